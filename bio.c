@@ -4,10 +4,13 @@
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
+// Only file system metadata is kept here; the data of files is kept
+// in the page cache (see pagecache.c).
 //
 // Interface:
 // * To get a buffer for a particular disk block, call diskBufferRead.
-// * After changing buffer data, call diskBufferWrite to write it to disk.
+// * After changing buffer data, call diskBufferWrite to write it to disk
+//     straight away, or diskBufferMarkDirty to leave it to the flusher.
 // * When done with the buffer, call diskBufferRelease.
 // * Do not use the buffer after calling diskBufferRelease.
 // * Only one process at a time can use a buffer,
@@ -17,6 +20,11 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Dirty buffers are written back by a flusher kernel thread, which sends
+// them to the disk in sector order in a single batch, or when the cache
+// runs out of clean buffers to recycle.  The flusher also writes back the
+// dirty pages of the page cache.
 
 #include "types.h"
 #include "defs.h"
@@ -26,10 +34,14 @@
 #include "fs.h"
 #include "buf.h"
 
+#define FLUSHINTERVAL	100				// Clock ticks between runs of the flusher
+#define FLUSHTHRESHOLD	(NBUF / 2)		// Number of dirty buffers that wakes the flusher early
+
 struct 
 {
 	Spinlock		Lock;
 	DiskBuffer		DiskBuffer[NBUF];
+	int				DirtyCount;			// Number of buffers marked dirty since the last flush
 
 	// Linked list of all buffers, through prev/next.
 	// head.Next is most recently used.
@@ -64,34 +76,43 @@ static DiskBuffer* diskBufferGet(uint32_t dev, uint32_t sectorNumber)
 	DiskBuffer *b;
 
 	spinlockAcquire(&diskBufferCache.Lock);
-
-	// Is the block already cached?
-	for (b = diskBufferCache.Head.Next; b != &diskBufferCache.Head; b = b->Next) 
+	for (;;)
 	{
-		if (b->Device == dev && b->SectorNumber == sectorNumber) 
+		// Is the block already cached?
+		for (b = diskBufferCache.Head.Next; b != &diskBufferCache.Head; b = b->Next) 
 		{
-			b->ReferenceCount++;
-			spinlockRelease(&diskBufferCache.Lock);
-			sleeplockAcquire(&b->Lock);
-			return b;
+			if (b->Device == dev && b->SectorNumber == sectorNumber) 
+			{
+				b->ReferenceCount++;
+				spinlockRelease(&diskBufferCache.Lock);
+				sleeplockAcquire(&b->Lock);
+				return b;
+			}
 		}
-	}
 
-	// Not cached; recycle an unused buffer.
-	for (b = diskBufferCache.Head.Previous; b != &diskBufferCache.Head; b = b->Previous) 
-	{
-		if (b->ReferenceCount == 0 && (b->Flags & B_DIRTY) == 0) 
+		// Not cached; recycle an unused buffer.
+		for (b = diskBufferCache.Head.Previous; b != &diskBufferCache.Head; b = b->Previous) 
 		{
-			b->Device = dev;
-			b->SectorNumber = sectorNumber;
-			b->Flags = 0;
-			b->ReferenceCount = 1;
-			spinlockRelease(&diskBufferCache.Lock);
-			sleeplockAcquire(&b->Lock);
-			return b;
+			if (b->ReferenceCount == 0 && (b->Flags & B_DIRTY) == 0) 
+			{
+				b->Device = dev;
+				b->SectorNumber = sectorNumber;
+				b->Flags = 0;
+				b->ReferenceCount = 1;
+				spinlockRelease(&diskBufferCache.Lock);
+				sleeplockAcquire(&b->Lock);
+				return b;
+			}
 		}
+
+		// Every buffer is in use or dirty.  Write the dirty ones back and try again.
+		spinlockRelease(&diskBufferCache.Lock);
+		if (diskBufferFlush() == 0)
+		{
+			panic("diskBufferGet: no buffers");
+		}
+		spinlockAcquire(&diskBufferCache.Lock);
 	}
-	panic("diskBufferGet: no buffers");
 }
 
 // Return a locked DiskBuffer with the contents of the indicated sector.
@@ -102,11 +123,23 @@ DiskBuffer *	diskBufferRead(uint32_t dev, uint32_t sectorNumber)
 	b = diskBufferGet(dev, sectorNumber);
 	if ((b->Flags & B_VALID) == 0) 
 	{
-		ideReadWrite(b);
+		blockDeviceReadWrite(b);
 	}
 	return b;
 }
 
+// Return a locked DiskBuffer for a sector that the caller is going to
+// overwrite completely, without reading the sector from disk first.
+
+DiskBuffer * diskBufferGetForWrite(uint32_t dev, uint32_t sectorNumber)
+{
+	DiskBuffer *b;
+
+	b = diskBufferGet(dev, sectorNumber);
+	b->Flags |= B_VALID;
+	return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void diskBufferWrite(DiskBuffer *b)
 {
@@ -115,7 +148,159 @@ void diskBufferWrite(DiskBuffer *b)
 		panic("diskBufferWrite");
 	}
 	b->Flags |= B_DIRTY;
-	ideReadWrite(b);
+	blockDeviceReadWrite(b);
+}
+
+// Mark b as needing to be written to disk without writing it now.  Must be locked.
+// The flusher writes it back later, together with the other dirty buffers.
+
+void diskBufferMarkDirty(DiskBuffer *b)
+{
+	if (!isHoldingSleeplock(&b->Lock))
+	{
+		panic("diskBufferMarkDirty");
+	}
+	spinlockAcquire(&diskBufferCache.Lock);
+	if ((b->Flags & B_DIRTY) == 0)
+	{
+		b->Flags |= B_DIRTY;
+		diskBufferCache.DirtyCount++;
+	}
+	spinlockRelease(&diskBufferCache.Lock);
+}
+
+// Pin b in the cache so that it is not recycled or written back by the
+// flusher until diskBufferUnpin is called.  Used by the log.
+
+void diskBufferPin(DiskBuffer *b)
+{
+	spinlockAcquire(&diskBufferCache.Lock);
+	b->ReferenceCount++;
+	spinlockRelease(&diskBufferCache.Lock);
+}
+
+void diskBufferUnpin(DiskBuffer *b)
+{
+	spinlockAcquire(&diskBufferCache.Lock);
+	b->ReferenceCount--;
+	spinlockRelease(&diskBufferCache.Lock);
+}
+
+// Write a batch of referenced buffers back to disk and release them.  The writes
+// are sorted by sector and queued at the disk together before waiting for any
+// of them.
+
+static void diskBufferWriteBatch(DiskBuffer **batch, int count)
+{
+	DiskBuffer *b;
+	int i;
+	int j;
+
+	// Sort the batch by sector so that the disk head sweeps across it once
+	for (i = 1; i < count; i++)
+	{
+		b = batch[i];
+		for (j = i; j > 0 && (batch[j - 1]->Device > b->Device || 
+							 (batch[j - 1]->Device == b->Device && batch[j - 1]->SectorNumber > b->SectorNumber)); j--)
+		{
+			batch[j] = batch[j - 1];
+		}
+		batch[j] = b;
+	}
+	for (i = 0; i < count; i++)
+	{
+		sleeplockAcquire(&batch[i]->Lock);
+		if (batch[i]->Flags & B_DIRTY)
+		{
+			blockDeviceQueueRequest(batch[i]);
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		blockDeviceWaitForRequest(batch[i]);
+		if (batch[i]->Flags & B_ERROR)
+		{
+			// Keep the changes so that the write is tried again later
+			batch[i]->Flags |= B_DIRTY;
+		}
+		diskBufferRelease(batch[i]);
+	}
+}
+
+// Write all dirty buffers that are not in use back to disk.
+// Returns the number of buffers written.
+
+int diskBufferFlush(void)
+{
+	DiskBuffer *batch[NBUF];
+	DiskBuffer *b;
+	int count = 0;
+
+	spinlockAcquire(&diskBufferCache.Lock);
+	for (b = diskBufferCache.Head.Next; b != &diskBufferCache.Head; b = b->Next) 
+	{
+		if (b->ReferenceCount == 0 && (b->Flags & B_DIRTY))
+		{
+			b->ReferenceCount++;
+			batch[count++] = b;
+		}
+	}
+	diskBufferCache.DirtyCount = 0;
+	spinlockRelease(&diskBufferCache.Lock);
+	diskBufferWriteBatch(batch, count);
+	return count;
+}
+
+// Write the listed sectors of dev back to disk if they are dirty in the cache.
+
+void diskBufferWriteBack(uint32_t dev, uint32_t *sectors, int count)
+{
+	DiskBuffer *batch[NBUF];
+	DiskBuffer *b;
+	int batchCount = 0;
+
+	spinlockAcquire(&diskBufferCache.Lock);
+	for (b = diskBufferCache.Head.Next; b != &diskBufferCache.Head; b = b->Next) 
+	{
+		if (b->Device != dev || (b->Flags & B_DIRTY) == 0)
+		{
+			continue;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			if (b->SectorNumber == sectors[i])
+			{
+				b->ReferenceCount++;
+				batch[batchCount++] = b;
+				break;
+			}
+		}
+	}
+	spinlockRelease(&diskBufferCache.Lock);
+	diskBufferWriteBatch(batch, batchCount);
+}
+
+// The flusher kernel thread.  Writes the dirty pages and buffers back every 
+// FLUSHINTERVAL ticks, or at the next tick after FLUSHTHRESHOLD buffers have
+// been marked dirty.  Pages go first, since writing them back can allocate
+// clusters and so change the FAT.
+
+void diskBufferFlusher(void)
+{
+	uint32_t start;
+
+	for (;;)
+	{
+		pageCacheFlush();
+		diskBufferFlush();
+		spinlockAcquire(&tickslock);
+		start = ticks;
+		while (ticks - start < FLUSHINTERVAL && diskBufferCache.DirtyCount < FLUSHTHRESHOLD)
+		{
+			sleep(&ticks, &tickslock);
+		}
+		spinlockRelease(&tickslock);
+	}
 }
 
 // Release a locked buffer.
@@ -0,0 +1,97 @@
+// Block device layer.
+//
+// The buffer cache and the log read and write sectors through this layer,
+// which passes each request on to the driver registered for the device 
+// number of the buffer.  A driver provides two functions:
+//
+//   QueueRequest starts syncing a locked buffer with the device, writing it
+//   if B_DIRTY is set and reading it otherwise.  It may return before the
+//   request has finished, so the driver keeps its own queue of requests.
+//
+//   WaitForRequest waits for a request to finish, which is when B_VALID is
+//   set and B_DIRTY is clear.  B_ERROR is set as well if the request failed.
+//
+// Device numbers 0 and 1 are IDE disks 0 and 1 and RAMDISKDEV is the RAM disk.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "buf.h"
+#include "blockdev.h"
+
+static BlockDevice * blockDevices[NBLOCKDEV];
+
+// Register the driver for a device number.  Called while the kernel starts.
+
+void blockDeviceRegister(uint32_t dev, BlockDevice * device)
+{
+	if (dev >= NBLOCKDEV || blockDevices[dev] != 0)
+	{
+		panic("blockDeviceRegister");
+	}
+	blockDevices[dev] = device;
+}
+
+// Get the number of sectors on a device, or 0 if the device is not present
+// or its size is not known.
+
+uint32_t blockDeviceCapacity(uint32_t dev)
+{
+	if (dev >= NBLOCKDEV || blockDevices[dev] == 0)
+	{
+		return 0;
+	}
+	return blockDevices[dev]->Capacity;
+}
+
+static BlockDevice * blockDeviceGet(DiskBuffer *b)
+{
+	if (b->Device >= NBLOCKDEV || blockDevices[b->Device] == 0)
+	{
+		panic("block device not present");
+	}
+	return blockDevices[b->Device];
+}
+
+// Start syncing a buffer with its device without waiting for it to finish.
+// The buffer must stay locked until blockDeviceWaitForRequest has been 
+// called for it.
+
+void blockDeviceQueueRequest(DiskBuffer *b)
+{
+	BlockDevice * device = blockDeviceGet(b);
+
+	if (!isHoldingSleeplock(&b->Lock))
+	{
+		panic("blockDeviceQueueRequest: DiskBuffer not locked");
+	}
+	if ((b->Flags & (B_VALID | B_DIRTY)) == B_VALID)
+	{
+		panic("blockDeviceQueueRequest: nothing to do");
+	}
+	if (device->Capacity != 0 && b->SectorNumber >= device->Capacity)
+	{
+		panic("blockDeviceQueueRequest: sector out of range");
+	}
+	b->Flags &= ~B_ERROR;
+	device->QueueRequest(b);
+}
+
+// Wait for a request started by blockDeviceQueueRequest to finish
+
+void blockDeviceWaitForRequest(DiskBuffer *b)
+{
+	blockDeviceGet(b)->WaitForRequest(b);
+}
+
+// Sync DiskBuffer with its device.
+// If B_DIRTY is set, write DiskBuffer to the device, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read DiskBuffer from the device, set B_VALID.
+
+void blockDeviceReadWrite(DiskBuffer *b)
+{
+	blockDeviceQueueRequest(b);
+	blockDeviceWaitForRequest(b);
+}
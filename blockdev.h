@@ -0,0 +1,9 @@
+// Block devices (see blockdev.c)
+
+struct _BlockDevice
+{
+	char *			Name;
+	uint32_t		Capacity;							// Number of sectors (0 if not known)
+	void			(*QueueRequest)(DiskBuffer *);		// Start syncing a buffer with the device
+	void			(*WaitForRequest)(DiskBuffer *);	// Wait for a request to finish
+};
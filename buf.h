@@ -1,4 +1,5 @@
 #define BSIZE 512  // block size
+#define SECTORSPERPAGE (PGSIZE / BSIZE)  // sectors in a page of the page cache
 
 struct _DiskBuffer
 {
@@ -15,4 +16,5 @@ struct _DiskBuffer
 
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ERROR 0x8  // the last request for the buffer failed
 
@@ -1,6 +1,8 @@
+struct _BlockDevice;
 struct _DiskBuffer;
 struct _Context;
 struct _File;
+struct _FileSystemOperations;
 struct _Device;
 struct _Pipe;
 struct _Process;
@@ -8,13 +10,23 @@ struct _RtcDate;
 struct _Spinlock;
 struct _Sleeplock;
 struct _Stat;
+struct _StatTime;
 struct _DirectoryEntry;
 struct _MountInfo;
+struct _Mount;
 struct _Cpu;
+struct _IoVector;
+struct _Ring;
+struct _SharedSegment;
+struct _SpawnAction;
+struct _TmpNode;
+struct _Vnode;
 
+typedef struct _BlockDevice		BlockDevice;
 typedef struct _DiskBuffer		DiskBuffer;
 typedef struct _Context			Context;
 typedef struct _File			File;
+typedef struct _FileSystemOperations	FileSystemOperations;
 typedef struct _Device			Device;
 typedef struct _Pipe			Pipe;
 typedef struct _Process			Process;
@@ -22,15 +34,37 @@ typedef struct _RtcDate			RtcDate;
 typedef struct _Spinlock		Spinlock;
 typedef struct _Sleeplock		Sleeplock;
 typedef struct _Stat			Stat;
+typedef struct _StatTime		StatTime;
 typedef struct _DirectoryEntry	DirectoryEntry;
 typedef struct _MountInfo		MountInfo;
+typedef struct _Mount			Mount;
 typedef struct _Cpu				Cpu;
+typedef struct _IoVector		IoVector;
+typedef struct _Ring			Ring;
+typedef struct _SharedSegment	SharedSegment;
+typedef struct _SpawnAction		SpawnAction;
+typedef struct _TmpNode			TmpNode;
+typedef struct _Vnode			Vnode;
 
 // bio.c
 void						diskBufferCacheInitialise(void);
 DiskBuffer*					diskBufferRead(uint32_t, uint32_t);
 void						diskBufferRelease(DiskBuffer*);
 void						diskBufferWrite(DiskBuffer*);
+DiskBuffer*					diskBufferGetForWrite(uint32_t, uint32_t);
+void						diskBufferMarkDirty(DiskBuffer*);
+int							diskBufferFlush(void);
+void						diskBufferFlusher(void);
+void						diskBufferPin(DiskBuffer*);
+void						diskBufferUnpin(DiskBuffer*);
+void						diskBufferWriteBack(uint32_t, uint32_t*, int);
+
+// blockdev.c
+void						blockDeviceRegister(uint32_t, BlockDevice*);
+uint32_t					blockDeviceCapacity(uint32_t);
+void						blockDeviceQueueRequest(DiskBuffer*);
+void						blockDeviceWaitForRequest(DiskBuffer*);
+void						blockDeviceReadWrite(DiskBuffer*);
 
 // console.c
 void						consoleInitialise(void);
@@ -40,6 +74,7 @@ void						panic(char*) __attribute__((noreturn));
 
 // exec.c
 int							exec(char*, char**);
+pde_t*						execLoad(char*, char*, char**, uint32_t*, uint32_t*, uint32_t*, char**);
 
 // file.c
 File*						allocateFileStructure(void);
@@ -47,21 +82,29 @@ void						fileClose(File*);
 File*						fileDup(File*);
 void						filesInitialise(void);
 int							fileRead(File*, char*, int n);
+int							fileReadAt(File*, char*, int n, uint32_t);
+int							fileReadDirectory(File*, DirectoryEntry*, int);
+int							fileSeek(File*, int, int);
+int							fileSplice(File*, File*, int n);
+int							fileStartRead(File*, uint32_t, uint32_t, char**, int);
 int							fileStat(File*, Stat*);
+int							fileTruncate(File*);
 int							fileWrite(File*, char*, int n);
+int							fileWriteAt(File*, char*, int n, uint32_t);
 
 // fs.c
-void						fsFat12Initialise(void);
-uint32_t					fsFat12Read(File *, unsigned char *, unsigned int);
-void						fsFat12Close(File *);
-File	*					fsFat12Open(const char *, const char *, int);
-// Assessment additions
-uint32_t 					fsFat12ReadRootDirectory(DirectoryEntry *);
+void						fsFat12Initialise(uint32_t);
+int							fsGetPathPart(char *, char *);
+void						toDosFileName(const char*, char*, unsigned int);
+
+// futex.c
+void						futexInitialise(void);
+int							futexWait(uint32_t, int);
+int							futexWake(uint32_t, int);
 
 // ide.c
 void						ideInitialise(void);
 void						ideInterruptHandler(void);
-void						ideReadWrite(DiskBuffer*);
 
 // ioApic.c
 void						ioApicEnable(int irq, int cpu);
@@ -86,10 +129,39 @@ void						localApicInitialise(void);
 void						localApicStartup(uint8_t, uint32_t);
 void						microDelay(int);
 
+// log.c
+void						logInitialise(uint32_t, uint32_t);
+void						logBeginOperation(void);
+void						logEndOperation(void);
+void						logWrite(DiskBuffer*);
+
+// mmap.c
+int							mmapMap(File*, int, int, int, int);
+int							mmapUnmap(uint32_t, int);
+int							mmapAttach(int);
+int							mmapDetach(uint32_t);
+int							mmapPageFault(uint32_t, int);
+int							mmapFaultIn(Process*, uint32_t, int, int);
+int							mmapFork(Process*, Process*);
+void						mmapRelease(Process*);
+
 // mp.c
 extern int					ismp;
 void						mpinit(void);
 
+// pagecache.c
+void						pageCacheInitialise(void);
+char*						pageCacheGet(Vnode*, uint32_t, int);
+int							pageCacheHold(char*);
+int							pageCacheRelease(char*);
+int							pageCacheReadAt(Vnode*, char*, int, uint32_t);
+int							pageCacheWriteAt(Vnode*, char*, int, uint32_t);
+int							pageCacheStartRead(Vnode*, uint32_t, uint32_t, char**, int);
+void						pageCacheWaitAndRelease(char*);
+void						pageCacheInvalidate(Vnode*);
+int							pageCacheFlush(void);
+void						pageCacheFlushVnode(Vnode*);
+
 // picirq.c
 void						picInitialise(void);
 
@@ -98,25 +170,55 @@ int							pipealloc(File**, File**);
 void						pipeclose(Pipe*, int);
 int							piperead(Pipe*, char*, int);
 int							pipewrite(Pipe*, char*, int);
+int							pipeWaitForSpace(Pipe*);
+int							pipeWriteNoWait(Pipe*, char*, int);
+int							pipeReadNoWait(Pipe*, char*, int);
 
 // Process.c
+int							clone(uint32_t, uint32_t, uint32_t);
+void						copyCwd(Process*, char*);
 int							cpuId(void);
+int							createKernelThread(void (*)(void), char *);
 void						exit(void);
 int							fork(void);
+void						freeOpenFileTable(Process*);
+int							growOpenFileTable(Process*, int);
 int							growProcess(int);
+int							join(uint32_t*);
 int							kill(int);
 Cpu*						myCpu(void);
 Process*					myProcess();
+Process*					myThreadGroup(void);
 void						processTableInitialise(void);
 void						processDump(void);
 void						scheduler(void) __attribute__((noreturn));
 void						sched(void);
 void						sleep(void*, Spinlock*);
+int							spawn(char*, char**, SpawnAction*, int);
 void						initialiseFirstUserProcess(void);
 int							wait(void);
 void						wakeup(void*);
+int							wakeupCount(void*, int);
 void						yield(void);
 
+// ramdisk.c
+void						ramDiskInitialise(void);
+void						ramDiskLoad(uint32_t);
+
+// ring.c
+int							ringSetup(int);
+int							ringDrain(int);
+void						ringPoll(void);
+
+// shm.c
+SharedSegment*				shmAttach(int, uint32_t*);
+void						shmDetach(SharedSegment*);
+int							shmGet(int, int);
+void						shmHold(SharedSegment*);
+void						shmInitialise(void);
+char*						shmPage(SharedSegment*, uint32_t);
+int							shmRemove(int);
+
 // swtch.asm
 void						swtch(Context**, Context*);
 
@@ -132,6 +234,7 @@ void						popCli(void);
 // sleeplock.c
 void						sleeplockAcquire(Sleeplock*);
 void						sleeplockRelease(Sleeplock*);
+int							sleeplockTryAcquire(Sleeplock*);
 int							isHoldingSleeplock(Sleeplock*);
 void						sleeplockInitialise(Sleeplock*, char*);
 
@@ -150,16 +253,25 @@ char*						strchr(char *, int);
 // syscall.c
 int							argint(int, int*);
 int							argptr(int, char**, int);
+int							argsrcptr(int, char**, int);
 int							argstr(int, char**);
+int							argstrcopy(int, char*, int);
 int							fetchint(uint32_t, int*);
+int							fetchptr(uint32_t, char**, int);
+int							fetchsrcptr(uint32_t, char**, int);
 int							fetchstr(uint32_t, char**);
+int							fetchstrcopy(uint32_t, char*, int);
 void						syscall(void);
 
 // timer.c
 void						timerinit(void);
 
+// tmpfs.c
+void						tmpfsInitialise(void);
+
 // trap.c
 void						interruptDescriptorTableInitialise(void);
+void						sysenterInitialise(void);
 extern uint32_t				ticks;
 void						trapVectorsInitialise(void);
 extern Spinlock				tickslock;
@@ -169,11 +281,24 @@ void						uartinit(void);
 void						uartintr(void);
 void						uartputc(int);
 
+// vfs.c
+void						vfsInitialise(void);
+void						vfsMount(const char *, FileSystemOperations *, uint32_t);
+File *						vfsOpen(const char *, const char *, int, int);
+Vnode *						vfsGetVnode(Mount *, uint32_t);
+void						vfsVnodeFilled(Vnode *);
+Vnode *						vfsDupVnode(Vnode *);
+void						vfsReleaseVnode(Vnode *);
+void						vfsStat(Vnode *, Stat *);
+int							vfsStatPath(const char *, const char *, Stat *);
+
 // vm.c
 void						initialiseGDT(void);
 void						allocateKernelVirtualMemory(void);
 pde_t*						setupKernelVirtualMemory(void);
 char*						mapVirtualAddressToKernelAddress(pde_t*, char*);
+int							mapUserPage(pde_t*, uint32_t, char*, int);
+char*						unmapUserPage(pde_t*, uint32_t);
 int							allocateMemoryAndPageTables(pde_t*, uint32_t, uint32_t);
 int							releaseUserPages(pde_t*, uint32_t, uint32_t);
 void						freeMemoryAndPageTable(pde_t*);
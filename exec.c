@@ -3,6 +3,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "x86.h"
@@ -21,7 +23,12 @@ void cleanupExec(pde_t * pageTable, File * exeFile)
 	fileClose(exeFile);
 }
 
-int exec(char *path, char **argv)
+// Load the program in path (relative to cwd) into a new page table and push
+// argv onto its stack.  The size of its memory, its stack pointer, its entry
+// point and the last part of path are returned.  Returns the new page table or
+// 0 on error.  Used by both exec and spawn.
+
+pde_t* execLoad(char *cwd, char *path, char **argv, uint32_t *size, uint32_t *stackPointer, uint32_t *entry, char **name)
 {
 	char *s;
 	char *last;
@@ -30,64 +37,59 @@ int exec(char *path, char **argv)
 	uint32_t ustack[3 + MAXARG + 1];
 	uint32_t memorySize;
 	pde_t *pgdir;
-	pde_t *oldpgdir;
- 	Process *curproc = myProcess();
-	int oldFilePosition;
+	uint32_t sectionHeaderOffset;
 		
-	File * exeFile = fsFat12Open(curproc->Cwd, path, 0);
+	File * exeFile = vfsOpen(cwd, path, 0, 0);
 	if (!exeFile)
 	{
-		return -1;
+		return 0;
 	}
 	exeFile->Readable = 1;
 	exeFile->Writable = 0;
 	// Get the IMAGE_FILE_HEADER structure (we skip the DOS Header)
-	exeFile->Position = 0x80;
-	int count = fileRead(exeFile, (char *)&imageFileHeader, sizeof(IMAGE_FILE_HEADER) + 4);
+	int count = fileReadAt(exeFile, (char *)&imageFileHeader, sizeof(IMAGE_FILE_HEADER) + 4, 0x80);
 	if (count != sizeof(IMAGE_FILE_HEADER) + 4)
 	{
 		fileClose(exeFile);
-		return -1;
+		return 0;
 	}
 	if (imageFileHeader.Signature[0] != 'P' || imageFileHeader.Signature[1] != 'E')
 	{
 		fileClose(exeFile);
-		return -1;
+		return 0;
 	}
-	exeFile->Position = 0x80 + sizeof(IMAGE_FILE_HEADER) + 4;
-	count = fileRead(exeFile, (char *)&imageFileHeader.OptionalHeader, sizeof(IMAGE_OPTIONAL_HEADER));
+	count = fileReadAt(exeFile, (char *)&imageFileHeader.OptionalHeader, sizeof(IMAGE_OPTIONAL_HEADER), 0x80 + sizeof(IMAGE_FILE_HEADER) + 4);
 	if (count != sizeof(IMAGE_OPTIONAL_HEADER))
 	{
 		fileClose(exeFile);
-		return -1;
+		return 0;
 	}
 	if ((pgdir = setupKernelVirtualMemory()) == 0)
 	{
 		fileClose(exeFile);
-		return -1;
+		return 0;
 	}
-	oldFilePosition = 0x80 + sizeof(IMAGE_FILE_HEADER) + 4 + imageFileHeader.FileHeader.SizeOfOptionalHeader;
+	sectionHeaderOffset = 0x80 + sizeof(IMAGE_FILE_HEADER) + 4 + imageFileHeader.FileHeader.SizeOfOptionalHeader;
 	memorySize = 0;
 	for (int i = 0; i < imageFileHeader.FileHeader.NumberOfSections; i++)
 	{
 		IMAGE_SECTION_HEADER sectionHeader;
-		exeFile->Position = oldFilePosition;
-		count = fileRead(exeFile, (char *)&sectionHeader, sizeof(IMAGE_SECTION_HEADER));
+		count = fileReadAt(exeFile, (char *)&sectionHeader, sizeof(IMAGE_SECTION_HEADER), sectionHeaderOffset);
 		if (count != sizeof(IMAGE_SECTION_HEADER))
 		{
-			fileClose(exeFile);
-			return -1;
+			cleanupExec(pgdir, exeFile);
+			return 0;
 		}
-		oldFilePosition = exeFile->Position;
+		sectionHeaderOffset += sizeof(IMAGE_SECTION_HEADER);
 		if ((memorySize = allocateMemoryAndPageTables(pgdir, memorySize, sectionHeader.VirtualAddress + sectionHeader.ActualSize)) == 0)
 		{
 			cleanupExec(pgdir, exeFile);
-			return -1;
+			return 0;
 		}
 		if (loadProgramSegmentIntoPageTable(pgdir, (char*)sectionHeader.VirtualAddress, exeFile, sectionHeader.OffsetInExeFile, sectionHeader.ActualSize) < 0)
 		{
 			cleanupExec(pgdir, exeFile);
-			return -1;
+			return 0;
 		}
 	}
 	fileClose(exeFile);
@@ -97,8 +99,8 @@ int exec(char *path, char **argv)
 	memorySize = PGROUNDUP(memorySize);
 	if ((memorySize = allocateMemoryAndPageTables(pgdir, memorySize, memorySize + 2 * PGSIZE)) == 0)
 	{
-		cleanupExec(pgdir, exeFile);
-		return -1;
+		freeMemoryAndPageTable(pgdir);
+		return 0;
 	}
 	clearPTEU(pgdir, (char*)(memorySize - 2 * PGSIZE));
     sp = memorySize;
@@ -108,14 +110,14 @@ int exec(char *path, char **argv)
 	{
 		if (argc >= MAXARG)
 		{
-			cleanupExec(pgdir, exeFile);
-			return -1;
+			freeMemoryAndPageTable(pgdir);
+			return 0;
 		}
 		sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
         if (copyToUserVirtualMemory(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
 		{
-			cleanupExec(pgdir, exeFile);
-			return -1;
+			freeMemoryAndPageTable(pgdir);
+			return 0;
 		}
 	    ustack[3+argc] = sp;
 	}
@@ -128,11 +130,11 @@ int exec(char *path, char **argv)
     sp -= (3+argc+1) * 4;
     if (copyToUserVirtualMemory(pgdir, sp, ustack, (3+argc+1)*4) < 0)
 	{
-		cleanupExec(pgdir, exeFile);
-		return -1;
+		freeMemoryAndPageTable(pgdir);
+		return 0;
 	}
 
-	// Save program name for debugging.
+	// Find the program name for debugging.
 	for (last = s = path; *s; s++)
 	{
 		if (*s == '/' || *s == '\\')
@@ -140,13 +142,43 @@ int exec(char *path, char **argv)
 			last = s + 1;
 		}
 	}
-	safestrcpy(curproc->Name, last, sizeof(curproc->Name));
+	*name = last;
+	*size = memorySize;
+	*stackPointer = sp;
+	*entry = imageFileHeader.OptionalHeader.AddressOfEntryPoint;
+	return pgdir;
+}
+
+int exec(char *path, char **argv)
+{
+	char *name;
+	uint32_t sp;
+	uint32_t entry;
+	uint32_t memorySize;
+	pde_t *pgdir;
+	pde_t *oldpgdir;
+	char cwd[MAXCWDSIZE];
+ 	Process *curproc = myProcess();
+
+	// The memory of a process with threads cannot be replaced under them
+	if (curproc->ThreadGroup != curproc || curproc->ThreadCount > 0)
+	{
+		return -1;
+	}
+	copyCwd(curproc, cwd);
+	if ((pgdir = execLoad(cwd, path, argv, &memorySize, &sp, &entry, &name)) == 0)
+	{
+		return -1;
+	}
+	safestrcpy(curproc->Name, name, sizeof(curproc->Name));
 
 	// Commit to the user image.
+	mmapRelease(curproc);
 	oldpgdir = curproc->PageTable;
 	curproc->PageTable = pgdir;
 	curproc->MemorySize = memorySize;
-	curproc->Trapframe->eip = imageFileHeader.OptionalHeader.AddressOfEntryPoint;
+	curproc->Ring = 0;
+	curproc->Trapframe->eip = entry;
 	curproc->Trapframe->esp = sp;
     switchToUserVirtualMemory(curproc);
     freeMemoryAndPageTable(oldpgdir);
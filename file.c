@@ -1,17 +1,30 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "x86.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "vfs.h"
+#include "fcntl.h"
+#include "buf.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 Device devices[NDEV];
 
+// Unused file structures are kept on a free list, so the lock is only held
+// to take one off the list or put one back.  Reference counts are changed 
+// with atomicAdd and do not need the lock.
+
 struct
 {
 	Spinlock		Lock;
 	File			File[NFILE];
+	File *			Free;
 } FileTable;
 
 void filesInitialise(void)
@@ -20,9 +33,11 @@ void filesInitialise(void)
 
 	spinlockInitialise(&FileTable.Lock, "FileTable");
 	spinlockAcquire(&FileTable.Lock);
-	for (f = FileTable.File; f < FileTable.File + NFILE; f++)
+	for (f = FileTable.File + NFILE - 1; f >= FileTable.File; f--)
 	{
 		f->ReferenceCount = 0;
+		f->NextFree = FileTable.Free;
+		FileTable.Free = f;
 	}
 	spinlockRelease(&FileTable.Lock);
 }
@@ -33,61 +48,56 @@ File* allocateFileStructure(void)
 	File *f;
 
 	spinlockAcquire(&FileTable.Lock);
-	for (f = FileTable.File; f < FileTable.File + NFILE; f++) 
+	if ((f = FileTable.Free) != 0)
 	{
-		if (f->ReferenceCount == 0) 
-		{
-			f->ReferenceCount = 1;
-			spinlockRelease(&FileTable.Lock);
-			return f;
-		}
+		FileTable.Free = f->NextFree;
+		f->ReferenceCount = 1;
 	}
 	spinlockRelease(&FileTable.Lock);
-	return 0;
+	return f;
 }
 
-// Increment ref count for file f.
+// Increment ref count for file f.  The caller must hold a reference to it.
 File* fileDup(File *f)
 {
-	spinlockAcquire(&FileTable.Lock);
-	if (f->ReferenceCount < 1)
+	if (atomicAdd(&f->ReferenceCount, 1) < 1)
 	{
 		panic("fileDup");
 	}
-	f->ReferenceCount++;
-	spinlockRelease(&FileTable.Lock);
 	return f;
 }
 
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void fileClose(File *f)
 {
-	File ff;
+	int referenceCount = atomicAdd(&f->ReferenceCount, -1);
 
-	spinlockAcquire(&FileTable.Lock);
-	if (f->ReferenceCount < 1)
+	if (referenceCount < 1)
 	{
 		panic("fileClose");
 	}
-	if (--f->ReferenceCount > 0) 
+	if (referenceCount > 1) 
 	{
-		spinlockRelease(&FileTable.Lock);
 		return;
 	}
-	ff = *f;
-	f->ReferenceCount = 0;
-	f->Type = FD_NONE;
-	spinlockRelease(&FileTable.Lock);
-	
-	if (ff.Type == FD_PIPE)
+	// That was the last reference, so nothing else can be using f
+	if (f->Type == FD_PIPE)
 	{
-		pipeclose(ff.Pipe, ff.Writable);
+		pipeclose(f->Pipe, f->Writable);
 	}
-	else if (ff.Type == FD_FILE || ff.Type == FD_DIR) 
+	else if (f->Type == FD_FILE || f->Type == FD_DIR) 
 	{
-		fsFat12Close(&ff);
+		if (f->Vnode->Mount->Operations->Close != 0)
+		{
+			f->Vnode->Mount->Operations->Close(f);
+		}
+		vfsReleaseVnode(f->Vnode);
 	}
-
+	f->Type = FD_NONE;
+	spinlockAcquire(&FileTable.Lock);
+	f->NextFree = FileTable.Free;
+	FileTable.Free = f;
+	spinlockRelease(&FileTable.Lock);
 }
 
 // Get metadata about file f.
@@ -95,9 +105,14 @@ int fileStat(File *f, Stat *st)
 {
 	if (f->Type == FD_FILE || f->Type == FD_DIR) 
 	{
-		//    ilock(f->ip);
-		//    stati(f->ip, st);
-		//    iunlock(f->ip);
+		vfsStat(f->Vnode, st);
+		return 0;
+	}
+	if (f->Type == FD_DEVICE)
+	{
+		memset(st, 0, sizeof(*st));
+		st->type = T_DEV;
+		st->dev = f->DeviceID;
 		return 0;
 	}
 	return -1;
@@ -122,15 +137,102 @@ int fileRead(File *f, char *addr, int n)
 	}
 	else if (f->Type == FD_FILE || f->Type == FD_DIR)
 	{
-		r = fsFat12Read(f, (unsigned char *)addr, n);
+		if (n < 0)
+		{
+			return -1;
+		}
+		if (f->Eof)
+		{
+			return 0;
+		}
+		r = f->Vnode->Mount->Operations->ReadAt(f->Vnode, addr, n, f->Position);
+		if (r < 0)
+		{
+			return -1;
+		}
+		f->Position += r;
+		if (r < n || (f->Type == FD_FILE && f->Position >= f->Vnode->Size))
+		{
+			f->Eof = 1;
+		}
 		return r;
 	}
 	panic("fileRead");
 }
 
+// Read from file f at the given offset without changing its position.
+// Only disk files and directories can be read in this way.
+
+int fileReadAt(File *f, char *addr, int n, uint32_t offset)
+{
+	if (f->Readable == 0 || n < 0)
+	{
+		return -1;
+	}
+	if (f->Type == FD_FILE || f->Type == FD_DIR)
+	{
+		return f->Vnode->Mount->Operations->ReadAt(f->Vnode, addr, n, offset);
+	}
+	return -1;
+}
+
+// Write to file f at the given offset without changing its position.
+// Only files can be written in this way.
+
+int fileWriteAt(File *f, char *addr, int n, uint32_t offset)
+{
+	if (f->Writable == 0 || n < 0)
+	{
+		return -1;
+	}
+	if (f->Type == FD_FILE)
+	{
+		return f->Vnode->Mount->Operations->WriteAt(f->Vnode, addr, n, offset);
+	}
+	return -1;
+}
+
+// Set the position of file f.  Returns the new position or -1 if the file
+// cannot be positioned (for example, pipes and devices).
+
+int fileSeek(File *f, int offset, int whence)
+{
+	int position;
+
+	if (f->Type != FD_FILE && f->Type != FD_DIR)
+	{
+		return -1;
+	}
+	switch (whence)
+	{
+		case SEEK_SET:
+			position = offset;
+			break;
+
+		case SEEK_CUR:
+			position = f->Position + offset;
+			break;
+
+		case SEEK_END:
+			position = f->Vnode->Size + offset;
+			break;
+
+		default:
+			return -1;
+	}
+	if (position < 0)
+	{
+		return -1;
+	}
+	f->Position = position;
+	f->Eof = (f->Type == FD_FILE && f->Position >= f->Vnode->Size);
+	return position;
+}
+
 // Write to file f.
 int fileWrite(File *f, char *addr, int n)
 {
+	int r;
 
 	if (f->Writable == 0)
 	{
@@ -144,7 +246,171 @@ int fileWrite(File *f, char *addr, int n)
 	{
 		return pipewrite(f->Pipe, addr, n);
 	}
-	// Code to write to a disk file needs to be added
+	else if (f->Type == FD_FILE)
+	{
+		r = f->Vnode->Mount->Operations->WriteAt(f->Vnode, addr, n, f->Position);
+		if (r > 0)
+		{
+			f->Position += r;
+			f->Eof = f->Position >= f->Vnode->Size;
+		}
+		return r;
+	}
+	else if (f->Type == FD_DIR)
+	{
+		return -1;
+	}
 	panic("fileWrite");
 }
 
+// Read up to count directory entries from directory f.  Returns the number 
+// of entries read, 0 at the end of the directory or -1 if f is not a directory.
+
+int fileReadDirectory(File *f, DirectoryEntry *directoryEntries, int count)
+{
+	if (f->Type == FD_DIR)
+	{
+		return f->Vnode->Mount->Operations->ReadDirectory(f, directoryEntries, count);
+	}
+	return -1;
+}
+
+// Truncate file f to zero length
+
+int fileTruncate(File *f)
+{
+	if (f->Writable == 0 || f->Type != FD_FILE)
+	{
+		return -1;
+	}
+	if (f->Vnode->Mount->Operations->Truncate(f->Vnode) < 0)
+	{
+		return -1;
+	}
+	f->Position = 0;
+	f->Eof = 0;
+	return 0;
+}
+
+// Start reading part of file f into the page cache without waiting for the
+// reads to finish.  The pages for the reads that were started are returned in
+// pages and must each be passed to pageCacheWaitAndRelease.  Returns the 
+// number of reads started, which is 0 if the file is not on a disk.
+
+int fileStartRead(File *f, uint32_t offset, uint32_t length, char **pages, int maxPages)
+{
+	if (f->Readable == 0 || f->Type != FD_FILE || f->Vnode->Mount->Operations->MapPage == 0)
+	{
+		return 0;
+	}
+	return pageCacheStartRead(f->Vnode, offset, length, pages, maxPages);
+}
+
+// Move up to n bytes from file in to file out without copying through user space.
+// At least one of the files must be a pipe.  Data read from a disk file is
+// written into the pipe straight from the page cache; data from other files
+// is staged through a kernel buffer, as is data from a pipe to a file.  No
+// page or buffer is held while waiting for room in a pipe, since the process
+// reading the pipe may need it.
+
+int fileSplice(File *in, File *out, int n)
+{
+	char * page;
+	uint32_t offset;
+	uint32_t length;
+	int count;
+	int written;
+	int total = 0;
+	char buffer[BSIZE];
+
+	if (in->Readable == 0 || out->Writable == 0 || n < 0)
+	{
+		return -1;
+	}
+	if (in->Type == FD_FILE && out->Type == FD_PIPE && in->Vnode->Mount->Operations->MapPage != 0)
+	{
+		while (total < n && in->Position < in->Vnode->Size)
+		{
+			if (pipeWaitForSpace(out->Pipe) < 0)
+			{
+				return total > 0 ? total : -1;
+			}
+			if ((page = pageCacheGet(in->Vnode, in->Position / PGSIZE, 0)) == 0)
+			{
+				break;
+			}
+			offset = in->Position % PGSIZE;
+			length = min(PGSIZE - offset, in->Vnode->Size - in->Position);
+			if (length > n - total)
+			{
+				length = n - total;
+			}
+			written = pipeWriteNoWait(out->Pipe, page + offset, length);
+			pageCacheRelease(page);
+			if (written < 0)
+			{
+				return total > 0 ? total : -1;
+			}
+			in->Position += written;
+			total += written;
+		}
+		if (in->Position >= in->Vnode->Size)
+		{
+			in->Eof = 1;
+		}
+		return total;
+	}
+	if (in->Type == FD_FILE && out->Type == FD_PIPE)
+	{
+		while (total < n)
+		{
+			count = fileRead(in, buffer, min(n - total, BSIZE));
+			if (count <= 0)
+			{
+				break;
+			}
+			written = pipewrite(out->Pipe, buffer, count);
+			if (written < 0)
+			{
+				return total > 0 ? total : -1;
+			}
+			total += written;
+		}
+		return total;
+	}
+	if (in->Type == FD_PIPE && (out->Type == FD_PIPE || out->Type == FD_DEVICE || out->Type == FD_FILE))
+	{
+		// The pipe lock cannot be held while the destination sleeps, so the data
+		// is staged through a kernel buffer rather than the caller's memory.
+		// Like read, only the first read of the pipe waits for data; after that,
+		// only what is already in the pipe is moved.
+		while (total < n)
+		{
+			if (total == 0)
+			{
+				count = piperead(in->Pipe, buffer, min(n - total, BSIZE));
+			}
+			else
+			{
+				count = pipeReadNoWait(in->Pipe, buffer, min(n - total, BSIZE));
+			}
+			if (count <= 0)
+			{
+				break;
+			}
+			written = fileWrite(out, buffer, count);
+			if (written < 0)
+			{
+				return total > 0 ? total : -1;
+			}
+			total += written;
+			if (written < count)
+			{
+				break;
+			}
+		}
+		return total;
+	}
+	return -1;
+}
+
@@ -4,21 +4,21 @@ enum FileType
 	FD_PIPE, 
 	FD_FILE, 
 	FD_DIR, 
-	FD_DEVICE 
+	FD_DEVICE
 };
 
 struct _File 
 {
   enum FileType			 Type;
-  int					 ReferenceCount; 
+  int					 ReferenceCount;		// Changed with atomicAdd
+  File *				 NextFree;				// Next unused file structure (when ReferenceCount is 0)
   char					 Readable;
   char					 Writable;
   Pipe *				 Pipe;
-  DirectoryEntry		 DirectoryEntry;
+  Vnode *				 Vnode;					// File or directory (FD_FILE and FD_DIR)
   char					 Name[256];
   uint32_t				 Eof;
   uint32_t				 Position;
-  uint32_t				 Size;
   uint32_t				 DeviceID;
 };
 
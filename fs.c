@@ -3,12 +3,13 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "vfs.h"
 #include "bpb.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -20,18 +21,132 @@
 #define tolower(c)	(isupper(c) ? c + 'a' - 'A' : c)
 #define toupper(c)	(islower(c) ? c + 'A' - 'a' : c)
 
+#define MAXRUNCLUSTERS		256			// Clusters allocated in one operation, so that at most three FAT sectors change
+#define LOGFILENAME			"FATLOG.SYS"	// Hidden file in the root directory holding the metadata log
+#define FREEMAPCLUSTERS		32768		// Clusters covered by the free cluster bitmap at a time
+#define MAXFREEEXTENTS		64			// Runs of free clusters kept in the free extent index
+#define MAXROOTENTRIES		512			// Largest fixed root directory held in memory
+#define NDIRECTORYINDEXES	8			// Directories whose names are indexed at a time
+#define MAXINDEXEDNAMES		256			// Names held in the index of one directory
+#define NAMEHASHSIZE		64			// Chains in the hash index of a directory
+
+// A run of free clusters
+typedef struct _FreeExtent
+{
+	uint32_t	Start;
+	uint32_t	Length;
+} FreeExtent;
+
+// A name in a directory name index.  Each file is indexed under its short name
+// and, if it has one, under its long name.
+
+typedef struct _IndexedName
+{
+	uint32_t	Hash;			// Hash of the name (case-folded for long names)
+	uint32_t	NameOffset;		// Offset in the directory of the first entry holding the name
+	uint32_t	EntryOffset;	// Offset in the directory of the short entry of the file
+	bool		Long;			// The name is a long filename
+	int16_t		Next;			// Next name in the same chain (-1 ends a chain)
+} IndexedName;
+
+// An index of the names in a directory, so that a name can be looked up
+// without reading through the directory and putting its long names together
+
+typedef struct _DirectoryIndex
+{
+	bool			Valid;
+	uint32_t		Directory;		// First cluster of the directory (0 for the fixed root)
+	bool			Complete;		// Every name in the directory is in the index
+	uint32_t		LastUsed;
+	int				Count;
+	int16_t			Chain[NAMEHASHSIZE];
+	IndexedName		Name[MAXINDEXEDNAMES];
+} DirectoryIndex;
+
+// Reads the entries of a directory in place in the buffer cache, following the
+// cluster chain of the directory.  The sector holding the last entry returned
+// stays locked until the iterator moves past it or fsFat12EndDirectory is called.
+
+typedef struct _DirectoryIterator
+{
+	Vnode *			Directory;
+	uint32_t		Offset;			// Offset in the directory of the next entry
+	uint32_t		Cluster;		// Cluster holding the next entry (not used for the fixed root)
+	bool			NextCluster;	// The next entry is at the start of the cluster after Cluster
+	uint32_t		Sector;			// Sector holding the last entry returned
+	DiskBuffer *	Buffer;			// Buffer holding Sector (0 if none is held)
+} DirectoryIterator;
+
 BootSector bootSector;
 MountInfo  mountInfo;
 
-// File Allocation Table 
-unsigned char fat[512 * MAXFATSIZE];
+// The FAT is not held in memory.  Its sectors are read through the buffer
+// cache when they are needed, so that large FAT16 and FAT32 volumes do not
+// take more memory or longer to mount than small ones.
+//
+// fatLock is held while the FAT is being changed.  fatChanged lists the
+// sectors of the first copy of the FAT that have been changed since they 
+// were last copied to the other copies.
+static Sleeplock fatLock;
+static uint32_t fatChanged[MAXOPBLOCKS];
+static int fatChangedCount;
+
+// Free space.  freeClusters has a bit set for each free cluster in the part 
+// of the disk from freeMapStart and is kept up to date as the FAT is changed.
+// When that part of the disk is full, the bitmap is moved on to the next part.
+// freeExtents lists runs of free clusters in the bitmap and is rebuilt from
+// freeClusters when it is next needed after the FAT has changed.  If there
+// are more than MAXFREEEXTENTS runs, only the longest are kept.
+static uint32_t freeClusters[FREEMAPCLUSTERS / 32];
+static uint32_t freeMapStart;
+static FreeExtent freeExtents[MAXFREEEXTENTS];
+static int freeExtentCount;
+static int freeExtentsValid;
 
-// Stage 4 (root directory)
-static int previousTimes = 0;
+// The fixed root directory of a FAT12 or FAT16 volume is small, so it is read
+// into memory when the volume is mounted.  The copy is updated whenever a 
+// sector of the root directory is changed.
+static DirectoryEntry rootDirectory[MAXROOTENTRIES];
+static bool rootInMemory;
 
-void fsFat12Initialise(void)
+// The names in the most recently used directories are indexed.  The indexes
+// are built when a directory is first searched and new entries are added to
+// them.  directoryIndexLock is held while they are used.
+static DirectoryIndex directoryIndexes[NDIRECTORYINDEXES];
+static uint32_t directoryIndexClock;
+static Sleeplock directoryIndexLock;
+
+// Long names read while the indexes are used are put together here rather
+// than on the kernel stack.  directoryIndexLock must be held.
+static char indexLongName[MAXLONGNAME + 1];
+
+// createLock is held while a file is looked up and created, so that two
+// processes cannot both add a file with the same name, or the same short name,
+// to a directory.
+static Sleeplock createLock;
+
+static FileSystemOperations fsFat12Operations;
+
+static uint32_t fsFat12SectorAtOffset(Vnode * vnode, uint32_t offset);
+static uint32_t fsFat12ClusterToSector(uint32_t cluster);
+static uint32_t fsFat12FindCluster(Vnode * vnode, uint32_t clusterIndex);
+uint32_t fsFat12GetNextCluster(uint32_t cluster);
+static uint32_t fsFat12EntryCluster(DirectoryEntry * directoryEntry);
+static void fsFat12RootVnode(Vnode * vnode);
+static int fsFat12ReadAt(Vnode * vnode, char * buffer, int length, uint32_t offset);
+static bool fsFat12FindInDirectory(Vnode * directory, const char* nameToFind, DirectoryEntry * foundDirectoryEntry, uint32_t * entrySector, uint32_t * entryOffset);
+static uint32_t fsFat12LogStart(DirectoryEntry * logEntry);
+static bool fsFat12IsShortName(const char * name);
+static uint32_t fsFat12GetClusterEntry(uint32_t cluster);
+static void fsFat12BuildFreeClusters(uint32_t start);
+static void fsFat12LoadRootDirectory(void);
+
+// Mount the file system on block device dev
+
+void fsFat12Initialise(uint32_t dev)
 {
-	DiskBuffer * bpb = diskBufferRead(0, 0);
+	mountInfo.Device = dev;
+	DiskBuffer * bpb = diskBufferRead(mountInfo.Device, 0);
 	memmove(&bootSector, bpb->Data, sizeof(BootSector));
 	diskBufferRelease(bpb);
 	// Store mount info
@@ -39,26 +154,65 @@ void fsFat12Initialise(void)
 	{
 		panic("Sector size != 512");
 	}
-	mountInfo.NumSectors = bootSector.Bpb.NumSectors;
+	// FAT32 volumes and large FAT16 volumes keep the sizes in the 32-bit fields
+	mountInfo.NumSectors = bootSector.Bpb.NumSectors != 0 ? bootSector.Bpb.NumSectors : bootSector.Bpb.LongSectors;
 	mountInfo.FatOffset = bootSector.Bpb.ReservedSectors;
-	mountInfo.FatSize = bootSector.Bpb.SectorsPerFat;
+	mountInfo.FatSize = bootSector.Bpb.SectorsPerFat != 0 ? bootSector.Bpb.SectorsPerFat : bootSector.BpbExt.SectorsPerFat32;
 	mountInfo.NumRootEntries = bootSector.Bpb.NumDirEntries;
-	mountInfo.RootOffset = (bootSector.Bpb.NumberOfFats * bootSector.Bpb.SectorsPerFat) + bootSector.Bpb.ReservedSectors;
+	mountInfo.RootOffset = (bootSector.Bpb.NumberOfFats * mountInfo.FatSize) + bootSector.Bpb.ReservedSectors;
 	mountInfo.RootSize = (bootSector.Bpb.NumDirEntries * 32) / bootSector.Bpb.BytesPerSector;
 	mountInfo.ClusterSize = bootSector.Bpb.SectorsPerCluster * bootSector.Bpb.BytesPerSector;
-	// Read the FAT into memory
-	if (mountInfo.FatSize > MAXFATSIZE)
+
+	// The type of FAT is decided by the number of clusters, as Microsoft's 
+	// specification says.  The number of clusters is then limited by the 
+	// number of entries in the FAT.
+	mountInfo.NumClusters = (mountInfo.NumSectors - mountInfo.RootOffset - mountInfo.RootSize) / bootSector.Bpb.SectorsPerCluster;
+	if (mountInfo.NumClusters < 4085)
+	{
+		mountInfo.FatType = 12;
+	}
+	else if (mountInfo.NumClusters < 65525)
+	{
+		mountInfo.FatType = 16;
+	}
+	else
+	{
+		mountInfo.FatType = 32;
+	}
+	if (mountInfo.NumClusters > (mountInfo.FatSize * 512 * 8) / mountInfo.FatType - 2)
+	{
+		mountInfo.NumClusters = (mountInfo.FatSize * 512 * 8) / mountInfo.FatType - 2;
+	}
+	// A FAT32 root directory is a cluster chain like any other directory
+	mountInfo.RootCluster = mountInfo.FatType == 32 ? bootSector.BpbExt.RootCluster : 0;
+	sleeplockInitialise(&fatLock, "fat");
+	sleeplockInitialise(&directoryIndexLock, "directory index");
+	sleeplockInitialise(&createLock, "create");
+
+	// If there is a metadata log, recover from it before looking at the rest of
+	// the FAT.  The log file is made when the disk image is built (see makefile);
+	// it is never created here, so mounting does not change the volume.  Without
+	// it, the volume is used without a log and is not protected against a crash.
+	Vnode root;
+	DirectoryEntry logEntry;
+	uint32_t logEntrySector;
+	uint32_t logEntryOffset;
+	uint32_t logStart = 0;
+	fsFat12RootVnode(&root);
+	if (fsFat12FindInDirectory(&root, LOGFILENAME, &logEntry, &logEntrySector, &logEntryOffset))
 	{
-		panic("FAT too large");
+		if ((logStart = fsFat12LogStart(&logEntry)) == 0)
+		{
+			cprintf("fs: %s cannot be used as the metadata log\n", LOGFILENAME);
+		}
 	}
-	uint32_t fatOffset = 0;
-	for (int fatSector = 0; fatSector < mountInfo.FatSize; fatSector++)
+	if (logStart != 0)
 	{
-		DiskBuffer * fatContents = diskBufferRead(0, fatSector + mountInfo.FatOffset);
-		memmove(&fat + fatOffset, fatContents->Data, 512);
-		diskBufferRelease(fatContents);
-		fatOffset += 512;
+		logInitialise(mountInfo.Device, logStart);
 	}
+	fsFat12LoadRootDirectory();
+	fsFat12BuildFreeClusters(2);
+	vfsMount("/", &fsFat12Operations, dev);
 }
 
 // Helper function. Converts filename to DOS 8.3 file format
@@ -149,7 +303,7 @@ uint32_t fsFat12ReadCluster(uint32_t deviceNumber, uint32_t clusterNumber, unsig
 	readSize = size;
 	while (size > 0)
 	{
-		sectorContents = diskBufferRead(0, sector);
+		sectorContents = diskBufferRead(deviceNumber, sector);
 		sectorContentsSize = bootSector.Bpb.BytesPerSector;
 		if (size < bootSector.Bpb.BytesPerSector)
 		{
@@ -165,345 +319,1830 @@ uint32_t fsFat12ReadCluster(uint32_t deviceNumber, uint32_t clusterNumber, unsig
 	return readSize;
 }
 
-File * fsFat12CreateFileStructure(DirectoryEntry * directoryEntry, const char * filename)
+// Get the first cluster of a file or directory from its directory entry.  The 
+// high 16 bits are only used on FAT32.
+
+static uint32_t fsFat12EntryCluster(DirectoryEntry * directoryEntry)
 {
-	File * file = allocateFileStructure();
-	if (file == 0)
+	uint32_t cluster = directoryEntry->FirstCluster;
+
+	if (mountInfo.FatType == 32)
 	{
-		return 0;
+		cluster |= (uint32_t)directoryEntry->FirstClusterHiBytes << 16;
 	}
-	strcpy(file->Name, filename);
-	memmove(&file->DirectoryEntry, directoryEntry, sizeof(DirectoryEntry));
-	file->Size = directoryEntry->FileSize;
-	file->Position = 0;
-	file->Eof = 0;
-	file->Type = FD_FILE;
-	return file;
+	return cluster;
 }
 
+static void fsFat12SetEntryCluster(DirectoryEntry * directoryEntry, uint32_t cluster)
+{
+	directoryEntry->FirstCluster = cluster & 0xFFFF;
+	if (mountInfo.FatType == 32)
+	{
+		directoryEntry->FirstClusterHiBytes = cluster >> 16;
+	}
+}
 
-// Locates file or directory in root directory
+// Get the first cluster of a file or directory.  A directory entry for a 
+// directory with a first cluster of 0 (for example, "..") refers to the root
+// directory, which is in a fixed region after the FATs on FAT12 and FAT16
+// (a first cluster of 0 is used for this) and in a cluster chain on FAT32.
 
-bool fsFat12FindInRootDirectory(const char* nameToFind, DirectoryEntry * foundDirectoryEntry)
+static uint32_t fsFat12FirstCluster(Vnode * vnode)
 {
-	DiskBuffer * buf;
-	DirectoryEntry * directoryEntry;
-	// Get 8.3 directory name
-	char dosFileName[12];
-	toDosFileName(nameToFind, dosFileName, 11);
-	dosFileName[11] = 0;
+	uint32_t cluster = fsFat12EntryCluster(&vnode->DirectoryEntry);
 
-	int rootDirectorySectorCount = mountInfo.NumRootEntries / 16;
-	for (int sector = 0; sector < rootDirectorySectorCount; sector++)
+	if (cluster == 0 && vnode->Directory)
 	{
-		// Read in sector of root directory
-		buf = diskBufferRead(0, mountInfo.RootOffset + sector);
-		// get directory entry info
-		directoryEntry = (DirectoryEntry *)buf->Data;
+		cluster = mountInfo.RootCluster;
+	}
+	return cluster;
+}
 
-		// 16 entries per sector
-		for (int i = 0; i<16; i++)
-		{
-			if (*(directoryEntry->Filename) != 0)
-			{
-				// get filename from directory entry
-				char name[12];
-				memmove(name, directoryEntry->Filename, 11);
-				name[11] = 0;
+// Does a vnode refer to the fixed root directory of FAT12 or FAT16?
 
-				// Is there a match?
-				if (strcmp(dosFileName, name) == 0)
-				{
-					// Found it
-					memmove((char *)foundDirectoryEntry, (char *)directoryEntry, sizeof(DirectoryEntry));
-					diskBufferRelease(buf);
-					return 1;
-				}
-			}
-			//! go to next directory
-			directoryEntry++;
-		}
-		diskBufferRelease(buf);
-	}
-	return 0;
+static bool fsFat12IsFixedRoot(Vnode * vnode)
+{
+	return vnode->Directory && fsFat12FirstCluster(vnode) == 0;
 }
 
-// Locate a file or folder in subdirectory. 
-//
+// The root directory does not have a directory entry of its own, so make one up
 
-bool fsFat12FindInSubDirectory(const char* nameToFind, DirectoryEntry * foundDirectoryEntry)
+static void fsFat12RootDirectoryEntry(DirectoryEntry * directoryEntry)
 {
-	unsigned char buf[512];
+	memset(directoryEntry, 0, sizeof(DirectoryEntry));
+	directoryEntry->Attrib = 0x10;
+	fsFat12SetEntryCluster(directoryEntry, mountInfo.RootCluster);
+}
 
-	// Take a copy of the directory entry for the sub-directory we are going to search
-	DirectoryEntry currentDirectory;
-	memmove((char *)&currentDirectory, (char *)foundDirectoryEntry, sizeof(DirectoryEntry));
-	
-	// Create a file structure for it - we don' bother with a name
-	File * subDirectory = fsFat12CreateFileStructure(&currentDirectory, "");
+// Fill in a vnode from the directory entry of a file or directory.  entrySector
+// and entryOffset give the location of the directory entry on disk.
 
-	// Get 8.3 name for sub-directory we are searching for
-	char dosFileName[12];
-	toDosFileName(nameToFind, dosFileName, 11);
-	dosFileName[11] = 0;
+static void fsFat12FillVnode(Vnode * vnode, DirectoryEntry * directoryEntry, uint32_t entrySector, uint32_t entryOffset)
+{
+	memmove(&vnode->DirectoryEntry, directoryEntry, sizeof(DirectoryEntry));
+	vnode->Directory = (directoryEntry->Attrib & 0x10) != 0;
+	vnode->Size = directoryEntry->FileSize;
+	memset(vnode->ClusterRuns, 0, sizeof(vnode->ClusterRuns));
+	vnode->NextClusterRun = 0;
+	vnode->DirectorySector = entrySector;
+	vnode->DirectoryOffset = entryOffset;
+	vnode->DirectoryEntryChanged = 0;
+	vnode->Delayed = 0;
+}
+
+// Set up a vnode for the root directory that is not in the vnode cache.  Used 
+// while the file system is being mounted.
+
+static void fsFat12RootVnode(Vnode * vnode)
+{
+	DirectoryEntry rootEntry;
+
+	memset(vnode, 0, sizeof(Vnode));
+	fsFat12RootDirectoryEntry(&rootEntry);
+	fsFat12FillVnode(vnode, &rootEntry, 0, 0);
+}
+
+// Read the fixed root directory into memory.  FAT32 root directories and root
+// directories that are too big are left on the disk.
+
+static void fsFat12LoadRootDirectory(void)
+{
+	DiskBuffer * b;
 
-	//! read directory
-	while (!subDirectory->Eof)
+	if (mountInfo.FatType == 32 || mountInfo.NumRootEntries > MAXROOTENTRIES)
+	{
+		return;
+	}
+	for (uint32_t i = 0; i < mountInfo.RootSize; i++)
 	{
-		// Read directory
-		fsFat12Read(subDirectory, buf, 512);
+		b = diskBufferRead(mountInfo.Device, mountInfo.RootOffset + i);
+		memmove((char *)rootDirectory + i * BSIZE, b->Data, BSIZE);
+		diskBufferRelease(b);
+	}
+	rootInMemory = 1;
+}
 
-		DirectoryEntry * subDirectoryEntry = (DirectoryEntry *)buf;
+// Keep the copy of the root directory in memory the same as the disk after
+// sector b has been changed
 
-		// 16 entries in buffer
-		for (unsigned int i = 0; i < 16; i++)
-		{
-			// Get current filename
-			char name[12];
-			memmove(name, subDirectoryEntry->Filename, 11);
-			name[11] = 0;
-			// Is there a match?
-			if (strcmp(name, dosFileName) == 0)
-			{
-				memmove((char *)foundDirectoryEntry, (char *)subDirectoryEntry, sizeof(DirectoryEntry));
-				fileClose(subDirectory);
-				return 1;
-			}
-			// go to next entry
-			subDirectoryEntry++;
-		}
+static void fsFat12SectorChanged(DiskBuffer * b)
+{
+	if (rootInMemory && b->SectorNumber >= mountInfo.RootOffset && b->SectorNumber < mountInfo.RootOffset + mountInfo.RootSize)
+	{
+		memmove((char *)rootDirectory + (b->SectorNumber - mountInfo.RootOffset) * BSIZE, b->Data, BSIZE);
 	}
+}
 
-	// unable to find file
-	fileClose(subDirectory);
-	return 0;
+// Start reading the entries of a directory at offset
+
+static void fsFat12StartDirectory(DirectoryIterator * iterator, Vnode * directory, uint32_t offset)
+{
+	iterator->Directory = directory;
+	iterator->Offset = offset;
+	iterator->Cluster = fsFat12IsFixedRoot(directory) ? 0 : fsFat12FindCluster(directory, offset / mountInfo.ClusterSize);
+	iterator->NextCluster = 0;
+	iterator->Sector = 0;
+	iterator->Buffer = 0;
 }
 
-uint32_t fsFat12GetNextCluster(uint32_t cluster)
+// Stop reading a directory and unlock the sector being read
+
+static void fsFat12EndDirectory(DirectoryIterator * iterator)
+{
+	if (iterator->Buffer != 0)
+	{
+		diskBufferRelease(iterator->Buffer);
+		iterator->Buffer = 0;
+	}
+}
+
+// Get the next entry of a directory, whether it is used or not.  The entry is 
+// only valid until the iterator is used again.  Returns 0 when there are no
+// more sectors in the directory.
+
+static DirectoryEntry * fsFat12NextEntry(DirectoryIterator * iterator)
 {
-	unsigned int fatOffset = cluster + (cluster / 2); //multiply by 1.5
-	uint16_t nextCluster = *(uint16_t*)&fat[fatOffset];
+	DirectoryEntry * directoryEntry;
+	uint32_t sector;
 
-	// Test if entry is odd or even
-	if (cluster & 0x0001)
+	if (fsFat12IsFixedRoot(iterator->Directory))
 	{
-		// Get high 12 bits
-		nextCluster >>= 4;
+		if (iterator->Offset >= mountInfo.RootSize * BSIZE)
+		{
+			return 0;
+		}
+		sector = mountInfo.RootOffset + iterator->Offset / BSIZE;
+		if (rootInMemory)
+		{
+			iterator->Sector = sector;
+			directoryEntry = &rootDirectory[iterator->Offset / sizeof(DirectoryEntry)];
+			iterator->Offset += sizeof(DirectoryEntry);
+			return directoryEntry;
+		}
 	}
 	else
 	{
-		nextCluster &= 0x0FFF;
+		if (iterator->NextCluster)
+		{
+			fsFat12EndDirectory(iterator);
+			iterator->Cluster = fsFat12GetNextCluster(iterator->Cluster);
+			iterator->NextCluster = 0;
+		}
+		if (iterator->Cluster == 0)
+		{
+			return 0;
+		}
+		sector = fsFat12ClusterToSector(iterator->Cluster) + (iterator->Offset % mountInfo.ClusterSize) / BSIZE;
 	}
-	// Test for end of file
-	if (nextCluster >= 0xff8)
+	if (iterator->Buffer == 0 || iterator->Buffer->SectorNumber != sector)
 	{
-		return 0;
+		fsFat12EndDirectory(iterator);
+		iterator->Buffer = diskBufferRead(mountInfo.Device, sector);
 	}
-	// Test for file corruption
-	if (nextCluster == 0)
+	iterator->Sector = sector;
+	directoryEntry = (DirectoryEntry *)&iterator->Buffer->Data[iterator->Offset % BSIZE];
+	iterator->Offset += sizeof(DirectoryEntry);
+	iterator->NextCluster = iterator->Offset % mountInfo.ClusterSize == 0;
+	return directoryEntry;
+}
+
+// Get the hash of length characters of a name.  If fold is 1, the case of
+// the characters is ignored.
+
+static uint32_t fsFat12NameHash(const char * name, int length, bool fold)
+{
+	uint32_t hash = 0;
+	uint8_t c;
+
+	for (int i = 0; i < length; i++)
 	{
-		return 0;
+		c = name[i];
+		hash = hash * 31 + (fold ? tolower(c) : c);
 	}
-	return nextCluster;
+	return hash;
 }
 
-// Read from a file
+// Compare two long filenames without regard to case
 
-uint32_t fsFat12Read(File * file, unsigned char* buffer, unsigned int length)
+static bool fsFat12SameName(const char * name1, const char * name2)
 {
-	uint32_t readLength = 0;
-	uint32_t totalRead = 0;
+	while (*name1 != 0 && tolower(*name1) == tolower(*name2))
+	{
+		name1++;
+		name2++;
+	}
+	return tolower(*name1) == tolower(*name2);
+}
+
+// Get the checksum of a short name that is kept in the long filename entries
+// of the file
+
+static uint8_t fsFat12ShortNameChecksum(DirectoryEntry * directoryEntry)
+{
+	uint8_t * name = (uint8_t *)directoryEntry;
+	uint8_t sum = 0;
+
+	for (int i = 0; i < 11; i++)
+	{
+		sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+	}
+	return sum;
+}
+
+// Read the next file in a directory.  The long filename in the entries before
+// its short entry, if there is one, is put together in longName, which is 
+// otherwise left empty.  nameOffset is set to the offset of the first entry 
+// holding the name of the file.  Deleted entries and volume labels are 
+// skipped.  Characters in long names that are not ASCII are replaced with '?'.
+// Returns the short entry of the file, which is only valid until the iterator
+// is used again, or 0 at the end of the directory.
+
+static DirectoryEntry * fsFat12NextName(DirectoryIterator * iterator, char * longName, uint32_t * nameOffset)
+{
+	DirectoryEntry * directoryEntry;
+	LongNameEntry * part;
+	uint16_t characters[LONGNAMECHARS];
+	uint8_t checksum = 0;
+	bool haveLongName = 0;
+	int position;
 
-	if (file && (file->Type == FD_FILE || file->Type == FD_DIR) && file->Eof == 0)
+	while ((directoryEntry = fsFat12NextEntry(iterator)) != 0)
 	{
-		// Calculate starting cluster
-		uint32_t clusterHops = file->Position / mountInfo.ClusterSize;
-		uint32_t clusterOffset = file->Position % mountInfo.ClusterSize;
-		uint32_t currentCluster = file->DirectoryEntry.FirstCluster;
-		while (clusterHops > 0)
+		part = (LongNameEntry *)directoryEntry;
+		if (directoryEntry->Filename[0] == 0)
+		{
+			// An empty entry marks the end of the directory
+			return 0;
+		}
+		if (directoryEntry->Filename[0] == 0xE5 || (directoryEntry->Attrib == ATTR_LONGNAME && (part->Sequence & 0x1F) == 0))
 		{
-			// Follow the cluster chain to get to the cluster we want to start with
-			currentCluster = fsFat12GetNextCluster(currentCluster);
-			clusterHops--;
+			haveLongName = 0;
+			continue;
 		}
-		while (length > 0)
+		if (directoryEntry->Attrib == ATTR_LONGNAME)
 		{
-			readLength = fsFat12ReadCluster(0, currentCluster, buffer, clusterOffset, length);
-			buffer += readLength;
-			length -= readLength;
-			totalRead += readLength;
-			file->Position += readLength;
-			if (file->Position >= file->Size && file->Type == FD_FILE)
+			if (part->Sequence & LONGNAMELAST)
 			{
-				file->Eof = 1;
-				return totalRead;
+				// The parts of the name are in reverse order, so this is the first one
+				memset(longName, 0, MAXLONGNAME + 1);
+				haveLongName = 1;
+				checksum = part->Checksum;
+				*nameOffset = iterator->Offset - sizeof(DirectoryEntry);
 			}
-			if (clusterOffset + readLength == mountInfo.ClusterSize)
+			else if (!haveLongName || part->Checksum != checksum)
 			{
-				currentCluster = fsFat12GetNextCluster(currentCluster);
+				haveLongName = 0;
+				continue;
 			}
-			clusterOffset = 0;
-			if (currentCluster == 0)
+			memmove(characters, part->Name1, sizeof(part->Name1));
+			memmove(characters + 5, part->Name2, sizeof(part->Name2));
+			memmove(characters + 11, part->Name3, sizeof(part->Name3));
+			position = ((part->Sequence & 0x1F) - 1) * LONGNAMECHARS;
+			for (int i = 0; i < LONGNAMECHARS && position + i < MAXLONGNAME && characters[i] != 0; i++)
 			{
-				file->Eof = 1;
-				return totalRead;
+				longName[position + i] = characters[i] < 0x80 ? characters[i] : '?';
 			}
+			continue;
 		}
+		if (directoryEntry->Attrib & 0x08)
+		{
+			haveLongName = 0;
+			continue;
+		}
+		if (!haveLongName || checksum != fsFat12ShortNameChecksum(directoryEntry))
+		{
+			longName[0] = 0;
+			*nameOffset = iterator->Offset - sizeof(DirectoryEntry);
+		}
+		return directoryEntry;
 	}
-	return totalRead;
+	return 0;
 }
 
-//	Closes file
+// Add a name to a directory index.  If the index is full, it is marked as not
+// holding every name in the directory.
 
-void fsFat12Close(File * file)
+static void fsFat12IndexName(DirectoryIndex * index, uint32_t hash, bool longName, uint32_t nameOffset, uint32_t entryOffset)
 {
-	if (file)
+	IndexedName * indexed;
+
+	if (index->Count >= MAXINDEXEDNAMES)
 	{
-		file->Type = FD_NONE;
+		index->Complete = 0;
+		return;
 	}
+	indexed = &index->Name[index->Count];
+	indexed->Hash = hash;
+	indexed->NameOffset = nameOffset;
+	indexed->EntryOffset = entryOffset;
+	indexed->Long = longName;
+	indexed->Next = index->Chain[hash % NAMEHASHSIZE];
+	index->Chain[hash % NAMEHASHSIZE] = index->Count++;
 }
 
-// Parse path to get next directory or filename on path. 
-// Returns 0 if we are returning the filename in pathPart or 
-// the length of the directory name if it is a directory name
+// Add a file to a directory index under its short name and its long name
 
-int fsGetPathPart(char * path, char * pathPart)
+static void fsFat12IndexFile(DirectoryIndex * index, DirectoryEntry * directoryEntry, const char * longName, uint32_t nameOffset, uint32_t entryOffset)
 {
-	char * p = path;
-	while (*p != 0 && *p != '\\' && *p != '/')
+	fsFat12IndexName(index, fsFat12NameHash((char *)directoryEntry->Filename, 11, 0), 0, entryOffset, entryOffset);
+	if (longName[0] != 0)
 	{
-		p++;
+		fsFat12IndexName(index, fsFat12NameHash(longName, strlen(longName), 1), 1, nameOffset, entryOffset);
 	}
-	int partLength = (int)(p - path);
-	strcpy(pathPart, path);
-	*(pathPart + partLength) = 0;	
-	if (*p == 0)
+}
+
+// Find the name index of a directory.  Returns 0 if the directory has not been
+// indexed.  directoryIndexLock must be held.
+
+static DirectoryIndex * fsFat12FindIndex(Vnode * directory)
+{
+	uint32_t firstCluster = fsFat12FirstCluster(directory);
+
+	for (DirectoryIndex * index = directoryIndexes; index < directoryIndexes + NDIRECTORYINDEXES; index++)
 	{
-		return 0;
+		if (index->Valid && index->Directory == firstCluster)
+		{
+			return index;
+		}
 	}
-	else
+	return 0;
+}
+
+// Get the name index of a directory, building it from the directory if there
+// is none.  The least recently used index is replaced.  directoryIndexLock 
+// must be held.
+
+static DirectoryIndex * fsFat12GetIndex(Vnode * directory)
+{
+	DirectoryIndex * index = fsFat12FindIndex(directory);
+	DirectoryIterator iterator;
+	DirectoryEntry * directoryEntry;
+	uint32_t nameOffset;
+
+	if (index == 0)
 	{
-		return partLength;
+		index = directoryIndexes;
+		for (DirectoryIndex * other = directoryIndexes; other < directoryIndexes + NDIRECTORYINDEXES; other++)
+		{
+			if (index->Valid && (!other->Valid || other->LastUsed < index->LastUsed))
+			{
+				index = other;
+			}
+		}
+		index->Valid = 1;
+		index->Directory = fsFat12FirstCluster(directory);
+		index->Complete = 1;
+		index->Count = 0;
+		memset(index->Chain, 0xFF, sizeof(index->Chain));
+		fsFat12StartDirectory(&iterator, directory, 0);
+		while ((directoryEntry = fsFat12NextName(&iterator, indexLongName, &nameOffset)) != 0)
+		{
+			fsFat12IndexFile(index, directoryEntry, indexLongName, nameOffset, iterator.Offset - sizeof(DirectoryEntry));
+		}
+		fsFat12EndDirectory(&iterator);
 	}
+	index->LastUsed = ++directoryIndexClock;
+	return index;
 }
 
-//  Open a file
-//
-//  cwd = 		The current working directory
-//  filename  = The path of the file to open.  If it does not begin with a '\' or '/'. we prepend cwd to the filename
-//  directory = 1 if we are opening a sub-directory, 0 otherwise
+// Look up a name in the name index of a directory.  If longName is 1, name is
+// compared with the long names of the files without regard to case.  Otherwise
+// it is an 8.3 name and is compared with their short names.  The entries that
+// the index points to are read again to check that the names really match.
+// Returns 1 if the name is found, with a copy of the short entry of the file,
+// the sector holding it and its offset in the sector.
 
-File * fsFat12Open(const char * cwd, const char* filename, int directory)
+static bool fsFat12FindInIndex(Vnode * directory, DirectoryIndex * index, const char * name, bool longName, DirectoryEntry * foundDirectoryEntry, uint32_t * entrySector, uint32_t * entryOffset)
 {
-	DirectoryEntry currentDirectoryEntry;
-	char * p = 0;
-	bool rootDirectory = true;
-	char path[255];
-	char pathPart[20];
-	int partLength;
-	
-	if (*filename == '\\' || *filename == '/')
+	uint32_t hash = longName ? fsFat12NameHash(name, strlen(name), 1) : fsFat12NameHash(name, 11, 0);
+	DirectoryIterator iterator;
+	DirectoryEntry * directoryEntry;
+	uint32_t nameOffset;
+	IndexedName * indexed;
+	bool found;
+
+	for (int i = index->Chain[hash % NAMEHASHSIZE]; i >= 0; i = indexed->Next)
 	{
-		safestrcpy(path, filename, MAXCWDSIZE);
+		indexed = &index->Name[i];
+		if (indexed->Hash != hash || indexed->Long != longName)
+		{
+			continue;
+		}
+		fsFat12StartDirectory(&iterator, directory, indexed->NameOffset);
+		directoryEntry = fsFat12NextName(&iterator, indexLongName, &nameOffset);
+		found = directoryEntry != 0 && iterator.Offset - sizeof(DirectoryEntry) == indexed->EntryOffset &&
+				(longName ? fsFat12SameName(indexLongName, name) : memcmp(directoryEntry->Filename, name, 11) == 0);
+		if (found)
+		{
+			memmove(foundDirectoryEntry, directoryEntry, sizeof(DirectoryEntry));
+			*entrySector = iterator.Sector;
+			*entryOffset = indexed->EntryOffset % BSIZE;
+		}
+		fsFat12EndDirectory(&iterator);
+		if (found)
+		{
+			return 1;
+		}
 	}
-	else
+	return 0;
+}
+
+// Get the vnode for the file or directory whose directory entry is at entryOffset
+// in entrySector, with a reference to it.  The vnode is identified by where its 
+// directory entry is, and the root directory (which has none) by 1.
+
+static Vnode * fsFat12GetVnode(Mount * mount, DirectoryEntry * directoryEntry, uint32_t entrySector, uint32_t entryOffset)
+{
+	uint32_t id = entrySector == 0 ? 1 : entrySector * (BSIZE / sizeof(DirectoryEntry)) + entryOffset / sizeof(DirectoryEntry);
+	Vnode * vnode = vfsGetVnode(mount, id);
+
+	if (vnode != 0 && !vnode->Valid)
 	{
-		safestrcpy(path, cwd, MAXCWDSIZE);
-		int cwdLen = strlen(cwd);
-		safestrcpy(path + cwdLen, filename, MAXCWDSIZE - cwdLen);
+		fsFat12FillVnode(vnode, directoryEntry, entrySector, entryOffset);
+		vfsVnodeFilled(vnode);
 	}
-	// Move past first '/' or '\'
-	p = path + 1;
-	while (p)
+	return vnode;
+}
+
+// Locate a file or folder in a directory.  The name is matched with the long
+// names of the files without regard to case and, if it is an 8.3 name, with
+// their short names.  A longer name is not cut short to match a short name.  On return, foundDirectoryEntry is the 
+// directory entry that was found. The sector holding the directory entry and its
+// offset in the sector are returned in entrySector and entryOffset.
+
+static bool fsFat12FindInDirectory(Vnode * directory, const char* nameToFind, DirectoryEntry * foundDirectoryEntry, uint32_t * entrySector, uint32_t * entryOffset)
+{
+	DirectoryIndex * index;
+	DirectoryIterator iterator;
+	DirectoryEntry * directoryEntry;
+	uint32_t nameOffset;
+	bool found;
+
+	// Get 8.3 name for the file we are searching for
+	char dosFileName[12];
+	bool shortName = fsFat12IsShortName(nameToFind);
+	toDosFileName(nameToFind, dosFileName, 11);
+	dosFileName[11] = 0;
+
+	sleeplockAcquire(&directoryIndexLock);
+	index = fsFat12GetIndex(directory);
+	found = fsFat12FindInIndex(directory, index, nameToFind, 1, foundDirectoryEntry, entrySector, entryOffset) ||
+			(shortName && fsFat12FindInIndex(directory, index, dosFileName, 0, foundDirectoryEntry, entrySector, entryOffset));
+	if (!found && !index->Complete)
 	{
-		partLength = fsGetPathPart(p, pathPart);
-		if (rootDirectory)
+		// The directory has more names than the index holds, so read through it
+		fsFat12StartDirectory(&iterator, directory, 0);
+		while ((directoryEntry = fsFat12NextName(&iterator, indexLongName, &nameOffset)) != 0)
 		{
-			// Search root directory 
-			if (fsFat12FindInRootDirectory(pathPart, &currentDirectoryEntry) == 0)
+			if ((indexLongName[0] != 0 && fsFat12SameName(indexLongName, nameToFind)) || (shortName && memcmp(directoryEntry->Filename, dosFileName, 11) == 0))
 			{
-				// This part of the path was not found in the directory
-				return 0;
+				memmove(foundDirectoryEntry, directoryEntry, sizeof(DirectoryEntry));
+				*entrySector = iterator.Sector;
+				*entryOffset = (iterator.Offset - sizeof(DirectoryEntry)) % BSIZE;
+				found = 1;
+				break;
 			}
-			rootDirectory = false;
+		}
+		fsFat12EndDirectory(&iterator);
+	}
+	sleeplockRelease(&directoryIndexLock);
+	return found;
+}
+
+// Get the offset in the FAT of the entry for a cluster.  Entries are 1.5, 2
+// or 4 bytes long.
+
+static uint32_t fsFat12EntryOffset(uint32_t cluster)
+{
+	return cluster * (mountInfo.FatType / 4) / 2;
+}
+
+// Get the value that marks the end of a cluster chain.  Values from this 
+// less 7 up also mark the end of a chain.
+
+static uint32_t fsFat12EndOfChain(void)
+{
+	return mountInfo.FatType == 32 ? 0x0FFFFFFF : (1 << mountInfo.FatType) - 1;
+}
+
+// Get the FAT entry for a cluster.  0 means that the cluster is free.
+
+static uint32_t fsFat12GetClusterEntry(uint32_t cluster)
+{
+	uint32_t fatOffset = fsFat12EntryOffset(cluster);
+	uint32_t sectorOffset = fatOffset % BSIZE;
+	DiskBuffer * b = diskBufferRead(mountInfo.Device, mountInfo.FatOffset + fatOffset / BSIZE);
+	uint32_t nextCluster;
+
+	if (mountInfo.FatType == 32)
+	{
+		// The top 4 bits are reserved
+		nextCluster = *(uint32_t *)&b->Data[sectorOffset] & 0x0FFFFFFF;
+	}
+	else if (mountInfo.FatType == 16)
+	{
+		nextCluster = *(uint16_t *)&b->Data[sectorOffset];
+	}
+	else
+	{
+		nextCluster = b->Data[sectorOffset];
+		if (sectorOffset == BSIZE - 1)
+		{
+			// The entry straddles two sectors of the FAT
+			diskBufferRelease(b);
+			b = diskBufferRead(mountInfo.Device, mountInfo.FatOffset + fatOffset / BSIZE + 1);
+			nextCluster |= b->Data[0] << 8;
 		}
 		else
 		{
-			// Search subdirectory
-			if (fsFat12FindInSubDirectory(pathPart, &currentDirectoryEntry) == 0)
-			{
-				// This part of the path was not found in the directory
-				return 0;
-			}
-		}	
-		// If we got here, we do have a match for this part of the path
-		if (partLength == 0)
+			nextCluster |= b->Data[sectorOffset + 1] << 8;
+		}
+		// Test if entry is odd or even
+		if (cluster & 0x0001)
 		{
-			// If we are trying to open a directory, but we have not found a directory, return error
-			if (directory == 1 && currentDirectoryEntry.Attrib != 0x10)
-			{
-				return 0;
-			}
-			// This is the filename component, so just return a file structure
-			File * fileStructure = fsFat12CreateFileStructure(&currentDirectoryEntry, filename);			
-			if (directory == 1)
-			{
-				fileStructure->Type = FD_DIR;			
-			} 
-			return fileStructure;
+			// Get high 12 bits
+			nextCluster >>= 4;
 		}
-		// Check to see if we found a directory.  If not, then we cannot continue
-		if (currentDirectoryEntry.Attrib != 0x10)
+		else
 		{
-			return 0;
+			nextCluster &= 0x0FFF;
 		}
-		p = p + partLength + 1;
 	}
-	return 0;
+	diskBufferRelease(b);
+	return nextCluster;
 }
 
-// Read root directory
-uint32_t fsFat12ReadRootDirectory(DirectoryEntry * rootDirectoryEntry)
+// Log a sector of the first copy of the FAT that has been changed and remember
+// it so that fsFat12WriteFat copies it to the other copies.
+
+static void fsFat12LogFatSector(DiskBuffer * b, uint32_t fatSector)
 {
-	DiskBuffer * buf;
-	DirectoryEntry * directoryEntry;
-	int rootDirectorySectorCount = mountInfo.NumRootEntries / 16;
-	int j = 0;
-	
-	for (int sector = 0; sector < rootDirectorySectorCount; sector++)
-	{
-		// Read in sector of root directory
-		buf = diskBufferRead(0, mountInfo.RootOffset + sector);	
-		directoryEntry = (DirectoryEntry *)buf->Data;
-				
-		// Loop through the disk numbers (previous times we have been here) and increment the directory entry
-		while(j < previousTimes)
-		{
-			// Increment to the next entry on this disk for the next interation
-			// Otherwise I get KERNEL SYS, USRBIN, USRBIN, USRBIN...
-			directoryEntry++;
-			j++;
-		}
-		
-		// Move directoryEntry to the returned directory memory
-		memmove((char *)rootDirectoryEntry, (char *)directoryEntry, sizeof(DirectoryEntry));
-		
-		// Check if the directory entry is populated with meaningful data
-		if(rootDirectoryEntry->Filename[0] != '\0')
-		{
-			diskBufferRelease(buf);
-			previousTimes++;
-			return 1;	
-		} 
-		else
+	int i;
+
+	logWrite(b);
+	for (i = 0; i < fatChangedCount; i++)
+	{
+		if (fatChanged[i] == fatSector)
 		{
-			diskBufferRelease(buf);
-			// Set the previous times to 0 when complete so the next run starts from scratch
-			previousTimes = 0;
-			return 0;
+			return;
 		}
-		diskBufferRelease(buf);
 	}
-	return 0;
-}
+	if (fatChangedCount >= MAXOPBLOCKS)
+	{
+		panic("fsFat12LogFatSector: too many FAT sectors changed");
+	}
+	fatChanged[fatChangedCount++] = fatSector;
+}
+
+// Set the FAT entry for a cluster.  fatLock must be held and a log operation
+// must have been started.
+
+static void fsFat12SetClusterEntry(uint32_t cluster, uint32_t value)
+{
+	uint32_t fatOffset = fsFat12EntryOffset(cluster);
+	uint32_t fatSector = fatOffset / BSIZE;
+	uint32_t sectorOffset = fatOffset % BSIZE;
+	uint32_t highOffset = sectorOffset + 1;
+	DiskBuffer * b = diskBufferRead(mountInfo.Device, mountInfo.FatOffset + fatSector);
+	uint32_t * entry32;
+
+	if (mountInfo.FatType == 32)
+	{
+		entry32 = (uint32_t *)&b->Data[sectorOffset];
+		*entry32 = (*entry32 & 0xF0000000) | (value & 0x0FFFFFFF);
+	}
+	else if (mountInfo.FatType == 16)
+	{
+		*(uint16_t *)&b->Data[sectorOffset] = value;
+	}
+	else
+	{
+		if (cluster & 0x0001)
+		{
+			b->Data[sectorOffset] = (b->Data[sectorOffset] & 0x0F) | ((value << 4) & 0xF0);
+		}
+		else
+		{
+			b->Data[sectorOffset] = value & 0xFF;
+		}
+		if (sectorOffset == BSIZE - 1)
+		{
+			// The entry straddles two sectors of the FAT
+			fsFat12LogFatSector(b, fatSector);
+			diskBufferRelease(b);
+			b = diskBufferRead(mountInfo.Device, mountInfo.FatOffset + ++fatSector);
+			highOffset = 0;
+		}
+		if (cluster & 0x0001)
+		{
+			b->Data[highOffset] = (value >> 4) & 0xFF;
+		}
+		else
+		{
+			b->Data[highOffset] = (b->Data[highOffset] & 0xF0) | ((value >> 8) & 0x0F);
+		}
+	}
+	fsFat12LogFatSector(b, fatSector);
+	diskBufferRelease(b);
+	if (cluster >= freeMapStart && cluster < freeMapStart + FREEMAPCLUSTERS)
+	{
+		if (value == 0)
+		{
+			freeClusters[(cluster - freeMapStart) / 32] |= 1U << ((cluster - freeMapStart) % 32);
+		}
+		else
+		{
+			freeClusters[(cluster - freeMapStart) / 32] &= ~(1U << ((cluster - freeMapStart) % 32));
+		}
+		freeExtentsValid = 0;
+	}
+}
+
+// Get the number of sectors of the FAT changed since the FAT was last written back
+
+static int fsFat12FatSectorsChanged(void)
+{
+	return fatChangedCount;
+}
+
+uint32_t fsFat12GetNextCluster(uint32_t cluster)
+{
+	uint32_t nextCluster = fsFat12GetClusterEntry(cluster);
+
+	// Test for end of file
+	if (nextCluster >= fsFat12EndOfChain() - 7)
+	{
+		return 0;
+	}
+	// Test for file corruption
+	if (nextCluster < 2 || nextCluster >= mountInfo.NumClusters + 2)
+	{
+		return 0;
+	}
+	return nextCluster;
+}
+
+// Get the first sector of a cluster
+
+static uint32_t fsFat12ClusterToSector(uint32_t cluster)
+{
+	return mountInfo.RootOffset + mountInfo.RootSize + ((cluster - 2) * bootSector.Bpb.SectorsPerCluster);
+}
+
+// Find the run in the cluster run cache of a file that ends closest before (or
+// at) the given cluster index.  Returns 0 if there is none.
+
+static ClusterRun * fsFat12ClosestRun(Vnode * vnode, uint32_t clusterIndex)
+{
+	ClusterRun * closest = 0;
+	ClusterRun * run;
+
+	for (int i = 0; i < NCLUSTERRUNS; i++)
+	{
+		run = &vnode->ClusterRuns[i];
+		if (run->Length != 0 && run->Index <= clusterIndex &&
+			(closest == 0 || run->Index + run->Length > closest->Index + closest->Length))
+		{
+			closest = run;
+		}
+	}
+	return closest;
+}
+
+// Find the cluster holding the given cluster index (0 = first cluster) of a file.
+// The runs of contiguous clusters found are remembered in the file, so that 
+// neither sequential nor random access needs to follow the cluster chain from
+// the start each time.  Since clusters are allocated in runs, a few runs 
+// usually cover the whole file.  Returns 0 if the file does not have that many 
+// clusters.
+
+static uint32_t fsFat12FindCluster(Vnode * vnode, uint32_t clusterIndex)
+{
+	ClusterRun * run = fsFat12ClosestRun(vnode, clusterIndex);
+	uint32_t currentCluster = fsFat12FirstCluster(vnode);
+	uint32_t currentIndex = 0;
+	uint32_t runCluster;
+	uint32_t runIndex;
+	uint32_t nextCluster;
+
+	if (run != 0)
+	{
+		if (clusterIndex < run->Index + run->Length)
+		{
+			return run->Cluster + clusterIndex - run->Index;
+		}
+		// Carry on from the end of the run
+		currentCluster = run->Cluster + run->Length - 1;
+		currentIndex = run->Index + run->Length - 1;
+		runCluster = run->Cluster;
+		runIndex = run->Index;
+	}
+	else
+	{
+		runCluster = currentCluster;
+		runIndex = 0;
+	}
+	while (currentIndex < clusterIndex && currentCluster != 0)
+	{
+		// Follow the cluster chain to get to the cluster we want
+		nextCluster = fsFat12GetNextCluster(currentCluster);
+		if (nextCluster != currentCluster + 1)
+		{
+			runCluster = nextCluster;
+			runIndex = currentIndex + 1;
+		}
+		currentCluster = nextCluster;
+		currentIndex++;
+	}
+	if (currentCluster == 0)
+	{
+		return 0;
+	}
+	// Remember the run that the cluster is in, extending the run we started
+	// from if it is the same one
+	if (run == 0 || run->Index != runIndex)
+	{
+		run = &vnode->ClusterRuns[vnode->NextClusterRun];
+		vnode->NextClusterRun = (vnode->NextClusterRun + 1) % NCLUSTERRUNS;
+		run->Index = runIndex;
+		run->Cluster = runCluster;
+	}
+	run->Length = currentIndex - runIndex + 1;
+	return currentCluster;
+}
+
+// Forget the cluster chain of a file found so far
+
+static void fsFat12ForgetClusterRuns(Vnode * vnode)
+{
+	memset(vnode->ClusterRuns, 0, sizeof(vnode->ClusterRuns));
+	vnode->NextClusterRun = 0;
+}
+
+// Get the disk sector holding the byte at offset in a file or directory.
+// Returns 0 if offset is past the end of the clusters of the file.
+
+static uint32_t fsFat12SectorAtOffset(Vnode * vnode, uint32_t offset)
+{
+	uint32_t cluster;
+
+	if (fsFat12IsFixedRoot(vnode))
+	{
+		if (offset >= mountInfo.RootSize * bootSector.Bpb.BytesPerSector)
+		{
+			return 0;
+		}
+		return mountInfo.RootOffset + offset / bootSector.Bpb.BytesPerSector;
+	}
+	if ((cluster = fsFat12FindCluster(vnode, offset / mountInfo.ClusterSize)) == 0)
+	{
+		return 0;
+	}
+	return fsFat12ClusterToSector(cluster) + (offset % mountInfo.ClusterSize) / bootSector.Bpb.BytesPerSector;
+}
+
+// Find the last cluster of a file and the number of clusters it has.  The
+// chain is followed from the furthest cluster found so far.
+
+static uint32_t fsFat12LastCluster(Vnode * vnode, uint32_t * clusterCount)
+{
+	ClusterRun * run = fsFat12ClosestRun(vnode, 0xFFFFFFFF);
+	uint32_t cluster = fsFat12FirstCluster(vnode);
+	uint32_t lastCluster = 0;
+
+	*clusterCount = 0;
+	if (run != 0)
+	{
+		cluster = run->Cluster + run->Length - 1;
+		*clusterCount = run->Index + run->Length - 1;
+	}
+	while (cluster != 0)
+	{
+		lastCluster = cluster;
+		(*clusterCount)++;
+		cluster = fsFat12GetNextCluster(cluster);
+	}
+	return lastCluster;
+}
+
+static int fsFat12ClusterIsFree(uint32_t cluster)
+{
+	if (cluster < freeMapStart || cluster >= freeMapStart + FREEMAPCLUSTERS)
+	{
+		return fsFat12GetClusterEntry(cluster) == 0;
+	}
+	return (freeClusters[(cluster - freeMapStart) / 32] >> ((cluster - freeMapStart) % 32)) & 1;
+}
+
+// Set up the free cluster bitmap from the FAT for the part of the disk from
+// start.  This is done when the disk is mounted and when the part of the disk
+// that the bitmap covers is full.
+
+static void fsFat12BuildFreeClusters(uint32_t start)
+{
+	uint32_t end = min(start + FREEMAPCLUSTERS, mountInfo.NumClusters + 2);
+
+	memset(freeClusters, 0, sizeof(freeClusters));
+	freeMapStart = start;
+	for (uint32_t cluster = start; cluster < end; cluster++)
+	{
+		if (fsFat12GetClusterEntry(cluster) == 0)
+		{
+			freeClusters[(cluster - start) / 32] |= 1U << ((cluster - start) % 32);
+		}
+	}
+	freeExtentsValid = 0;
+}
+
+// Add a run of free clusters to the free extent index.  If the index is full,
+// the run replaces the shortest one in it if it is longer.
+
+static void fsFat12AddFreeExtent(uint32_t start, uint32_t length)
+{
+	int index = freeExtentCount;
+
+	if (freeExtentCount < MAXFREEEXTENTS)
+	{
+		freeExtentCount++;
+	}
+	else
+	{
+		index = 0;
+		for (int i = 1; i < freeExtentCount; i++)
+		{
+			if (freeExtents[i].Length < freeExtents[index].Length)
+			{
+				index = i;
+			}
+		}
+		if (freeExtents[index].Length >= length)
+		{
+			return;
+		}
+	}
+	freeExtents[index].Start = start;
+	freeExtents[index].Length = length;
+}
+
+// Rebuild the free extent index from the free cluster bitmap.  Words of the 
+// bitmap that are all used or all free are stepped over in one go.
+
+static void fsFat12BuildFreeExtents(void)
+{
+	uint32_t end = min(FREEMAPCLUSTERS, mountInfo.NumClusters + 2 - freeMapStart);
+	uint32_t bit = 0;
+	uint32_t start;
+
+	freeExtentCount = 0;
+	while (bit < end)
+	{
+		if (bit % 32 == 0 && freeClusters[bit / 32] == 0)
+		{
+			bit += 32;
+			continue;
+		}
+		if (((freeClusters[bit / 32] >> (bit % 32)) & 1) == 0)
+		{
+			bit++;
+			continue;
+		}
+		start = bit;
+		while (bit < end && ((freeClusters[bit / 32] >> (bit % 32)) & 1))
+		{
+			if (bit % 32 == 0 && bit + 32 <= end && freeClusters[bit / 32] == 0xFFFFFFFF)
+			{
+				bit += 32;
+			}
+			else
+			{
+				bit++;
+			}
+		}
+		fsFat12AddFreeExtent(freeMapStart + start, bit - start);
+	}
+	freeExtentsValid = 1;
+}
+
+// Get the number of free clusters (up to wanted) starting at cluster
+
+static uint32_t fsFat12FreeRunLength(uint32_t cluster, uint32_t wanted)
+{
+	uint32_t length = 0;
+
+	while (length < wanted && cluster + length < mountInfo.NumClusters + 2 && fsFat12ClusterIsFree(cluster + length))
+	{
+		length++;
+	}
+	return length;
+}
+
+// Find free clusters to add to a file.  The clusters straight after goal are used
+// if they are free so that the file stays in one piece.  Otherwise, the run comes
+// from the start of the shortest free extent that holds wanted clusters (best fit), 
+// so that long extents are left for large files.  If no extent is that long, the 
+// longest is used.  Returns the first cluster of the run and its length in 
+// runLength, or 0 if the disk is full.
+
+static uint32_t fsFat12FindFreeRun(uint32_t goal, uint32_t wanted, uint32_t * runLength)
+{
+	uint32_t parts = (mountInfo.NumClusters + FREEMAPCLUSTERS - 1) / FREEMAPCLUSTERS;
+	uint32_t nextStart;
+	FreeExtent * best = 0;
+	FreeExtent * extent;
+	uint32_t length;
+
+	if (goal >= 2 && goal < mountInfo.NumClusters + 2 && (length = fsFat12FreeRunLength(goal, wanted)) > 0)
+	{
+		*runLength = length;
+		return goal;
+	}
+	for (uint32_t part = 0; best == 0; part++)
+	{
+		if (!freeExtentsValid)
+		{
+			fsFat12BuildFreeExtents();
+		}
+		for (int i = 0; i < freeExtentCount; i++)
+		{
+			extent = &freeExtents[i];
+			if (best == 0 ||
+				(best->Length < wanted && extent->Length > best->Length) ||
+				(extent->Length >= wanted && extent->Length < best->Length))
+			{
+				best = extent;
+			}
+		}
+		if (best == 0)
+		{
+			if (part + 1 >= parts)
+			{
+				*runLength = 0;
+				return 0;
+			}
+			// There are no free clusters in this part of the disk, so move on to the next
+			nextStart = freeMapStart + FREEMAPCLUSTERS;
+			fsFat12BuildFreeClusters(nextStart < mountInfo.NumClusters + 2 ? nextStart : 2);
+		}
+	}
+	*runLength = min(best->Length, wanted);
+	return best->Start;
+}
+
+// Add a run of up to count clusters (and no more than MAXRUNCLUSTERS, or half 
+// that on FAT32) to the end of the cluster chain of a file or sub-directory, so 
+// that no more than three sectors of the FAT are changed.  Returns the number of clusters added, which 
+// is less than count if a long enough run could not be found or 0 if the disk
+// is full.  fatLock must be held.
+
+static uint32_t fsFat12ExtendChain(Vnode * vnode, uint32_t count)
+{
+	uint32_t clusterCount;
+	uint32_t lastCluster = fsFat12LastCluster(vnode, &clusterCount);
+	uint32_t maxClusters = min(MAXRUNCLUSTERS, 512 * 8 / mountInfo.FatType);
+	uint32_t firstCluster;
+	uint32_t runLength;
+
+	if ((firstCluster = fsFat12FindFreeRun(lastCluster + 1, min(count, maxClusters), &runLength)) == 0)
+	{
+		return 0;
+	}
+	for (uint32_t cluster = firstCluster; cluster < firstCluster + runLength; cluster++)
+	{
+		fsFat12SetClusterEntry(cluster, cluster == firstCluster + runLength - 1 ? fsFat12EndOfChain() : cluster + 1);
+	}
+	if (lastCluster == 0)
+	{
+		fsFat12SetEntryCluster(&vnode->DirectoryEntry, firstCluster);
+	}
+	else
+	{
+		fsFat12SetClusterEntry(lastCluster, firstCluster);
+	}
+	return runLength;
+}
+
+// Copy the sectors of the first copy of the FAT that have been changed to the
+// other copies of the FAT on the disk, and log them.  fatLock must be held and 
+// a log operation must have been started.
+
+static void fsFat12WriteFat(void)
+{
+	DiskBuffer * from;
+	DiskBuffer * to;
+
+	for (int i = 0; i < fatChangedCount; i++)
+	{
+		from = diskBufferRead(mountInfo.Device, mountInfo.FatOffset + fatChanged[i]);
+		for (uint32_t copy = 1; copy < bootSector.Bpb.NumberOfFats; copy++)
+		{
+			to = diskBufferGetForWrite(mountInfo.Device, mountInfo.FatOffset + copy * mountInfo.FatSize + fatChanged[i]);
+			memmove(to->Data, from->Data, BSIZE);
+			logWrite(to);
+			diskBufferRelease(to);
+		}
+		diskBufferRelease(from);
+	}
+	fatChangedCount = 0;
+}
+
+// Copy the directory entry of a file into the buffer cache and log it if it
+// has changed, recording size as the size of the file.  A log operation must
+// have been started.
+
+static void fsFat12WriteDirectoryEntry(Vnode * vnode, uint32_t size)
+{
+	DiskBuffer * b;
+
+	if (vnode->DirectoryEntryChanged == 0 || vnode->DirectorySector == 0)
+	{
+		return;
+	}
+	vnode->DirectoryEntry.FileSize = size;
+	b = diskBufferRead(mountInfo.Device, vnode->DirectorySector);
+	memmove(b->Data + vnode->DirectoryOffset, &vnode->DirectoryEntry, sizeof(DirectoryEntry));
+	logWrite(b);
+	fsFat12SectorChanged(b);
+	diskBufferRelease(b);
+	vnode->DirectoryEntryChanged = 0;
+}
+
+// Clear a sector to zero in the buffer cache
+
+static void fsFat12ClearSector(uint32_t sector)
+{
+	DiskBuffer * b = diskBufferGetForWrite(mountInfo.Device, sector);
+
+	memset(b->Data, 0, BSIZE);
+	diskBufferMarkDirty(b);
+	diskBufferRelease(b);
+}
+
+// Allocate clusters for the data written past the end of the clusters of a file.
+// Until this is done, the data is only held in dirty pages in the page cache,
+// so that the clusters for all of it can be allocated together as one run.  
+// This is done when the pages are written back or the file is closed.  Returns
+// -1 if the disk is full, in which case the file is cut short at the end of 
+// its clusters and the data that there is no room for is thrown away when 
+// the pages are written back.
+//
+// Each run of clusters is added to the file in its own log operation.  The
+// clusters needed are worked out again under fatLock for each run, so that
+// two processes writing back pages of the same file cannot both extend it.
+// The size in the directory entry is not changed here, since the data in the
+// new clusters has not been written yet.  It is recorded when the file is
+// closed, after its pages have been written back.
+
+static int fsFat12AllocateDelayed(Vnode * vnode)
+{
+	uint32_t clusterCount;
+	uint32_t needed;
+	uint32_t added;
+	int result = 0;
+
+	if (vnode->Delayed == 0)
+	{
+		return 0;
+	}
+	// Cleared first, so that a write made while the clusters are being
+	// allocated sets it again and is allocated for later
+	vnode->Delayed = 0;
+	for (;;)
+	{
+		logBeginOperation();
+		sleeplockAcquire(&fatLock);
+		needed = (vnode->Size + mountInfo.ClusterSize - 1) / mountInfo.ClusterSize;
+		fsFat12LastCluster(vnode, &clusterCount);
+		if (clusterCount >= needed)
+		{
+			sleeplockRelease(&fatLock);
+			logEndOperation();
+			break;
+		}
+		added = fsFat12ExtendChain(vnode, needed - clusterCount);
+		fsFat12WriteFat();
+		vnode->DirectoryEntryChanged = 1;
+		fsFat12WriteDirectoryEntry(vnode, vnode->DirectoryEntry.FileSize);
+		if (added == 0)
+		{
+			// The disk is full
+			vnode->Size = clusterCount * mountInfo.ClusterSize;
+			result = -1;
+		}
+		sleeplockRelease(&fatLock);
+		logEndOperation();
+		if (added == 0)
+		{
+			break;
+		}
+	}
+	return result;
+}
+
+// Read from the root directory of a FAT12 or FAT16 volume.  The root directory
+// is held in a fixed region after the FATs rather than in clusters.  It is
+// read from the copy in memory if there is one.
+
+static uint32_t fsFat12ReadRootDirectoryAt(unsigned char * buffer, uint32_t length, uint32_t offset)
+{
+	DiskBuffer * sectorContents;
+	uint32_t sectorOffset;
+	uint32_t readLength;
+	uint32_t totalRead = 0;
+	uint32_t rootDirectorySize = mountInfo.RootSize * bootSector.Bpb.BytesPerSector;
+
+	if (offset >= rootDirectorySize)
+	{
+		return 0;
+	}
+	length = min(length, rootDirectorySize - offset);
+	if (rootInMemory)
+	{
+		memmove(buffer, (char *)rootDirectory + offset, length);
+		return length;
+	}
+	while (length > 0)
+	{
+		sectorContents = diskBufferRead(mountInfo.Device, mountInfo.RootOffset + offset / bootSector.Bpb.BytesPerSector);
+		sectorOffset = offset % bootSector.Bpb.BytesPerSector;
+		readLength = min(length, bootSector.Bpb.BytesPerSector - sectorOffset);
+		memmove(buffer, &sectorContents->Data[sectorOffset], readLength);
+		diskBufferRelease(sectorContents);
+		buffer += readLength;
+		offset += readLength;
+		length -= readLength;
+		totalRead += readLength;
+	}
+	return totalRead;
+}
+
+// Read from a file or directory at the given offset
+
+static int fsFat12ReadAt(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	uint32_t readLength = 0;
+	uint32_t totalRead = 0;
+
+	if (fsFat12IsFixedRoot(vnode))
+	{
+		return fsFat12ReadRootDirectoryAt((unsigned char *)buffer, length, offset);
+	}
+	if (!vnode->Directory)
+	{
+		// File data is read through the page cache
+		return pageCacheReadAt(vnode, buffer, length, offset);
+	}
+	// Calculate starting cluster
+	uint32_t clusterIndex = offset / mountInfo.ClusterSize;
+	uint32_t clusterOffset = offset % mountInfo.ClusterSize;
+	uint32_t currentCluster = fsFat12FindCluster(vnode, clusterIndex);
+	while (length > 0 && currentCluster != 0)
+	{
+		readLength = fsFat12ReadCluster(mountInfo.Device, currentCluster, (unsigned char *)buffer, clusterOffset, length);
+		buffer += readLength;
+		length -= readLength;
+		totalRead += readLength;
+		if (clusterOffset + readLength == mountInfo.ClusterSize && length > 0)
+		{
+			currentCluster = fsFat12FindCluster(vnode, ++clusterIndex);
+		}
+		clusterOffset = 0;
+	}
+	return totalRead;
+}
+
+// Read up to count directory entries from the current position of a directory.
+// Deleted entries are skipped.  Returns the number of entries read, which is
+// 0 once the end of the directory has been reached.
+
+static int fsFat12ReadDirectory(File * directory, DirectoryEntry * directoryEntries, int count)
+{
+	DirectoryIterator iterator;
+	DirectoryEntry * directoryEntry;
+	int found = 0;
+
+	fsFat12StartDirectory(&iterator, directory->Vnode, directory->Position);
+	while (found < count && directory->Eof == 0)
+	{
+		if ((directoryEntry = fsFat12NextEntry(&iterator)) == 0)
+		{
+			directory->Eof = 1;
+			break;
+		}
+		directory->Position = iterator.Offset;
+		if (directoryEntry->Filename[0] == 0)
+		{
+			// An empty entry marks the end of the directory
+			directory->Eof = 1;
+			break;
+		}
+		if (directoryEntry->Filename[0] != 0xE5 && directoryEntry->Attrib != ATTR_LONGNAME)
+		{
+			memmove(&directoryEntries[found++], directoryEntry, sizeof(DirectoryEntry));
+		}
+	}
+	fsFat12EndDirectory(&iterator);
+	return found;
+}
+
+// Get the disk sectors holding page index of a file, for the page cache.  
+// sectors[i] is set to the sector holding the i'th sector of the page, or to 0 
+// if that part of the page is past the end of the file or has not been given
+// a disk sector yet.  If allocate is 1, the page is about to be written back, 
+// so clusters are first allocated for any data that does not have them.
+// Returns -1 if the vnode is not a file.
+
+static int fsFat12MapPage(Vnode * vnode, uint32_t index, uint32_t * sectors, int allocate)
+{
+	uint32_t offset = index * PGSIZE;
+
+	memset(sectors, 0, SECTORSPERPAGE * sizeof(uint32_t));
+	if (vnode->Directory)
+	{
+		return -1;
+	}
+	if (allocate)
+	{
+		fsFat12AllocateDelayed(vnode);
+	}
+	for (int i = 0; i < SECTORSPERPAGE && offset < vnode->Size; i++)
+	{
+		sectors[i] = fsFat12SectorAtOffset(vnode, offset);
+		offset += bootSector.Bpb.BytesPerSector;
+	}
+	return 0;
+}
+
+// Write to a file at the given offset.  The position of the file is not changed.
+// Writes go into the page cache and are written to disk later by the flusher.
+// Returns the number of bytes written or -1 on error.
+
+static int fsFat12WriteAt(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	int written;
+	int delayed;
+
+	if (vnode->Directory || length < 0)
+	{
+		return -1;
+	}
+	// Note whether the write goes past the end of the clusters of the file before
+	// making it, so that the flusher allocates clusters if it writes the pages back.
+	// It is noted again afterwards in case clusters were being allocated for the
+	// file meanwhile, before its size had been changed.
+	delayed = length > 0 && fsFat12SectorAtOffset(vnode, offset + length - 1) == 0;
+	if (delayed)
+	{
+		vnode->Delayed = 1;
+	}
+	if ((written = pageCacheWriteAt(vnode, buffer, length, offset)) > 0)
+	{
+		vnode->DirectoryEntryChanged = 1;
+		if (delayed)
+		{
+			vnode->Delayed = 1;
+		}
+	}
+	return written;
+}
+
+// Truncate a file to zero length, freeing its clusters
+
+static int fsFat12Truncate(Vnode * vnode)
+{
+	uint32_t cluster;
+	uint32_t nextCluster;
+	int freed;
+
+	if (vnode->Directory)
+	{
+		return -1;
+	}
+	// Dirty pages must not be written to the clusters once they have been freed
+	pageCacheInvalidate(vnode);
+
+	// First detach the clusters from the file.  If there is a crash before they 
+	// have all been freed, they are lost but the file system is still consistent.
+	logBeginOperation();
+	cluster = fsFat12EntryCluster(&vnode->DirectoryEntry);
+	fsFat12SetEntryCluster(&vnode->DirectoryEntry, 0);
+	vnode->Size = 0;
+	fsFat12ForgetClusterRuns(vnode);
+	vnode->Delayed = 0;
+	vnode->DirectoryEntryChanged = 1;
+	fsFat12WriteDirectoryEntry(vnode, 0);
+	logEndOperation();
+
+	// Then free them, a few FAT sectors' worth in each operation
+	while (cluster != 0)
+	{
+		logBeginOperation();
+		sleeplockAcquire(&fatLock);
+		freed = 0;
+		while (cluster != 0 && (freed == 0 || fsFat12FatSectorsChanged() + 2 <= (MAXOPBLOCKS - 1) / bootSector.Bpb.NumberOfFats))
+		{
+			nextCluster = fsFat12GetNextCluster(cluster);
+			fsFat12SetClusterEntry(cluster, 0);
+			cluster = nextCluster;
+			freed++;
+		}
+		fsFat12WriteFat();
+		sleeplockRelease(&fatLock);
+		logEndOperation();
+	}
+	return 0;
+}
+
+// Decode a date and time from a directory entry.  The date holds the year 
+// from 1980 in bits 9-15, the month in bits 5-8 and the day in bits 0-4.  The
+// time holds the hour in bits 11-15, the minute in bits 5-10 and the second
+// divided by 2 in bits 0-4.  A date of 0 was never set.
+
+static void fsFat12DecodeTime(uint16_t date, uint16_t time, StatTime * decoded)
+{
+	if (date == 0)
+	{
+		return;
+	}
+	decoded->year = 1980 + (date >> 9);
+	decoded->month = (date >> 5) & 0x0F;
+	decoded->day = date & 0x1F;
+	decoded->hour = time >> 11;
+	decoded->minute = (time >> 5) & 0x3F;
+	decoded->second = (time & 0x1F) * 2;
+}
+
+// Fill in the details of a file from the copy of its directory entry held in
+// its vnode
+
+static void fsFat12Stat(Vnode * vnode, Stat * st)
+{
+	st->cluster = fsFat12FirstCluster(vnode);
+	st->attrib = vnode->DirectoryEntry.Attrib;
+	fsFat12DecodeTime(vnode->DirectoryEntry.DateCreated, vnode->DirectoryEntry.TimeCreated, &st->created);
+	fsFat12DecodeTime(vnode->DirectoryEntry.LastModDate, vnode->DirectoryEntry.LastModTime, &st->modified);
+}
+
+//	Closes file
+
+static void fsFat12Close(File * file)
+{
+	if (file->Type == FD_FILE && file->Writable)
+	{
+		// Allocate clusters for any delayed data, write it to them and then
+		// record the new size
+		fsFat12AllocateDelayed(file->Vnode);
+		pageCacheFlushVnode(file->Vnode);
+		if (file->Vnode->DirectoryEntry.FileSize != file->Vnode->Size)
+		{
+			file->Vnode->DirectoryEntryChanged = 1;
+		}
+		logBeginOperation();
+		fsFat12WriteDirectoryEntry(file->Vnode, file->Vnode->Size);
+		logEndOperation();
+	}
+}
+
+// Parse path to get next directory or filename on path. 
+// Returns 0 if we are returning the filename in pathPart or 
+// the length of the directory name if it is a directory name
+
+int fsGetPathPart(char * path, char * pathPart)
+{
+	char * p = path;
+	while (*p != 0 && *p != '\\' && *p != '/')
+	{
+		p++;
+	}
+	int partLength = (int)(p - path);
+	strcpy(pathPart, path);
+	*(pathPart + partLength) = 0;	
+	if (*p == 0)
+	{
+		return 0;
+	}
+	else
+	{
+		return partLength;
+	}
+}
+
+// Characters that cannot be used in filenames.  Those after the first eight
+// can be used in long names but not in short ones.
+
+static const char invalidNameCharacters[] = "\"*/:<>?\\|+,;=[]";
+
+// Check whether c can be used in a name, in a short one if inShortName is 1
+
+static bool fsFat12ValidNameCharacter(char c, bool inShortName)
+{
+	int i;
+
+	if ((uint8_t)c < ' ' || !isascii(c) || (inShortName && c == ' '))
+	{
+		return 0;
+	}
+	for (i = 0; i < (inShortName ? sizeof(invalidNameCharacters) - 1 : 9); i++)
+	{
+		if (c == invalidNameCharacters[i])
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Check whether name is an 8.3 name, which can be held in a short entry alone.
+// Lower case letters are allowed, since short names are compared in upper case.
+
+static bool fsFat12IsShortName(const char * name)
+{
+	int baseLength = 0;
+	int extensionLength = -1;
+
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+	{
+		return 1;
+	}
+	for (const char * p = name; *p != 0; p++)
+	{
+		if (*p == '.')
+		{
+			if (extensionLength >= 0)
+			{
+				return 0;
+			}
+			extensionLength = 0;
+		}
+		else if (!fsFat12ValidNameCharacter(*p, 1))
+		{
+			return 0;
+		}
+		else if (extensionLength >= 0)
+		{
+			extensionLength++;
+		}
+		else
+		{
+			baseLength++;
+		}
+	}
+	return baseLength >= 1 && baseLength <= 8 && extensionLength != 0 && extensionLength <= 3;
+}
+
+// Check whether name can be used as a long filename
+
+static bool fsFat12IsLongName(const char * name)
+{
+	int length = strlen(name);
+
+	if (length == 0 || length > MAXLONGNAME || name[length - 1] == '.' || name[length - 1] == ' ')
+	{
+		return 0;
+	}
+	for (const char * p = name; *p != 0; p++)
+	{
+		if (!fsFat12ValidNameCharacter(*p, 0))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Make the nth short name for a file whose name is not an 8.3 name, as
+// BASE~n.EXT, from the characters of name before its last '.' and the first
+// three after it.  Characters that cannot be in short names are left out
+// or replaced with '_'.  shortName is given as a name rather than as 8.3 
+// fields, so that it can be looked up like any other.
+
+static void fsFat12MakeShortName(const char * name, int n, char * shortName)
+{
+	const char * extension = 0;
+	char tail[8];
+	int tailLength = 0;
+	int length = 0;
+	int i;
+
+	// A leading '.' does not start an extension
+	for (const char * p = name + 1; *p != 0; p++)
+	{
+		if (*p == '.')
+		{
+			extension = p;
+		}
+	}
+	tail[tailLength++] = '~';
+	for (i = n; i > 0; i /= 10)
+	{
+		tailLength++;
+	}
+	for (i = tailLength - 1; n > 0; i--, n /= 10)
+	{
+		tail[i] = '0' + n % 10;
+	}
+	for (const char * p = name; *p != 0 && p != extension && length < 8 - tailLength; p++)
+	{
+		if (*p != ' ' && *p != '.')
+		{
+			shortName[length++] = fsFat12ValidNameCharacter(*p, 1) ? toupper(*p) : '_';
+		}
+	}
+	memmove(shortName + length, tail, tailLength);
+	length += tailLength;
+	if (extension != 0)
+	{
+		shortName[length++] = '.';
+		for (i = 1; extension[i] != 0 && i <= 3; i++)
+		{
+			shortName[length++] = fsFat12ValidNameCharacter(extension[i], 1) ? toupper(extension[i]) : '_';
+		}
+	}
+	shortName[length] = 0;
+}
+
+// Fill in the long filename entry holding part sequence of longName, for the
+// file whose short name has checksum
+
+static void fsFat12SetLongNameEntry(LongNameEntry * part, const char * longName, int sequence, bool last, uint8_t checksum)
+{
+	uint16_t characters[LONGNAMECHARS];
+	int position = (sequence - 1) * LONGNAMECHARS;
+	int length = strlen(longName);
+
+	// The name ends with a nul if there is room, and the rest is padded with 0xFFFF
+	for (int i = 0; i < LONGNAMECHARS; i++)
+	{
+		characters[i] = position + i < length ? (uint8_t)longName[position + i] : position + i == length ? 0 : 0xFFFF;
+	}
+	memset(part, 0, sizeof(LongNameEntry));
+	part->Sequence = sequence | (last ? LONGNAMELAST : 0);
+	part->Attrib = ATTR_LONGNAME;
+	part->Checksum = checksum;
+	memmove(part->Name1, characters, sizeof(part->Name1));
+	memmove(part->Name2, characters + 5, sizeof(part->Name2));
+	memmove(part->Name3, characters + 11, sizeof(part->Name3));
+}
+
+// Add a directory entry to a directory.  If longName is not empty, it is written
+// in long filename entries just before the new entry, so the first run of free
+// entries long enough for all of them is used.  A sub-directory is given another
+// cluster if it is full.  The location of the new entry is returned in 
+// entrySector and entryOffset.  Returns -1 if there is no room for the entry.
+// A log operation must have been started.
+
+static int fsFat12AddDirectoryEntry(Vnode * directory, DirectoryEntry * newEntry, const char * longName, uint32_t * entrySector, uint32_t * entryOffset)
+{
+	DirectoryIndex * index;
+	DiskBuffer * b;
+	DirectoryEntry * directoryEntry;
+	uint32_t sector;
+	uint32_t lastCluster;
+	uint32_t clusterCount;
+	uint32_t offset;
+	uint32_t runStart = 0;
+	int runLength = 0;
+	int count = 1 + (strlen(longName) + LONGNAMECHARS - 1) / LONGNAMECHARS;
+	uint8_t checksum = fsFat12ShortNameChecksum(newEntry);
+
+	for (offset = 0; runLength < count; offset += bootSector.Bpb.BytesPerSector)
+	{
+		if ((sector = fsFat12SectorAtOffset(directory, offset)) == 0)
+		{
+			// The root directory cannot grow
+			if (fsFat12IsFixedRoot(directory))
+			{
+				return -1;
+			}
+			sleeplockAcquire(&fatLock);
+			if (fsFat12ExtendChain(directory, 1) == 0)
+			{
+				sleeplockRelease(&fatLock);
+				return -1;
+			}
+			// A cleared cluster holds only unused entries.  It is written to disk
+			// before the change to the FAT that links it to the directory.
+			lastCluster = fsFat12LastCluster(directory, &clusterCount);
+			for (uint32_t i = 0; i < bootSector.Bpb.SectorsPerCluster; i++)
+			{
+				sector = fsFat12ClusterToSector(lastCluster) + i;
+				fsFat12ClearSector(sector);
+				diskBufferWriteBack(mountInfo.Device, &sector, 1);
+			}
+			fsFat12WriteFat();
+			sleeplockRelease(&fatLock);
+			sector = fsFat12SectorAtOffset(directory, offset);
+		}
+		b = diskBufferRead(mountInfo.Device, sector);
+		directoryEntry = (DirectoryEntry *)b->Data;
+		for (int i = 0; i < 16 && runLength < count; i++)
+		{
+			if (directoryEntry->Filename[0] == 0 || directoryEntry->Filename[0] == 0xE5)
+			{
+				if (runLength++ == 0)
+				{
+					runStart = offset + i * sizeof(DirectoryEntry);
+				}
+			}
+			else
+			{
+				runLength = 0;
+			}
+			directoryEntry++;
+		}
+		diskBufferRelease(b);
+	}
+	// The run may cross into the next sector
+	for (int i = 0; i < count; i++)
+	{
+		offset = runStart + i * sizeof(DirectoryEntry);
+		sector = fsFat12SectorAtOffset(directory, offset);
+		b = diskBufferRead(mountInfo.Device, sector);
+		directoryEntry = (DirectoryEntry *)(b->Data + offset % BSIZE);
+		if (i == count - 1)
+		{
+			memmove(directoryEntry, newEntry, sizeof(DirectoryEntry));
+		}
+		else
+		{
+			fsFat12SetLongNameEntry((LongNameEntry *)directoryEntry, longName, count - 1 - i, i == 0, checksum);
+		}
+		logWrite(b);
+		fsFat12SectorChanged(b);
+		diskBufferRelease(b);
+	}
+	sleeplockAcquire(&directoryIndexLock);
+	if ((index = fsFat12FindIndex(directory)) != 0)
+	{
+		fsFat12IndexFile(index, newEntry, longName, runStart, offset);
+	}
+	sleeplockRelease(&directoryIndexLock);
+	*entrySector = sector;
+	*entryOffset = offset % BSIZE;
+	return 0;
+}
+
+// Create a file in a directory.  A name that is not an 8.3 name is kept as a
+// long filename and the file is given a short name that no other file in the
+// directory has.  createLock must be held, so that no other file is given the
+// same name meanwhile.  Returns its vnode or 0 if it could not be created.
+
+static Vnode * fsFat12CreateInDirectory(Mount * mount, Vnode * directory, const char * name)
+{
+	DirectoryEntry newEntry;
+	DirectoryEntry existing;
+	uint32_t entrySector;
+	uint32_t entryOffset;
+	char shortName[13];
+	const char * longName = "";
+	int n;
+
+	if (fsFat12IsShortName(name))
+	{
+		safestrcpy(shortName, name, sizeof(shortName));
+	}
+	else
+	{
+		if (!fsFat12IsLongName(name))
+		{
+			return 0;
+		}
+		for (n = 1; ; n++)
+		{
+			if (n > 999999)
+			{
+				return 0;
+			}
+			fsFat12MakeShortName(name, n, shortName);
+			if (!fsFat12FindInDirectory(directory, shortName, &existing, &entrySector, &entryOffset))
+			{
+				break;
+			}
+		}
+		longName = name;
+	}
+	memset(&newEntry, 0, sizeof(DirectoryEntry));
+	toDosFileName(shortName, (char *)newEntry.Filename, 11);
+	newEntry.Attrib = 0x20;
+	logBeginOperation();
+	if (fsFat12AddDirectoryEntry(directory, &newEntry, longName, &entrySector, &entryOffset) < 0)
+	{
+		logEndOperation();
+		return 0;
+	}
+	logEndOperation();
+	return fsFat12GetVnode(mount, &newEntry, entrySector, entryOffset);
+}
+
+//  Open a file
+//
+//  mount     = Where the file system is mounted
+//  path      = The path of the file from the root of the file system, starting with a '\' or '/'
+//  directory = 1 if we are opening a sub-directory, 0 otherwise
+//  create    = 1 to create the file if it does not exist
+//
+//  Returns the vnode of the file or 0 if it could not be found or created.
+
+static Vnode * fsFat12Open(Mount * mount, char * path, int directory, int create)
+{
+	DirectoryEntry directoryEntry;
+	uint32_t entrySector;
+	uint32_t entryOffset;
+	Vnode * current;
+	Vnode * next;
+	char pathPart[MAXCWDSIZE];
+	char * p = path + 1;
+	int partLength;
+	bool creating;
+
+	fsFat12RootDirectoryEntry(&directoryEntry);
+	if ((current = fsFat12GetVnode(mount, &directoryEntry, 0, 0)) == 0)
+	{
+		return 0;
+	}
+	while (*p != 0)
+	{
+		partLength = fsGetPathPart(p, pathPart);
+		// Only the last part of the path can be created.  It is looked up and
+		// created under createLock, so that two processes cannot both create it.
+		creating = create && !directory && partLength == 0 && pathPart[0] != '.';
+		if (creating)
+		{
+			sleeplockAcquire(&createLock);
+		}
+		if (fsFat12FindInDirectory(current, pathPart, &directoryEntry, &entrySector, &entryOffset))
+		{
+			next = fsFat12GetVnode(mount, &directoryEntry, entrySector, entryOffset);
+		}
+		else if (creating)
+		{
+			next = fsFat12CreateInDirectory(mount, current, pathPart);
+		}
+		else
+		{
+			next = 0;
+		}
+		if (creating)
+		{
+			sleeplockRelease(&createLock);
+		}
+		vfsReleaseVnode(current);
+		if ((current = next) == 0)
+		{
+			return 0;
+		}
+		if (partLength == 0)
+		{
+			break;
+		}
+		// Check to see if we found a directory.  If not, then we cannot continue
+		if (!current->Directory)
+		{
+			vfsReleaseVnode(current);
+			return 0;
+		}
+		// If the path ends with a '/' or '\', it names the directory we just found
+		p = p + partLength + 1;
+	}
+	if (directory && !current->Directory)
+	{
+		vfsReleaseVnode(current);
+		return 0;
+	}
+	return current;
+}
+
+// Check that the metadata log file found on a volume can be used.  It must hold
+// LOGSIZE + 1 sectors in one run of clusters.  Returns the first sector of the
+// log or 0 if it cannot be used.
+
+static uint32_t fsFat12LogStart(DirectoryEntry * logEntry)
+{
+	uint32_t logClusters = ((LOGSIZE + 1) * BSIZE + mountInfo.ClusterSize - 1) / mountInfo.ClusterSize;
+	uint32_t cluster = fsFat12EntryCluster(logEntry);
+
+	if (cluster < 2 || cluster + logClusters > mountInfo.NumClusters + 2 || logEntry->FileSize < (LOGSIZE + 1) * BSIZE)
+	{
+		return 0;
+	}
+	for (uint32_t i = 1; i < logClusters; i++)
+	{
+		if (fsFat12GetClusterEntry(cluster + i - 1) != cluster + i)
+		{
+			return 0;
+		}
+	}
+	return fsFat12ClusterToSector(cluster);
+}
 
+static FileSystemOperations fsFat12Operations =
+{
+	.Name = "fat",
+	.Open = fsFat12Open,
+	.ReadAt = fsFat12ReadAt,
+	.WriteAt = fsFat12WriteAt,
+	.Truncate = fsFat12Truncate,
+	.ReadDirectory = fsFat12ReadDirectory,
+	.MapPage = fsFat12MapPage,
+	.Stat = fsFat12Stat,
+	.Close = fsFat12Close
+};
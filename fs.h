@@ -15,10 +15,44 @@ struct _DirectoryEntry
 	uint32_t  FileSize;
 };
 
+// A VFAT long filename entry.  A long name is held in up to 20 of these, each
+// holding 13 of its UCS-2 characters, just before the short entry of the file
+// and in reverse order.  Their Attrib is ATTR_LONGNAME, which older systems
+// skip over as a volume label.
+
+#define ATTR_LONGNAME		0x0F
+#define LONGNAMELAST		0x40	// Set in the sequence number of the last part of a name
+#define LONGNAMECHARS		13		// Characters in each entry
+#define MAXLONGNAME			255		// Longest long filename
+
+typedef struct _LongNameEntry
+{
+	uint8_t		Sequence;		// Number of this part of the name, from 1
+	uint16_t	Name1[5];
+	uint8_t		Attrib;
+	uint8_t		Type;
+	uint8_t		Checksum;		// Checksum of the short name that the entry belongs to
+	uint16_t	Name2[6];
+	uint16_t	FirstCluster;
+	uint16_t	Name3[2];
+} __attribute__((packed)) LongNameEntry;
+
+// A run of contiguous clusters found in the cluster chain of a file
+
+typedef struct _ClusterRun
+{
+	uint32_t	Index;			// Index in the chain of the first cluster of the run
+	uint32_t	Cluster;		// First cluster of the run
+	uint32_t	Length;			// Number of clusters in the run (0 if unused)
+} ClusterRun;
+
+#define NCLUSTERRUNS	4
+
 // Filesystem mount information
 
 struct _MountInfo
 {
+	uint32_t Device;			// Block device the file system is on
 	uint32_t NumSectors;
 	uint32_t FatOffset;
 	uint32_t NumRootEntries;
@@ -26,5 +60,8 @@ struct _MountInfo
 	uint32_t RootSize;
 	uint32_t FatSize;
 	uint32_t ClusterSize;
+	uint32_t NumClusters;
+	uint32_t FatType;			// 12, 16 or 32 (the number of bits in a FAT entry)
+	uint32_t RootCluster;		// First cluster of the root directory on FAT32, otherwise 0
 };
 
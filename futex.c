@@ -0,0 +1,128 @@
+// Futexes: waiting in the kernel on a word of user memory.
+//
+// futexwait(address, value) puts the process to sleep if the word at address
+// still holds value, and futexwake(address, count) wakes up to count of the
+// processes waiting on that word.  The locks in ulib.c only enter the kernel
+// when they have to wait or when someone is waiting.
+//
+// A futex is identified by the physical address of the word, so the threads of
+// a process, and processes that have attached the same shared memory segment
+// (see shm.c), find the same futex.  Writable mappings of files are private
+// copies, so processes mapping a file do not share futexes in it.  The kernel
+// address of the word is used as the sleep channel.  The futexes are hashed 
+// into buckets, each with a lock that is held while the word is checked and
+// is then passed to sleep, so a wake cannot be missed between the check and
+// going to sleep.
+//
+// The word is found and read while the MemoryLock of the process is held, so 
+// that another thread cannot unmap its page in the meantime.  The page stays
+// mapped while the process sleeps, since memory cannot be unmapped while a
+// process has threads, and a process without threads is the one sleeping.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+
+#define FUTEXHASHSIZE	32			// Buckets that futexes are hashed into
+
+struct
+{
+	Spinlock		Lock[FUTEXHASHSIZE];
+} futexTable;
+
+void futexInitialise(void)
+{
+	for (int i = 0; i < FUTEXHASHSIZE; i++)
+	{
+		spinlockInitialise(&futexTable.Lock[i], "futex");
+	}
+}
+
+// Get the kernel address of the word at address in process p, or 0 if it is
+// not aligned or not present.  The caller must have checked that the word 
+// lies in the process memory (which also faults in mapped pages), and must
+// hold p->MemoryLock.
+
+static int * futexWord(Process * p, uint32_t address)
+{
+	char * page;
+
+	if (address % sizeof(int) != 0)
+	{
+		return 0;
+	}
+	if ((page = mapVirtualAddressToKernelAddress(p->PageTable, (char *)PGROUNDDOWN(address))) == 0)
+	{
+		return 0;
+	}
+	return (int *)(page + address % PGSIZE);
+}
+
+// Get the lock of the bucket for a futex
+
+static Spinlock * futexLock(int * word)
+{
+	return &futexTable.Lock[((uint32_t)word / sizeof(int)) % FUTEXHASHSIZE];
+}
+
+// Sleep until the futex at address is woken, if it still holds value.  Returns 
+// 0 once woken or -1 if the word did not hold value.
+
+int futexWait(uint32_t address, int value)
+{
+	Process * curproc = myThreadGroup();
+	int * word;
+	Spinlock * lock;
+
+	sleeplockAcquire(&curproc->MemoryLock);
+	if ((word = futexWord(curproc, address)) == 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	lock = futexLock(word);
+	spinlockAcquire(lock);
+	if (*word != value)
+	{
+		spinlockRelease(lock);
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	sleeplockRelease(&curproc->MemoryLock);
+	sleep(word, lock);
+	spinlockRelease(lock);
+	return myProcess()->IsKilled ? -1 : 0;
+}
+
+// Wake up to count of the processes waiting on the futex at address.  Returns
+// the number woken or -1 on error.
+
+int futexWake(uint32_t address, int count)
+{
+	Process * curproc = myThreadGroup();
+	int * word;
+	Spinlock * lock;
+	int woken;
+
+	if (count < 0)
+	{
+		return -1;
+	}
+	sleeplockAcquire(&curproc->MemoryLock);
+	if ((word = futexWord(curproc, address)) == 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	lock = futexLock(word);
+	spinlockAcquire(lock);
+	woken = wakeupCount(word, count);
+	spinlockRelease(lock);
+	sleeplockRelease(&curproc->MemoryLock);
+	return woken;
+}
@@ -5,13 +5,14 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
-#include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "blockdev.h"
 
 #define SECTOR_SIZE		512
 
@@ -28,6 +29,7 @@
 #define IDE_CMD_WRITE			0x30
 #define IDE_CMD_READMULTIPLE	0xc4
 #define IDE_CMD_WRITEMULTIPLE	0xc5
+#define IDE_CMD_IDENTIFY		0xec
 
 // idequeue points to the DiskBuffer now being read/written to the disk.
 // idequeue->QueueNext points to the next DiskBuffer to be processed.
@@ -38,7 +40,11 @@ static DiskBuffer *		idequeue;
 
 static int havedisk1;
 
+static BlockDevice		ideDisks[2];
+
 static void ideStartRequest(DiskBuffer*);
+static void ideQueueRequest(DiskBuffer*);
+static void ideWaitForRequest(DiskBuffer*);
 
 // Wait for IDE disk to become ready. 
 //
@@ -57,6 +63,26 @@ static int ideWait(int checkForError)
 	return 0;
 }
 
+// Get the number of sectors on a drive with the IDENTIFY command.  Returns 0 if
+// the drive does not say.  Interrupts from the drive are turned off while the 
+// command runs, since there is no request in idequeue for it.
+
+static uint32_t ideCapacity(int drive)
+{
+	uint32_t identify[SECTOR_SIZE / 4];
+
+	outputByteToPort(0x3f6, 2);
+	outputByteToPort(0x1f6, 0xe0 | (drive << 4));
+	outputByteToPort(0x1f7, IDE_CMD_IDENTIFY);
+	if (ideWait(1) < 0)
+	{
+		return 0;
+	}
+	inputSequenceFromPort(0x1f0, identify, SECTOR_SIZE / 4);
+	// Words 60 and 61 hold the number of sectors that can be addressed with LBA28
+	return identify[30];
+}
+
 void ideInitialise(void)
 {
 	int i;
@@ -76,6 +102,16 @@ void ideInitialise(void)
 		}
 	}
 
+	// Register each disk as a block device
+	for (i = 0; i <= havedisk1; i++)
+	{
+		ideDisks[i].Name = "ide";
+		ideDisks[i].Capacity = ideCapacity(i);
+		ideDisks[i].QueueRequest = ideQueueRequest;
+		ideDisks[i].WaitForRequest = ideWaitForRequest;
+		blockDeviceRegister(i, &ideDisks[i]);
+	}
+
 	// Switch back to disk 0.
 	outputByteToPort(0x1f6, 0xe0 | (0<<4));
 }
@@ -155,27 +191,15 @@ void ideInterruptHandler(void)
 	spinlockRelease(&idelock);
 }
 
-// Sync DiskBuffer with disk.
-// If B_DIRTY is set, write DiskBuffer to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read DiskBuffer from disk, set B_VALID.
+// Add a request to sync DiskBuffer with disk to idequeue without waiting for 
+// it to finish.  This lets several requests be in flight at once.  Both disks
+// share idequeue, since they are on the same controller.  Called through
+// blockDeviceQueueRequest, which checks the request.
 
-void ideReadWrite(DiskBuffer *b)
+static void ideQueueRequest(DiskBuffer *b)
 {
 	DiskBuffer **pp;
 
-	if (!isHoldingSleeplock(&b->Lock))
-	{
-		panic("ideReadWrite: DiskBuffer not locked");
-	}
-	if ((b->Flags & (B_VALID | B_DIRTY)) == B_VALID)
-	{
-		panic("ideReadWrite: nothing to do");
-	}
-	if (b->Device != 0 && !havedisk1)
-	{
-		panic("ideReadWrite: ide disk 1 not present");
-	}
-
 	spinlockAcquire(&idelock);  
 
 	// Append b to idequeue.
@@ -189,12 +213,17 @@ void ideReadWrite(DiskBuffer *b)
 	{
 		ideStartRequest(b);
 	}
+	spinlockRelease(&idelock);
+}
 
-	// Wait for request to finish.
+// Wait for a request added by ideQueueRequest to finish.
+
+static void ideWaitForRequest(DiskBuffer *b)
+{
+	spinlockAcquire(&idelock);  
 	while((b->Flags & (B_VALID | B_DIRTY)) != B_VALID)
 	{
 		sleep(b, &idelock);
 	}
-
-	  spinlockRelease(&idelock);
+	spinlockRelease(&idelock);
 }
@@ -14,16 +14,10 @@ main(void)
 	for (;;) 
 	{
 		printf("init: starting sh.exe\n");
-		pid = fork();
+		pid = spawn("/usrbin/sh.exe", argv, 0, 0);
 		if (pid < 0) 
 		{
-			printf("init: fork failed\n");
-			exit();
-		}
-		if (pid == 0) 
-		{
-			exec("/usrbin/sh.exe", argv);
-			printf("init: exec sh.exe failed\n");
+			printf("init: spawn sh.exe failed\n");
 			exit();
 		}
 		while ((wpid = wait()) >= 0 && wpid != pid)
@@ -3,6 +3,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -32,10 +34,17 @@ void main()
 	processTableInitialise();							// process table
 	trapVectorsInitialise();							// trap vectors
 	diskBufferCacheInitialise();						// buffer cache
+	pageCacheInitialise();								// page cache
 	filesInitialise();									// file table
+	futexInitialise();									// futex wait queues
+	shmInitialise();									// shared memory segments
+	vfsInitialise();									// mount table and vnode cache
+	tmpfsInitialise();									// memory-backed file system
 	ideInitialise();									// disk 
+	ramDiskInitialise();								// RAM disk
 	initialiseRestOfkernelMemory(P2V(4 * 1024 * 1024), P2V(PHYSTOP));			// must come after startothers()
 	initialiseFirstUserProcess();						// first user process
+	createKernelThread(diskBufferFlusher, "flusher");	// buffer and page cache write-back
 	mpmain();											// finish this processor's setup
 }
 
@@ -44,6 +53,7 @@ static void mpmain(void)
 {
 	cprintf("cpu%d: starting %d\n", cpuId(), cpuId());
 	interruptDescriptorTableInitialise();       
+	sysenterInitialise();						// fast system calls
 	atomicExchange(&(myCpu()->Started), 1); // tell startothers() we're up
 	scheduler();    
 }
\ No newline at end of file
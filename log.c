@@ -0,0 +1,345 @@
+// Write-ahead log for file system metadata.
+//
+// Changes to the FAT and to directory entries are made in transactions so
+// that the file system is left consistent if the machine crashes.  A system
+// call that changes metadata looks like this:
+//
+//   logBeginOperation();
+//   b = diskBufferRead(...);
+//   modify b->Data[];
+//   logWrite(b);
+//   logEndOperation();
+//
+// logWrite records the sector and pins its buffer in the cache, so that it
+// is not written to its home location before the transaction commits.
+// Several sectors written in one transaction (for example, the same FAT
+// sector) are only logged once.
+//
+// Transactions are committed in groups: the commit is done by the last of
+// the operations running at once to finish.  Committing writes the logged
+// sectors to the log one after the other and then writes the log header,
+// which is the commit point.  The sectors are not written to their home
+// locations straight away.  They are just marked dirty and left to the
+// flusher.  Before the log is used again, any of them that are still dirty
+// are written back (the checkpoint).
+//
+// There is no spare space in a FAT12 volume for the log, so it is kept in a
+// hidden system file whose clusters are contiguous.  The file is made when the
+// disk image is built.  A volume without it is used without a log (see
+// fsFat12Initialise), and logBeginOperation and logEndOperation do nothing.
+// The first sector of the log holds the header and the rest hold the sectors
+// that were logged.  The log is read and written through its own buffers
+// rather than through the buffer cache.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+// Contents of the header sector, both on disk and in memory
+
+typedef struct _LogHeader
+{
+	uint32_t			Count;
+	uint32_t			Sector[LOGSIZE];
+} LogHeader;
+
+struct
+{
+	Spinlock			Lock;
+	int					Enabled;
+	uint32_t			Device;
+	uint32_t			Start;				// First sector of the log (the header)
+	int					Outstanding;		// Number of operations running
+	int					Committing;			// In commit(), please wait
+	LogHeader			Header;				// Sectors logged in the current transaction
+	LogHeader			Committed;			// Sectors of the last committed transaction
+	DiskBuffer			Buffer[LOGSIZE + 1];
+} metadataLog;
+
+// Read or write sector of the log through one of the log's own buffers.
+// The buffer is left locked.
+
+static DiskBuffer * logSectorBuffer(int index, uint32_t sector, int write)
+{
+	DiskBuffer *b = &metadataLog.Buffer[index];
+
+	sleeplockAcquire(&b->Lock);
+	b->Device = metadataLog.Device;
+	b->SectorNumber = sector;
+	b->Flags = write ? B_VALID | B_DIRTY : 0;
+	return b;
+}
+
+// Write count of the log's buffers to disk together and unlock them
+
+static void logWriteBuffers(int first, int count)
+{
+	for (int i = first; i < first + count; i++)
+	{
+		blockDeviceQueueRequest(&metadataLog.Buffer[i]);
+	}
+	for (int i = first; i < first + count; i++)
+	{
+		blockDeviceWaitForRequest(&metadataLog.Buffer[i]);
+		sleeplockRelease(&metadataLog.Buffer[i].Lock);
+	}
+}
+
+// Write the log header to disk.  This is the point at which a
+// transaction commits.
+
+static void logWriteHeader(LogHeader *header)
+{
+	DiskBuffer *b = logSectorBuffer(0, metadataLog.Start, 1);
+
+	memset(b->Data, 0, BSIZE);
+	memmove(b->Data, header, sizeof(LogHeader));
+	logWriteBuffers(0, 1);
+}
+
+// Copy the sectors of a committed transaction from the log to their home
+// locations.  Used to recover after a crash.
+
+static void logInstall(LogHeader *header)
+{
+	DiskBuffer *from;
+	DiskBuffer *to;
+
+	for (int i = 0; i < header->Count; i++)
+	{
+		from = logSectorBuffer(1, metadataLog.Start + 1 + i, 0);
+		blockDeviceReadWrite(from);
+		to = diskBufferRead(metadataLog.Device, header->Sector[i]);
+		memmove(to->Data, from->Data, BSIZE);
+		diskBufferWrite(to);
+		diskBufferRelease(to);
+		sleeplockRelease(&from->Lock);
+	}
+}
+
+// Find sector in the sectors logged in a transaction.
+// Returns its index in the log or -1.
+
+static int logFind(LogHeader *header, uint32_t sector)
+{
+	for (int i = 0; i < header->Count; i++)
+	{
+		if (header->Sector[i] == sector)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Make sure that the sectors of the last committed transaction have all
+// reached their home locations, so that the log can be used again.  Most of
+// them will normally have been written back by the flusher already.
+
+static void logCheckpoint(void)
+{
+	uint32_t sectors[LOGSIZE];
+	int count = 0;
+	DiskBuffer *b;
+
+	if (metadataLog.Committed.Count == 0)
+	{
+		return;
+	}
+	for (int i = 0; i < metadataLog.Committed.Count; i++)
+	{
+		if (logFind(&metadataLog.Header, metadataLog.Committed.Sector[i]) < 0)
+		{
+			sectors[count++] = metadataLog.Committed.Sector[i];
+		}
+		else
+		{
+			// The cached copy has been changed again by the transaction being
+			// committed, so copy the committed contents over from the log.
+			b = logSectorBuffer(1, metadataLog.Start + 1 + i, 0);
+			blockDeviceReadWrite(b);
+			b->SectorNumber = metadataLog.Committed.Sector[i];
+			b->Flags |= B_DIRTY;
+			blockDeviceReadWrite(b);
+			sleeplockRelease(&b->Lock);
+		}
+	}
+	diskBufferWriteBack(metadataLog.Device, sectors, count);
+	metadataLog.Committed.Count = 0;
+	logWriteHeader(&metadataLog.Committed);
+}
+
+// Commit the current transaction
+
+static void logCommit(void)
+{
+	DiskBuffer *from;
+	DiskBuffer *to;
+	int i;
+
+	if (metadataLog.Header.Count == 0)
+	{
+		return;
+	}
+	logCheckpoint();
+
+	// Copy the logged sectors from the cache to the log
+	for (i = 0; i < metadataLog.Header.Count; i++)
+	{
+		from = diskBufferRead(metadataLog.Device, metadataLog.Header.Sector[i]);
+		to = logSectorBuffer(1 + i, metadataLog.Start + 1 + i, 1);
+		memmove(to->Data, from->Data, BSIZE);
+		diskBufferRelease(from);
+	}
+	logWriteBuffers(1, metadataLog.Header.Count);
+	logWriteHeader(&metadataLog.Header);
+
+	// Leave the sectors to be written to their home locations by the flusher
+	for (i = 0; i < metadataLog.Header.Count; i++)
+	{
+		from = diskBufferRead(metadataLog.Device, metadataLog.Header.Sector[i]);
+		diskBufferMarkDirty(from);
+		diskBufferUnpin(from);
+		diskBufferRelease(from);
+	}
+	metadataLog.Committed = metadataLog.Header;
+	metadataLog.Header.Count = 0;
+}
+
+// Start using the log held in LOGSIZE + 1 sectors from start on dev.  If the
+// log holds a committed transaction, the machine crashed before it was
+// checkpointed, so its sectors are installed now.
+
+void logInitialise(uint32_t dev, uint32_t start)
+{
+	DiskBuffer *b;
+
+	spinlockInitialise(&metadataLog.Lock, "log");
+	for (int i = 0; i < LOGSIZE + 1; i++)
+	{
+		sleeplockInitialise(&metadataLog.Buffer[i].Lock, "log buffer");
+	}
+	metadataLog.Device = dev;
+	metadataLog.Start = start;
+
+	b = logSectorBuffer(0, start, 0);
+	blockDeviceReadWrite(b);
+	memmove(&metadataLog.Header, b->Data, sizeof(LogHeader));
+	sleeplockRelease(&b->Lock);
+	if (metadataLog.Header.Count > LOGSIZE)
+	{
+		panic("logInitialise: bad log header");
+	}
+	if (metadataLog.Header.Count > 0)
+	{
+		logInstall(&metadataLog.Header);
+		metadataLog.Header.Count = 0;
+		logWriteHeader(&metadataLog.Header);
+	}
+	metadataLog.Enabled = 1;
+}
+
+// Called at the start of each operation that changes metadata
+
+void logBeginOperation(void)
+{
+	if (!metadataLog.Enabled)
+	{
+		return;
+	}
+	spinlockAcquire(&metadataLog.Lock);
+	for (;;)
+	{
+		if (metadataLog.Committing)
+		{
+			sleep(&metadataLog, &metadataLog.Lock);
+		}
+		else if (metadataLog.Header.Count + (metadataLog.Outstanding + 1) * MAXOPBLOCKS > LOGSIZE)
+		{
+			// This operation might use up the rest of the log; wait for a commit
+			sleep(&metadataLog, &metadataLog.Lock);
+		}
+		else
+		{
+			metadataLog.Outstanding++;
+			spinlockRelease(&metadataLog.Lock);
+			break;
+		}
+	}
+}
+
+// Called at the end of each operation that changes metadata.
+// Commits if this was the last operation running.
+
+void logEndOperation(void)
+{
+	int doCommit = 0;
+
+	if (!metadataLog.Enabled)
+	{
+		return;
+	}
+	spinlockAcquire(&metadataLog.Lock);
+	metadataLog.Outstanding--;
+	if (metadataLog.Committing)
+	{
+		panic("logEndOperation: committing");
+	}
+	if (metadataLog.Outstanding == 0)
+	{
+		doCommit = 1;
+		metadataLog.Committing = 1;
+	}
+	else
+	{
+		// logBeginOperation may be waiting for space in the log, and
+		// decrementing Outstanding has reduced the amount reserved.
+		wakeup(&metadataLog);
+	}
+	spinlockRelease(&metadataLog.Lock);
+
+	if (doCommit)
+	{
+		// Call logCommit without holding locks, since it is not allowed
+		// to sleep with locks held.
+		logCommit();
+		spinlockAcquire(&metadataLog.Lock);
+		metadataLog.Committing = 0;
+		wakeup(&metadataLog);
+		spinlockRelease(&metadataLog.Lock);
+	}
+}
+
+// Record that a metadata sector has been changed in the current operation.
+// Used instead of diskBufferMarkDirty.  Until the log is set up, the sector
+// is just marked dirty.
+
+void logWrite(DiskBuffer *b)
+{
+	int i;
+
+	if (!metadataLog.Enabled)
+	{
+		diskBufferMarkDirty(b);
+		return;
+	}
+	if (metadataLog.Outstanding < 1)
+	{
+		panic("logWrite outside of transaction");
+	}
+	spinlockAcquire(&metadataLog.Lock);
+	if ((i = logFind(&metadataLog.Header, b->SectorNumber)) < 0)
+	{
+		if (metadataLog.Header.Count >= LOGSIZE)
+		{
+			panic("too big a transaction");
+		}
+		metadataLog.Header.Sector[metadataLog.Header.Count++] = b->SectorNumber;
+		diskBufferPin(b);
+	}
+	spinlockRelease(&metadataLog.Lock);
+}
@@ -3,134 +3,29 @@
 #include "user.h"
 #include "fs.h"
 
-// Take uint16_t -> convert to binary
-// Take binary[0-6], [7-10], [11-15]
-// Takes these integer arrays and converts them to decimal
-// Prints the value out, carriage returns, labels etc. should be...
-// ..done before calling this method
+// Prints a date in the FAT12 format.  Carriage returns, labels etc. should be
+// done before calling this method
 //15 14 13 12 11 10 09 08 07 06 05 04 03 02 01 00
 //y  y  y  y  y  y  y  m  m  m  m  d  d  d  d  d
 void toDate(uint16_t number)
 {	
-	int year[7];
-	int month[4];
-	int day[5];
-	
-	// Convert year to binary
-	for (int i = 0, j = 0; i < 7; i++) {
-		// Year iterator = passed in number AND with 1000000000000000 and shifted right 15 bits
-		year[j] = (number & 0x8000) >> 15;
-		// Shift left one bit to multiply by 2
-		number <<= 1;
-		j++;
-	}
-	
-	// Convert month to binary
-	for (int i = 7, j = 0; i < 11; i++) {
-		month[j] = (number & 0x8000) >> 15;
-		number <<= 1;
-		j++;
-	}
-	
-	// Convert day to binary
-	for (int i = 11, j = 0; i < 16; i++) {
-		day[j] = (number & 0x8000) >> 15;
-		number <<= 1;
-		j++;
-	}
-	
-	// Initialise variables for converting binary to real numbers (starting at 00/00/1980)
-	int printYear = 1980;
-	int printMonth = 0;
-	int printDay = 0;
-
-	// Loop through the year array, calculating the number as we go	
-	for(int i = 6, j = 1; i >= 0; i--)
-	{
-		if(year[i] == 1)
-		{
-			printYear += j;
-		}
-		// Shift left one bit to multiply by 2
-		j <<= 1;
-	}
-	
-	
-	// Loop through the month array, calculating the number as we go
-	for(int i = 3, j = 1; i >= 0; i--)
-	{
-		if(month[i] == 1)
-		{
-			printMonth += j;
-		}
-		j <<= 1;
-	}
-	
-	// Loop through the day array, calculating the number as we go
-	for(int i = 4, j = 1; i >= 0; i--)
-	{
-		if(day[i] == 1)
-		{
-			printDay += j;
-		}
-		j <<= 1;
-	}
-	
-	// Print final String
-	printf("%d/%d/%d", printDay, printMonth, printYear);
+	// The year is counted from 1980
+	printf("%d/%d/%d", number & 0x1F, (number >> 5) & 0x0F, 1980 + (number >> 9));
 }
 
-// Takes a uint16_t number and converts it to a time in the FAT12 format
+// Prints a time in the FAT12 format
 //15 14 13 12 11 10 09 08 07 06 05 04 03 02 01 00
 //h  h  h  h  h  m  m  m  m  m  m  x  x  x  x  x
 void toTime(uint16_t number)
 {	
-	int hour[5];
-	int minute[6];
-	
-	// Convert hour to binary
-	for (int i = 0, j = 0; i < 5; i++) {
-		hour[j] = (number & 0x8000) >> 15;
-		number <<= 1;
-		j++;
-	}
-
-	// Convert minute to binary
-	for (int i = 7, j = 0; i < 11; i++) {
-		minute[j] = (number & 0x8000) >> 15;
-		number <<= 1;
-		j++;
-	}
-	
-	// Initialise variables for converting binary to real numbers
-	int printHour = 0;
-	int printMin = 0;
-	
-	// Loop through the hour array, calculating the number as we go
-	for(int i = 4, j = 1; i >= 0; i--)
-	{
-		if(hour[i] == 1)
-		{
-			printHour += j;
-		}
-		j <<= 1;
-	}
-	
-	for(int i = 5, j = 1; i >= 0; i--)
-	{
-		if(minute[i] == 1)
-		{
-			printMin += j;
-		}
-		j <<= 1;
-	}
+	int printHour = number >> 11;
+	int printMin = (number >> 5) & 0x3F;
 
 	// Print final String (checking for 0-9 issue)
-	if(printMin >= 0 && printMin < 10)
+	if(printMin < 10)
 		printf("%d:0%d", printHour, printMin);	
 	else
 		printf("%d:%d", printHour, printMin);
-	
 }
 
 // Method to take in the attributes
@@ -215,12 +110,15 @@ void printListing(struct _DirectoryEntry dirEntry, int option)
 	printf("\n");
 }
 
+// Number of directory entries fetched by each call to getdents
+#define DIRENTRIES 64
+
 int main(int argc, char *argv[])
 {	
 	int uniqueDescriptor = 0;
 	int option = 0;
-	int readDirectoryResult = 1;
-	struct _DirectoryEntry dirEntry;
+	int entryCount;
+	static struct _DirectoryEntry dirEntries[DIRENTRIES];
 	
 	switch(argc) 
 	{
@@ -279,22 +177,19 @@ int main(int argc, char *argv[])
 			break;
 	}
 
-	// Cater for a directory not existing since 0 is now root
+	// Cater for a directory not existing
 	if(uniqueDescriptor == -1)
 	{
 		exit();
 	}
 	
-	while(readDirectoryResult != -1)
+	// Fetch the directory a block of entries at a time
+	while((entryCount = getdents(uniqueDescriptor, dirEntries, DIRENTRIES)) > 0)
 	{
-		// Fetch the current chunk of file
-		readDirectoryResult = readdir(uniqueDescriptor, &dirEntry);
-		
-		// Check before printing so I don't print a blank line
-		if(readDirectoryResult != -1)
-		{			
+		for(int i = 0; i < entryCount; i++)
+		{
 			// Send to print listing
-			printListing(dirEntry, option);
+			printListing(dirEntries[i], option);
 		}
 	}	
 	
@@ -7,6 +7,7 @@
 // Key addresses for address space layout (see kernelMemoryMap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK KERNBASE + EXTMEM  // Address where kernel is linked
+#define MMAPBASE 0x40000000         // Start of the region for mapped files (see mmap.c)
 
 #define V2P(a) (((uint32_t) (a)) - KERNBASE)
 #define P2V(a) (((void *) (a)) + KERNBASE)
@@ -0,0 +1,9 @@
+// Protection and flags for mmap
+
+#define PROT_READ		0x1
+#define PROT_WRITE		0x2
+
+#define MAP_SHARED		0x1		// The mapping is shared with other processes mapping the file (read-only)
+#define MAP_PRIVATE		0x2		// Writes to the mapping are private to the process
+
+#define MAP_FAILED		((void *)-1)
@@ -0,0 +1,411 @@
+// Memory-mapped files.
+//
+// mmap maps part of a file into the address space of a process, in the region
+// from MMAPBASE to KERNBASE above the heap.  Nothing is read when the mapping 
+// is made.  Each page is filled in when it is first touched, by the page fault
+// handler (mmapPageFault) or, for buffers passed to system calls, by
+// mmapFaultIn.
+//
+// The pages of read-only mappings are the pages of the file in the page cache
+// (see pagecache.c).  The same physical page is mapped into every process that
+// maps that part of a file, and it changes as the file is written.  The pages
+// of writable mappings are private copies which are never written back to the
+// file, so writable shared mappings are not supported.  Only files on file 
+// systems that keep their data in the page cache can be mapped.  If the page
+// cache cannot give a mapping a page, a private page is used instead.
+//
+// Shared memory segments (see shm.c) are mapped in the same way.  Their pages
+// belong to the segment and are shared by every process that maps it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "vfs.h"
+#include "mman.h"
+
+// Read a page of a file into a private page, clearing whatever is past the end
+// of the file
+
+static void mmapReadPage(Vnode * vnode, uint32_t index, char * page)
+{
+	int length = vnode->Mount->Operations->ReadAt(vnode, page, PGSIZE, index * PGSIZE);
+
+	if (length < 0)
+	{
+		length = 0;
+	}
+	memset(page + length, 0, PGSIZE - length);
+}
+
+// Find the mapping of process p that holds address
+
+static Mapping * mmapFind(Process * p, uint32_t address)
+{
+	for (Mapping * m = p->Mappings; m < p->Mappings + NMAPPINGS; m++)
+	{
+		if (m->Address != 0 && address >= m->Address && address < m->Address + m->Length)
+		{
+			return m;
+		}
+	}
+	return 0;
+}
+
+// Map in the page at address (page aligned) of mapping m of process p
+
+static int mmapMapPage(Process * p, Mapping * m, uint32_t address)
+{
+	Vnode * vnode;
+	uint32_t index = (m->Offset + address - m->Address) / PGSIZE;
+	int writable = (m->Protection & PROT_WRITE) != 0;
+	char * page = 0;
+
+	if (m->Segment != 0)
+	{
+		if ((page = shmPage(m->Segment, index)) == 0)
+		{
+			return -1;
+		}
+		return mapUserPage(p->PageTable, address, page, writable);
+	}
+	vnode = m->File->Vnode;
+	if (!writable)
+	{
+		page = pageCacheGet(vnode, index, 1);
+	}
+	if (page == 0)
+	{
+		if ((page = allocatePhysicalMemoryPage()) == 0)
+		{
+			return -1;
+		}
+		mmapReadPage(vnode, index, page);
+	}
+	if (mapUserPage(p->PageTable, address, page, writable) < 0)
+	{
+		if (!pageCacheRelease(page))
+		{
+			freePhysicalMemoryPage(page);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+// Unmap the pages of mapping m of process p that have been mapped in and 
+// free the mapping
+
+static void mmapRemove(Process * p, Mapping * m)
+{
+	char * page;
+
+	for (uint32_t address = m->Address; address < m->Address + m->Length; address += PGSIZE)
+	{
+		if ((page = unmapUserPage(p->PageTable, address)) != 0 && m->Segment == 0 && !pageCacheRelease(page))
+		{
+			freePhysicalMemoryPage(page);
+		}
+	}
+	if (m->Segment != 0)
+	{
+		shmDetach(m->Segment);
+	}
+	else
+	{
+		fileClose(m->File);
+	}
+	m->Address = 0;
+	m->File = 0;
+	m->Segment = 0;
+}
+
+// Find an unused mapping of process p and the lowest gap between its other
+// mappings that will hold length bytes.  Returns the address of the gap, or 0
+// if there is no room.
+
+static uint32_t mmapFindSpace(Process * p, uint32_t length, Mapping ** mapping)
+{
+	Mapping * m = 0;
+	uint32_t address = MMAPBASE;
+	int moved;
+
+	for (int i = 0; i < NMAPPINGS && m == 0; i++)
+	{
+		if (p->Mappings[i].Address == 0)
+		{
+			m = &p->Mappings[i];
+		}
+	}
+	if (m == 0)
+	{
+		return 0;
+	}
+	do
+	{
+		moved = 0;
+		for (int i = 0; i < NMAPPINGS; i++)
+		{
+			Mapping * other = &p->Mappings[i];
+			if (other->Address != 0 && address < other->Address + other->Length && address + length > other->Address)
+			{
+				address = other->Address + other->Length;
+				moved = 1;
+			}
+		}
+	} while (moved);
+	if (address + length > KERNBASE || address + length < address)
+	{
+		return 0;
+	}
+	*mapping = m;
+	return address;
+}
+
+// Handle a page fault at address in the current process.  Returns 0 if the
+// address is in a mapped file and the page has been mapped in, or -1 if the
+// process has used an address it should not have.
+
+int mmapPageFault(uint32_t address, int write)
+{
+	Process * curproc = myThreadGroup();
+	Mapping * m;
+	int result = 0;
+
+	sleeplockAcquire(&curproc->MemoryLock);
+	m = mmapFind(curproc, address);
+	address = PGROUNDDOWN(address);
+	if (m == 0 || (write && (m->Protection & PROT_WRITE) == 0))
+	{
+		result = -1;
+	}
+	else if (mapVirtualAddressToKernelAddress(curproc->PageTable, (char *)address) == 0)
+	{
+		result = mmapMapPage(curproc, m, address);
+	}
+	// Otherwise another thread has mapped the page in since the fault
+	sleeplockRelease(&curproc->MemoryLock);
+	return result;
+}
+
+// Check that size bytes at address lie in one mapped file of process p and map
+// in any of their pages that have not been touched yet, so that the kernel can
+// use them without faulting.  write is 1 if the kernel will write to them.
+// Returns 0 if they can be used or -1 if not.
+
+int mmapFaultIn(Process * p, uint32_t address, int size, int write)
+{
+	Mapping * m;
+	int result = 0;
+
+	sleeplockAcquire(&p->MemoryLock);
+	m = mmapFind(p, address);
+	if (m == 0 || size < 0 || address + size > m->Address + m->Length ||
+		(write && (m->Protection & PROT_WRITE) == 0))
+	{
+		sleeplockRelease(&p->MemoryLock);
+		return -1;
+	}
+	for (uint32_t page = PGROUNDDOWN(address); page < address + size && result == 0; page += PGSIZE)
+	{
+		if (mapVirtualAddressToKernelAddress(p->PageTable, (char *)page) == 0 && mmapMapPage(p, m, page) < 0)
+		{
+			result = -1;
+		}
+	}
+	sleeplockRelease(&p->MemoryLock);
+	return result;
+}
+
+// Map length bytes of file f from offset (a multiple of PGSIZE) into the 
+// current process.  Returns the address of the mapping or -1 on error.
+
+int mmapMap(File * f, int length, int protection, int flags, int offset)
+{
+	Process * curproc = myThreadGroup();
+	Mapping * m;
+	uint32_t address;
+
+	if (length <= 0 || offset < 0 || offset % PGSIZE != 0 || (protection & PROT_READ) == 0 || 
+		(flags != MAP_SHARED && flags != MAP_PRIVATE) || (flags == MAP_SHARED && (protection & PROT_WRITE)))
+	{
+		return -1;
+	}
+	if (f->Type != FD_FILE || !f->Readable || f->Vnode->Mount->Operations->MapPage == 0)
+	{
+		return -1;
+	}
+	length = PGROUNDUP(length);
+	sleeplockAcquire(&curproc->MemoryLock);
+	if ((address = mmapFindSpace(curproc, length, &m)) == 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	m->Address = address;
+	m->Length = length;
+	m->Offset = offset;
+	m->Protection = protection;
+	m->Flags = flags;
+	m->File = fileDup(f);
+	m->Segment = 0;
+	sleeplockRelease(&curproc->MemoryLock);
+	return address;
+}
+
+// Map shared memory segment id into the current process.  Returns the address
+// of the mapping or -1 on error.
+
+int mmapAttach(int id)
+{
+	Process * curproc = myThreadGroup();
+	SharedSegment * s;
+	Mapping * m;
+	uint32_t address;
+	uint32_t length;
+
+	if ((s = shmAttach(id, &length)) == 0)
+	{
+		return -1;
+	}
+	sleeplockAcquire(&curproc->MemoryLock);
+	if ((address = mmapFindSpace(curproc, length, &m)) == 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		shmDetach(s);
+		return -1;
+	}
+	m->Address = address;
+	m->Length = length;
+	m->Offset = 0;
+	m->Protection = PROT_READ | PROT_WRITE;
+	m->Flags = MAP_SHARED;
+	m->File = 0;
+	m->Segment = s;
+	sleeplockRelease(&curproc->MemoryLock);
+	return address;
+}
+
+// Remove the shared memory segment mapped at address from the current process.
+//
+// Mappings cannot be removed while the process has threads, since other
+// processors could still reach the freed pages through their TLBs.
+
+int mmapDetach(uint32_t address)
+{
+	Process * curproc = myThreadGroup();
+	Mapping * m;
+
+	sleeplockAcquire(&curproc->MemoryLock);
+	m = mmapFind(curproc, address);
+	if (m == 0 || m->Address != address || m->Segment == 0 || curproc->ThreadCount > 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	mmapRemove(curproc, m);
+	switchToUserVirtualMemory(myProcess());
+	sleeplockRelease(&curproc->MemoryLock);
+	return 0;
+}
+
+// Remove the mapping at address from the current process.  The whole of the
+// mapping must be removed, and the process must not have threads (see
+// mmapDetach).
+
+int mmapUnmap(uint32_t address, int length)
+{
+	Process * curproc = myThreadGroup();
+	Mapping * m;
+
+	sleeplockAcquire(&curproc->MemoryLock);
+	m = mmapFind(curproc, address);
+	if (m == 0 || m->Address != address || PGROUNDUP(length) != m->Length || curproc->ThreadCount > 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	mmapRemove(curproc, m);
+	switchToUserVirtualMemory(myProcess());
+	sleeplockRelease(&curproc->MemoryLock);
+	return 0;
+}
+
+// Remove all of the mappings of process p.  Used by exit and exec, when p
+// has no threads.
+
+void mmapRelease(Process * p)
+{
+	for (Mapping * m = p->Mappings; m < p->Mappings + NMAPPINGS; m++)
+	{
+		if (m->Address != 0)
+		{
+			mmapRemove(p, m);
+		}
+	}
+}
+
+// Give child copies of the mappings of parent.  Pages from the page cache and
+// shared memory segments are shared and private pages are copied.  Returns -1
+// if there is not enough memory, in which case the mappings made so far are
+// left for mmapRelease.  parent->MemoryLock must be held.
+
+int mmapFork(Process * parent, Process * child)
+{
+	Mapping * m;
+	char * page;
+	char * copy;
+
+	memset(child->Mappings, 0, sizeof(child->Mappings));
+	for (int i = 0; i < NMAPPINGS; i++)
+	{
+		m = &parent->Mappings[i];
+		if (m->Address == 0)
+		{
+			continue;
+		}
+		child->Mappings[i] = *m;
+		if (m->Segment != 0)
+		{
+			shmHold(m->Segment);
+		}
+		else
+		{
+			child->Mappings[i].File = fileDup(m->File);
+		}
+		for (uint32_t address = m->Address; address < m->Address + m->Length; address += PGSIZE)
+		{
+			if ((page = mapVirtualAddressToKernelAddress(parent->PageTable, (char *)address)) == 0)
+			{
+				continue;
+			}
+			if (m->Segment != 0 || pageCacheHold(page))
+			{
+				copy = page;
+			}
+			else if ((copy = allocatePhysicalMemoryPage()) != 0)
+			{
+				memmove(copy, page, PGSIZE);
+			}
+			else
+			{
+				return -1;
+			}
+			if (mapUserPage(child->PageTable, address, copy, (m->Protection & PROT_WRITE) != 0) < 0)
+			{
+				if (m->Segment == 0 && !pageCacheRelease(copy))
+				{
+					freePhysicalMemoryPage(copy);
+				}
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
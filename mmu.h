@@ -39,6 +39,14 @@
 
 #define CR4_PSE         0x00000010      // Page size extension
 
+// CPUID feature flags (CPUID 1, EDX)
+#define CPUID_SEP       0x00000800      // SYSENTER/SYSEXIT supported
+
+// Model specific registers used by SYSENTER
+#define MSR_SYSENTER_CS   0x174         // Kernel code segment
+#define MSR_SYSENTER_ESP  0x175         // Kernel stack pointer
+#define MSR_SYSENTER_EIP  0x176         // Kernel entry point
+
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
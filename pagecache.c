@@ -0,0 +1,657 @@
+// Page cache.
+//
+// The data of files on disk file systems is cached in whole pages, each
+// identified by the mount and vnode id of its file and its index in the file.
+// The buffer cache (bio.c) only holds metadata such as the FAT and directories.
+// Reads and writes of file data, exec, mmap, splice and read-ahead all work on
+// pages, so that a page of a file takes one lookup rather than one for each
+// of its sectors.
+//
+// A file system provides the MapPage operation, which gives the disk sectors
+// holding a page of a file.  The page cache reads and writes the sectors of a
+// page together, through a set of transfer buffers, so that they are all queued
+// at the disk at once.
+//
+// Writes only change the page in the cache, which is marked dirty and written
+// back later by the flusher or when the page is needed for something else.  A
+// dirty page holds a reference to the vnode of its file so that it can be
+// written back after the file has been closed.  Clusters are allocated for
+// data written past the end of the clusters of a file when its pages are
+// written back (by MapPage).
+//
+// Each page has a sleeplock that is held while it is read, written back or
+// changed.  The pages of read-only mapped files are mapped straight into the
+// processes that map them, with a reference taken for each page table entry.
+// Pages that are in use or dirty are never recycled.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "vfs.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define P_VALID		0x1		// The page has been read from disk
+#define P_DIRTY		0x2		// The page has been changed and needs to be written back
+
+// Buffers for reading or writing the sectors of one page
+
+typedef struct _PageTransfer
+{
+	int				Busy;
+	int				Used[SECTORSPERPAGE];		// The buffer is being used for a sector of the page
+	DiskBuffer		Buffer[SECTORSPERPAGE];
+} PageTransfer;
+
+typedef struct _CachedPage
+{
+	int				Flags;
+	Mount *			Mount;				// File the page belongs to (0 if none)
+	uint32_t		Id;
+	uint32_t		Index;				// Index of the page in the file
+	Vnode *			Vnode;				// Held while the page is dirty, so that it can be written back
+	Sleeplock		Lock;
+	int				ReferenceCount;		// Users of the page, including page table entries mapping it
+	uint32_t		LastUsed;
+	char *			Page;				// Kernel address of the page (0 until first used)
+	PageTransfer *	Transfer;			// Buffers for the read or write in progress
+} CachedPage;
+
+struct
+{
+	Spinlock		Lock;
+	CachedPage		Entry[NPAGECACHE];
+	uint32_t		Clock;
+	PageTransfer	Transfer[NPAGEIO];
+} pageCache;
+
+void pageCacheInitialise(void)
+{
+	spinlockInitialise(&pageCache.Lock, "page cache");
+	for (CachedPage * entry = pageCache.Entry; entry < pageCache.Entry + NPAGECACHE; entry++)
+	{
+		sleeplockInitialise(&entry->Lock, "page");
+	}
+	for (PageTransfer * transfer = pageCache.Transfer; transfer < pageCache.Transfer + NPAGEIO; transfer++)
+	{
+		for (int i = 0; i < SECTORSPERPAGE; i++)
+		{
+			sleeplockInitialise(&transfer->Buffer[i].Lock, "page transfer");
+		}
+	}
+}
+
+// Find the page cache entry holding a physical page.  pageCache.Lock must be held.
+
+static CachedPage * pageCacheFind(char * page)
+{
+	for (CachedPage * entry = pageCache.Entry; entry < pageCache.Entry + NPAGECACHE; entry++)
+	{
+		if (entry->Page == page)
+		{
+			return entry;
+		}
+	}
+	return 0;
+}
+
+// Start reading or writing the sectors of a locked page that are on the disk.
+// If there are no free transfer buffers, waits for some if wait is 1 or returns
+// 0 otherwise.  The parts of a page being read that are not on the disk are
+// cleared.  Returns 1 if the transfer was started, which must be followed by
+// pageCacheFinishTransfer.
+
+static int pageCacheStartTransfer(CachedPage * entry, Vnode * vnode, int write, int wait)
+{
+	uint32_t sectors[SECTORSPERPAGE];
+	PageTransfer * transfer = 0;
+	DiskBuffer * b;
+
+	vnode->Mount->Operations->MapPage(vnode, entry->Index, sectors, write);
+	spinlockAcquire(&pageCache.Lock);
+	for (;;)
+	{
+		for (int i = 0; i < NPAGEIO && transfer == 0; i++)
+		{
+			if (!pageCache.Transfer[i].Busy)
+			{
+				transfer = &pageCache.Transfer[i];
+			}
+		}
+		if (transfer != 0 || !wait)
+		{
+			break;
+		}
+		sleep(pageCache.Transfer, &pageCache.Lock);
+	}
+	if (transfer != 0)
+	{
+		transfer->Busy = 1;
+	}
+	spinlockRelease(&pageCache.Lock);
+	if (transfer == 0)
+	{
+		return 0;
+	}
+	entry->Transfer = transfer;
+	for (int i = 0; i < SECTORSPERPAGE; i++)
+	{
+		transfer->Used[i] = sectors[i] != 0;
+		if (sectors[i] == 0)
+		{
+			if (!write)
+			{
+				memset(entry->Page + i * BSIZE, 0, BSIZE);
+			}
+			continue;
+		}
+		b = &transfer->Buffer[i];
+		sleeplockAcquire(&b->Lock);
+		b->Device = vnode->Mount->Device;
+		b->SectorNumber = sectors[i];
+		if (write)
+		{
+			memmove(b->Data, entry->Page + i * BSIZE, BSIZE);
+			b->Flags = B_VALID | B_DIRTY;
+		}
+		else
+		{
+			b->Flags = 0;
+		}
+		blockDeviceQueueRequest(b);
+	}
+	return 1;
+}
+
+// Wait for a transfer started by pageCacheStartTransfer to finish.  Returns -1
+// if the device failed any part of it.
+
+static int pageCacheFinishTransfer(CachedPage * entry)
+{
+	PageTransfer * transfer = entry->Transfer;
+	DiskBuffer * b;
+	int result = 0;
+
+	for (int i = 0; i < SECTORSPERPAGE; i++)
+	{
+		if (!transfer->Used[i])
+		{
+			continue;
+		}
+		b = &transfer->Buffer[i];
+		blockDeviceWaitForRequest(b);
+		if (b->Flags & B_ERROR)
+		{
+			result = -1;
+		}
+		if ((entry->Flags & P_VALID) == 0)
+		{
+			memmove(entry->Page + i * BSIZE, b->Data, BSIZE);
+		}
+		sleeplockRelease(&b->Lock);
+	}
+	entry->Flags |= P_VALID;
+	entry->Transfer = 0;
+	spinlockAcquire(&pageCache.Lock);
+	transfer->Busy = 0;
+	wakeup(pageCache.Transfer);
+	spinlockRelease(&pageCache.Lock);
+	return result;
+}
+
+// Write a locked dirty page back to its file and drop the reference to the
+// vnode that it held.  If the device fails the write, the page is left dirty
+// so that it is tried again later, and -1 is returned.
+
+static int pageCacheWriteBack(CachedPage * entry)
+{
+	Vnode * vnode = entry->Vnode;
+
+	pageCacheStartTransfer(entry, vnode, 1, 1);
+	if (pageCacheFinishTransfer(entry) < 0)
+	{
+		return -1;
+	}
+	spinlockAcquire(&pageCache.Lock);
+	entry->Flags &= ~P_DIRTY;
+	entry->Vnode = 0;
+	spinlockRelease(&pageCache.Lock);
+	vfsReleaseVnode(vnode);
+	return 0;
+}
+
+// Write all dirty pages that are not in use back to their files.
+// Returns the number of pages written.
+
+int pageCacheFlush(void)
+{
+	CachedPage * batch[NPAGECACHE];
+	CachedPage * entry;
+	int count = 0;
+	int written = 0;
+
+	spinlockAcquire(&pageCache.Lock);
+	for (entry = pageCache.Entry; entry < pageCache.Entry + NPAGECACHE; entry++)
+	{
+		if (entry->ReferenceCount == 0 && (entry->Flags & P_DIRTY))
+		{
+			entry->ReferenceCount++;
+			batch[count++] = entry;
+		}
+	}
+	spinlockRelease(&pageCache.Lock);
+	for (int i = 0; i < count; i++)
+	{
+		entry = batch[i];
+		sleeplockAcquire(&entry->Lock);
+		if ((entry->Flags & P_DIRTY) && pageCacheWriteBack(entry) == 0)
+		{
+			written++;
+		}
+		sleeplockRelease(&entry->Lock);
+		spinlockAcquire(&pageCache.Lock);
+		entry->ReferenceCount--;
+		spinlockRelease(&pageCache.Lock);
+	}
+	return written;
+}
+
+// Write the dirty pages of a file back to it, waiting for any that are in use.
+// Used before the new size of a file is recorded, so that the size never
+// covers data that is not on the disk.
+
+void pageCacheFlushVnode(Vnode * vnode)
+{
+	CachedPage * batch[NPAGECACHE];
+	CachedPage * entry;
+	int count = 0;
+
+	spinlockAcquire(&pageCache.Lock);
+	for (entry = pageCache.Entry; entry < pageCache.Entry + NPAGECACHE; entry++)
+	{
+		if (entry->Mount == vnode->Mount && entry->Id == vnode->Id && (entry->Flags & P_DIRTY))
+		{
+			entry->ReferenceCount++;
+			batch[count++] = entry;
+		}
+	}
+	spinlockRelease(&pageCache.Lock);
+	for (int i = 0; i < count; i++)
+	{
+		entry = batch[i];
+		sleeplockAcquire(&entry->Lock);
+		if ((entry->Flags & P_DIRTY) && entry->Mount == vnode->Mount && entry->Id == vnode->Id)
+		{
+			pageCacheWriteBack(entry);
+		}
+		sleeplockRelease(&entry->Lock);
+		spinlockAcquire(&pageCache.Lock);
+		entry->ReferenceCount--;
+		spinlockRelease(&pageCache.Lock);
+	}
+}
+
+// Look through the page cache for page index of a file.  If it is not there,
+// recycle the least recently used page that is not in use or dirty, writing
+// the dirty pages back if there is none.  Returns the entry with a reference
+// taken but not locked, or 0 if every page is in use.
+//
+// mapping is 1 if the page is going to be mapped into a process.  New pages
+// are not given to mappings once half of the cache is in use, so that mapped
+// files cannot take all of the cache from reads and writes.
+
+static CachedPage * pageCacheLookup(Vnode * vnode, uint32_t index, int mapping)
+{
+	CachedPage * entry;
+	CachedPage * victim;
+	int inUse;
+
+	for (;;)
+	{
+		victim = 0;
+		inUse = 0;
+		spinlockAcquire(&pageCache.Lock);
+		for (entry = pageCache.Entry; entry < pageCache.Entry + NPAGECACHE; entry++)
+		{
+			if (entry->Mount == vnode->Mount && entry->Id == vnode->Id && entry->Index == index)
+			{
+				entry->ReferenceCount++;
+				entry->LastUsed = ++pageCache.Clock;
+				spinlockRelease(&pageCache.Lock);
+				return entry;
+			}
+			if (entry->ReferenceCount > 0)
+			{
+				inUse++;
+			}
+			else if ((entry->Flags & P_DIRTY) == 0 &&
+					 (victim == 0 || (victim->Mount != 0 && (entry->Mount == 0 || entry->LastUsed < victim->LastUsed))))
+			{
+				victim = entry;
+			}
+		}
+		if (mapping && inUse >= NPAGECACHE / 2)
+		{
+			spinlockRelease(&pageCache.Lock);
+			return 0;
+		}
+		if (victim != 0)
+		{
+			if (victim->Page == 0 && (victim->Page = allocatePhysicalMemoryPage()) == 0)
+			{
+				spinlockRelease(&pageCache.Lock);
+				return 0;
+			}
+			victim->Mount = vnode->Mount;
+			victim->Id = vnode->Id;
+			victim->Index = index;
+			victim->Flags = 0;
+			victim->ReferenceCount = 1;
+			victim->LastUsed = ++pageCache.Clock;
+			spinlockRelease(&pageCache.Lock);
+			return victim;
+		}
+		spinlockRelease(&pageCache.Lock);
+		if (pageCacheFlush() == 0)
+		{
+			return 0;
+		}
+	}
+}
+
+// Drop a reference to a page cache entry
+
+static void pageCacheDrop(CachedPage * entry)
+{
+	spinlockAcquire(&pageCache.Lock);
+	entry->ReferenceCount--;
+	spinlockRelease(&pageCache.Lock);
+}
+
+// Get page index of a file, reading it if it is not in the cache.  Returns the
+// locked entry with a reference taken, or 0 if every page is in use.
+
+static CachedPage * pageCacheGetLocked(Vnode * vnode, uint32_t index, int mapping)
+{
+	CachedPage * entry = pageCacheLookup(vnode, index, mapping);
+
+	if (entry == 0)
+	{
+		return 0;
+	}
+	sleeplockAcquire(&entry->Lock);
+	if ((entry->Flags & P_VALID) == 0)
+	{
+		pageCacheStartTransfer(entry, vnode, 0, 1);
+		pageCacheFinishTransfer(entry);
+	}
+	return entry;
+}
+
+// Get page index of a file and take a reference to it, so that it stays in
+// the cache until pageCacheRelease is called.  mapping is 1 if the page is
+// going to be mapped into a process.  Returns the kernel address of the page
+// or 0 if every page is in use.
+
+char * pageCacheGet(Vnode * vnode, uint32_t index, int mapping)
+{
+	CachedPage * entry = pageCacheGetLocked(vnode, index, mapping);
+
+	if (entry == 0)
+	{
+		return 0;
+	}
+	sleeplockRelease(&entry->Lock);
+	return entry->Page;
+}
+
+// Take another reference to page if it is in the page cache.  Returns 1 if
+// it is or 0 if it is not.
+
+int pageCacheHold(char * page)
+{
+	CachedPage * entry;
+
+	spinlockAcquire(&pageCache.Lock);
+	if ((entry = pageCacheFind(page)) != 0)
+	{
+		entry->ReferenceCount++;
+	}
+	spinlockRelease(&pageCache.Lock);
+	return entry != 0;
+}
+
+// Drop a reference to page if it is in the page cache.  Returns 1 if it is
+// or 0 if it is not, in which case it is a private page of the caller.
+
+int pageCacheRelease(char * page)
+{
+	CachedPage * entry;
+
+	spinlockAcquire(&pageCache.Lock);
+	if ((entry = pageCacheFind(page)) != 0)
+	{
+		entry->ReferenceCount--;
+	}
+	spinlockRelease(&pageCache.Lock);
+	return entry != 0;
+}
+
+// Read from a file at the given offset through the page cache.  Returns the
+// number of bytes read or -1 if the cache has no pages free.
+
+int pageCacheReadAt(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	CachedPage * entry;
+	uint32_t pageOffset;
+	int readLength;
+	int totalRead = 0;
+
+	if (offset >= vnode->Size)
+	{
+		return 0;
+	}
+	length = min(length, vnode->Size - offset);
+	while (length > 0)
+	{
+		if ((entry = pageCacheGetLocked(vnode, offset / PGSIZE, 0)) == 0)
+		{
+			return totalRead > 0 ? totalRead : -1;
+		}
+		pageOffset = offset % PGSIZE;
+		readLength = min(length, PGSIZE - pageOffset);
+		memmove(buffer, entry->Page + pageOffset, readLength);
+		sleeplockRelease(&entry->Lock);
+		pageCacheDrop(entry);
+		buffer += readLength;
+		offset += readLength;
+		length -= readLength;
+		totalRead += readLength;
+	}
+	return totalRead;
+}
+
+// Write length bytes from buffer, or zeros if buffer is 0, to a file at offset.
+// The bytes must all be in one page.  Returns -1 if the cache has no pages free.
+
+static int pageCacheWritePage(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	uint32_t index = offset / PGSIZE;
+	uint32_t pageOffset = offset % PGSIZE;
+	CachedPage * entry = pageCacheLookup(vnode, index, 0);
+
+	if (entry == 0)
+	{
+		return -1;
+	}
+	sleeplockAcquire(&entry->Lock);
+	if ((entry->Flags & P_VALID) == 0)
+	{
+		if (index * PGSIZE >= vnode->Size || (pageOffset == 0 && offset + length >= vnode->Size))
+		{
+			// Nothing in the page after what we are writing is part of the file,
+			// so there is no need to read it first.
+			memset(entry->Page, 0, PGSIZE);
+			entry->Flags |= P_VALID;
+		}
+		else
+		{
+			pageCacheStartTransfer(entry, vnode, 0, 1);
+			pageCacheFinishTransfer(entry);
+		}
+	}
+	if (buffer != 0)
+	{
+		memmove(entry->Page + pageOffset, buffer, length);
+	}
+	else
+	{
+		memset(entry->Page + pageOffset, 0, length);
+	}
+	spinlockAcquire(&pageCache.Lock);
+	if ((entry->Flags & P_DIRTY) == 0)
+	{
+		entry->Flags |= P_DIRTY;
+		entry->Vnode = vfsDupVnode(vnode);
+	}
+	spinlockRelease(&pageCache.Lock);
+	if (offset + length > vnode->Size)
+	{
+		vnode->Size = offset + length;
+	}
+	sleeplockRelease(&entry->Lock);
+	pageCacheDrop(entry);
+	return length;
+}
+
+// Write to a file at the given offset through the page cache.  Writing past
+// the end of the file leaves a gap that is filled with zeros.  The size of the
+// file is updated.  Returns the number of bytes written or -1 if the cache has
+// no pages free.
+
+int pageCacheWriteAt(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	int writeLength;
+	int totalWritten = 0;
+
+	while (vnode->Size < offset)
+	{
+		if (pageCacheWritePage(vnode, 0, min(offset - vnode->Size, PGSIZE - vnode->Size % PGSIZE), vnode->Size) < 0)
+		{
+			return -1;
+		}
+	}
+	while (length > 0)
+	{
+		writeLength = min(length, PGSIZE - offset % PGSIZE);
+		if (pageCacheWritePage(vnode, buffer, writeLength, offset) < 0)
+		{
+			return totalWritten > 0 ? totalWritten : -1;
+		}
+		buffer += writeLength;
+		offset += writeLength;
+		length -= writeLength;
+		totalWritten += writeLength;
+	}
+	return totalWritten;
+}
+
+// Start reading the pages holding part of a file into the cache without waiting
+// for the reads to finish, so that they are all queued at the disk together.
+// The pages for the reads that were started are returned in pages and must each
+// be passed to pageCacheWaitAndRelease.  Returns the number of reads started.
+// One set of transfer buffers is always left for writing pages back, since
+// finding pages for the reads may need dirty pages to be written back first.
+
+int pageCacheStartRead(Vnode * vnode, uint32_t offset, uint32_t length, char ** pages, int maxPages)
+{
+	CachedPage * entry;
+	uint32_t end;
+	int started = 0;
+
+	if (offset >= vnode->Size)
+	{
+		return 0;
+	}
+	end = offset + min(length, vnode->Size - offset);
+	for (uint32_t index = offset / PGSIZE; index * PGSIZE < end && started < maxPages && started < NPAGEIO - 1; index++)
+	{
+		if ((entry = pageCacheLookup(vnode, index, 0)) == 0)
+		{
+			break;
+		}
+		// A page that is already there, or is being read by someone else, is left alone
+		if ((entry->Flags & P_VALID) == 0 && sleeplockTryAcquire(&entry->Lock))
+		{
+			if ((entry->Flags & P_VALID) == 0 && pageCacheStartTransfer(entry, vnode, 0, 0))
+			{
+				pages[started++] = entry->Page;
+				continue;
+			}
+			sleeplockRelease(&entry->Lock);
+		}
+		pageCacheDrop(entry);
+	}
+	return started;
+}
+
+// Wait for a read started by pageCacheStartRead and release the page
+
+void pageCacheWaitAndRelease(char * page)
+{
+	CachedPage * entry;
+
+	spinlockAcquire(&pageCache.Lock);
+	entry = pageCacheFind(page);
+	spinlockRelease(&pageCache.Lock);
+	pageCacheFinishTransfer(entry);
+	sleeplockRelease(&entry->Lock);
+	pageCacheDrop(entry);
+}
+
+// Drop the pages of a file from the page cache after it has been truncated.
+// Dirty pages are not written back.  Pages that are still in use, for example
+// by mapped files, are cleared and no longer belong to the file.
+
+void pageCacheInvalidate(Vnode * vnode)
+{
+	CachedPage * batch[NPAGECACHE];
+	CachedPage * entry;
+	int count = 0;
+
+	spinlockAcquire(&pageCache.Lock);
+	for (entry = pageCache.Entry; entry < pageCache.Entry + NPAGECACHE; entry++)
+	{
+		if (entry->Mount == vnode->Mount && entry->Id == vnode->Id)
+		{
+			entry->ReferenceCount++;
+			batch[count++] = entry;
+		}
+	}
+	spinlockRelease(&pageCache.Lock);
+	for (int i = 0; i < count; i++)
+	{
+		entry = batch[i];
+		sleeplockAcquire(&entry->Lock);
+		spinlockAcquire(&pageCache.Lock);
+		if (entry->ReferenceCount > 1)
+		{
+			memset(entry->Page, 0, PGSIZE);
+		}
+		if (entry->Flags & P_DIRTY)
+		{
+			vfsReleaseVnode(entry->Vnode);
+			entry->Vnode = 0;
+		}
+		entry->Flags = 0;
+		entry->Mount = 0;
+		entry->ReferenceCount--;
+		spinlockRelease(&pageCache.Lock);
+		sleeplockRelease(&entry->Lock);
+	}
+}
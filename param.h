@@ -1,13 +1,24 @@
-#define NPROC        64  // maximum number of processes
+#define PIDHASHSIZE  64  // chains in the hash table of process IDs
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
+#define NOFILE       16  // open files per process before its descriptor table grows
+#define MAXNOFILE  1024  // most open files per process (a page of File pointers)
 #define NFILE       100  // open files per system
+#define NVNODE      100  // maximum number of open files and directories (vnodes)
+#define NMAPPINGS     8  // mapped files per process
+#define NSHAREDSEGMENTS 16 // shared memory segments per system
+#define SHMMAXPAGES  64  // most pages in a shared memory segment
+#define NPAGECACHE  128  // pages of file data cached
+#define NPAGEIO       8  // pages of file data being read or written at once
+#define NMOUNT        4  // maximum number of mounted file systems
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define ROOTDEV       0  // device number of file system root disk
+#define NBLOCKDEV     3  // number of block devices (IDE disks 0 and 1, RAM disk)
+#define RAMDISKDEV    2  // device number of the RAM disk
+#define RAMDISKSIZE 20480 // sectors in the RAM disk (memory is only used as it is written)
 #define MAXARG       32  // max exec arguments
+#define MAXDIRENTRIES 64 // max directory entries read by one getdents
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define MAXFATSIZE	 10 // Maximum number of sectors occupied by a FAT
+#define NBUF         (MAXOPBLOCKS*6)  // size of disk block cache (room for a full log pinned in it)
 #define MAXCWDSIZE	 200 // Maximum length of current working directory in process structure
@@ -2,10 +2,10 @@
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
-#include "proc.h"
-#include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
 #include "file.h"
 
 #define PIPESIZE 512
@@ -116,6 +116,51 @@ int pipewrite(Pipe *p, char *addr, int n)
 	return n;
 }
 
+// Wait until there is room in pipe p for more data.  Returns -1 if the
+// reading end has been closed or the process has been killed.
+
+int pipeWaitForSpace(Pipe *p)
+{
+	int result;
+
+	spinlockAcquire(&p->Lock);
+	while (p->WriteCount == p->ReadCount + PIPESIZE && p->ReadOpen)
+	{
+		if (myProcess()->IsKilled)
+		{
+			spinlockRelease(&p->Lock);
+			return -1;
+		}
+		wakeup(&p->ReadCount);
+		sleep(&p->WriteCount, &p->Lock);
+	}
+	result = p->ReadOpen ? 0 : -1;
+	spinlockRelease(&p->Lock);
+	return result;
+}
+
+// Write as much of n bytes to pipe p as there is room for, without waiting.
+// Returns the number of bytes written or -1 if the reading end has been closed.
+
+int pipeWriteNoWait(Pipe *p, char *addr, int n)
+{
+	int i;
+
+	spinlockAcquire(&p->Lock);
+	if (p->ReadOpen == 0)
+	{
+		spinlockRelease(&p->Lock);
+		return -1;
+	}
+	for (i = 0; i < n && p->WriteCount != p->ReadCount + PIPESIZE; i++)
+	{
+		p->Data[p->WriteCount++ % PIPESIZE] = addr[i];
+	}
+	wakeup(&p->ReadCount);
+	spinlockRelease(&p->Lock);
+	return i;
+}
+
 int piperead(Pipe *p, char *addr, int n)
 {
 	int i;
@@ -142,3 +187,23 @@ int piperead(Pipe *p, char *addr, int n)
 	spinlockRelease(&p->Lock);
 	return i;
 }
+
+// Read up to n bytes that are already in pipe p, without waiting for more.
+// Returns the number of bytes read, which is 0 if the pipe is empty.
+
+int pipeReadNoWait(Pipe *p, char *addr, int n)
+{
+	int i;
+
+	spinlockAcquire(&p->Lock);
+	for (i = 0; i < n && p->ReadCount != p->WriteCount; i++)
+	{
+		addr[i] = p->Data[p->ReadCount++ % PIPESIZE];
+	}
+	if (i > 0)
+	{
+		wakeup(&p->WriteCount);
+	}
+	spinlockRelease(&p->Lock);
+	return i;
+}
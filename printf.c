@@ -2,9 +2,113 @@
 #include "stat.h"
 #include "user.h"
 
+// Output to the first few file descriptors is buffered so that printf does not
+// make a system call per character.  Buffers are flushed when full, by fflush,
+// and by exit, fork, exec, close and spawn.  Output to a device (the console)
+// is also flushed at the end of each line.
+
+#define NSTDIOFD		8
+#define STDIOBUFSIZE	512
+
+#define BUF_UNKNOWN		0	// Buffering mode not yet determined
+#define BUF_LINE		1	// Flush at end of each line
+#define BUF_FULL		2	// Flush when full
+
+static struct
+{
+	char	Data[STDIOBUFSIZE];
+	int		Count;
+	int		Mode;
+} outputBuffer[NSTDIOFD];
+
+// Threads share the buffers, so outputLock is held while they are used
+static Mutex outputLock;
+
+// Write out the buffered output for fd.  outputLock must be held.
+
+static void flushBuffer(int fd)
+{
+	if (fd < 0 || fd >= NSTDIOFD || outputBuffer[fd].Count == 0)
+	{
+		return;
+	}
+	write(fd, outputBuffer[fd].Data, outputBuffer[fd].Count);
+	outputBuffer[fd].Count = 0;
+}
+
+void fflush(int fd)
+{
+	mutexLock(&outputLock);
+	flushBuffer(fd);
+	mutexUnlock(&outputLock);
+}
+
+// Flush fd before closing it and forget its buffering mode, since the next file
+// given the same descriptor may be a different kind of file.
+
+int close(int fd)
+{
+	mutexLock(&outputLock);
+	flushBuffer(fd);
+	if (fd >= 0 && fd < NSTDIOFD)
+	{
+		outputBuffer[fd].Count = 0;
+		outputBuffer[fd].Mode = BUF_UNKNOWN;
+	}
+	mutexUnlock(&outputLock);
+	return _close(fd);
+}
+
+// fork holds outputLock while the process is copied, so that the child does
+// not get a copy of it held by another thread
+
+int fork(void)
+{
+	int fd;
+	int pid;
+
+	mutexLock(&outputLock);
+	for (fd = 0; fd < NSTDIOFD; fd++)
+	{
+		flushBuffer(fd);
+	}
+	pid = _fork();
+	mutexUnlock(&outputLock);
+	return pid;
+}
+
+void flushall(void)
+{
+	int fd;
+
+	mutexLock(&outputLock);
+	for (fd = 0; fd < NSTDIOFD; fd++)
+	{
+		flushBuffer(fd);
+	}
+	mutexUnlock(&outputLock);
+}
+
+// Add a character to the output for fd.  outputLock must be held.
+
 static void putc(int fd, char c)
 {
-	write(fd, &c, 1);
+	struct _Stat st;
+
+	if (fd < 0 || fd >= NSTDIOFD)
+	{
+		write(fd, &c, 1);
+		return;
+	}
+	if (outputBuffer[fd].Mode == BUF_UNKNOWN)
+	{
+		outputBuffer[fd].Mode = (fstat(fd, &st) == 0 && st.type == T_DEV) ? BUF_LINE : BUF_FULL;
+	}
+	outputBuffer[fd].Data[outputBuffer[fd].Count++] = c;
+	if (outputBuffer[fd].Count >= STDIOBUFSIZE || (c == '\n' && outputBuffer[fd].Mode == BUF_LINE))
+	{
+		flushBuffer(fd);
+	}
 }
 
 static void printInt(int fd, int xx, int base, int sgn)
@@ -48,6 +152,7 @@ void printf(char *fmt, ...)
 
 	state = 0;
 	ap = (uint32_t*)(void*)&fmt + 1;
+	mutexLock(&outputLock);
 	for (i = 0; fmt[i]; i++) 
 	{
 		c = fmt[i] & 0xff;
@@ -106,4 +211,5 @@ void printf(char *fmt, ...)
 			state = 0;
 		}
 	}
+	mutexUnlock(&outputLock);
 }
@@ -4,21 +4,31 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
 #include "file.h"
-#include "spinlock.h"
+#include "spawn.h"
+
+// Process structures are allocated a page at a time as they are needed and
+// are never freed.  Every structure is on the All list, which is what the 
+// scheduler looks through.  Unused structures are also on the Free list, and
+// the ones in use are found by process ID in Hash.
 
 struct 
 {
 	Spinlock		Lock;
-	Process			Process[NPROC];
+	Process *		All;
+	Process *		Free;
+	Process *		Hash[PIDHASHSIZE];
 } processTable;
 
 static Process *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
+extern void kernelThreadStart(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
@@ -73,8 +83,80 @@ Process* myProcess(void)
 	return p;
 }
 
-// Look in the process table for an UNUSED Process.
-// If found, change state to EMBRYO and initialize
+// Find the process with the given pid.  processTable.Lock must be held.
+
+static Process* findProcess(int pid)
+{
+	Process *p;
+
+	for (p = processTable.Hash[pid % PIDHASHSIZE]; p != 0; p = p->HashNext)
+	{
+		if (p->ProcessId == pid)
+		{
+			return p;
+		}
+	}
+	return 0;
+}
+
+// Make child one of the children of parent.  processTable.Lock must be held.
+
+static void addChild(Process *parent, Process *child)
+{
+	child->Parent = parent;
+	child->PreviousSibling = 0;
+	child->NextSibling = parent->FirstChild;
+	if (parent->FirstChild != 0)
+	{
+		parent->FirstChild->PreviousSibling = child;
+	}
+	parent->FirstChild = child;
+}
+
+// Take a process out of the PID hash table and the children of its parent and
+// put it on the free list.  Its memory must have been freed already.
+// processTable.Lock must be held.
+
+static void freeProcess(Process *p)
+{
+	Process **link;
+
+	for (link = &processTable.Hash[p->ProcessId % PIDHASHSIZE]; *link != 0; link = &(*link)->HashNext)
+	{
+		if (*link == p)
+		{
+			*link = p->HashNext;
+			break;
+		}
+	}
+	if (p->Parent != 0)
+	{
+		if (p->PreviousSibling != 0)
+		{
+			p->PreviousSibling->NextSibling = p->NextSibling;
+		}
+		else
+		{
+			p->Parent->FirstChild = p->NextSibling;
+		}
+		if (p->NextSibling != 0)
+		{
+			p->NextSibling->PreviousSibling = p->PreviousSibling;
+		}
+	}
+	p->ProcessId = 0;
+	p->Parent = 0;
+	p->Name[0] = 0;
+	p->IsKilled = 0;
+	p->Ring = 0;
+	p->RingDraining = 0;
+	p->State = UNUSED;
+	p->HashNext = processTable.Free;
+	processTable.Free = p;
+}
+
+// Look for an UNUSED Process, allocating another page of them if there
+// are none.  If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
 
@@ -82,38 +164,49 @@ static Process* allocateProcess(void)
 {
 	Process *p;
 	char *sp;
-	int found = 0;
+	char *page;
 
 	spinlockAcquire(&processTable.Lock);
-	p = processTable.Process;
-	while (p < &processTable.Process[NPROC] && !found)
+	if (processTable.Free == 0 && (page = allocatePhysicalMemoryPage()) != 0)
 	{
-		if (p->State == UNUSED)
-		{
-			found = 1;
-		}
-		else
+		memset(page, 0, PGSIZE);
+		for (p = (Process *)page; p + 1 <= (Process *)(page + PGSIZE); p++)
 		{
-			p++;
+			p->AllNext = processTable.All;
+			processTable.All = p;
+			p->HashNext = processTable.Free;
+			processTable.Free = p;
 		}
 	}
-	if (!found)
+	if ((p = processTable.Free) == 0)
 	{
 		spinlockRelease(&processTable.Lock);
 		return 0;
 	}
+	processTable.Free = p->HashNext;
+	spinlockInitialise(&p->FileLock, "files");
+	sleeplockInitialise(&p->MemoryLock, "memory");
 	p->State = EMBRYO;
 	p->ProcessId = nextpid++;
+	p->FirstChild = 0;
+	p->ThreadGroup = p;
+	p->ThreadCount = 0;
+	p->HashNext = processTable.Hash[p->ProcessId % PIDHASHSIZE];
+	processTable.Hash[p->ProcessId % PIDHASHSIZE] = p;
 
 	spinlockRelease(&processTable.Lock);
 
 	// Allocate kernel stack.
 	if ((p->KernelStack = allocatePhysicalMemoryPage()) == 0) 
 	{
-		p->State = UNUSED;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(p);
+		spinlockRelease(&processTable.Lock);
 		return 0;
 	}
 	sp = p->KernelStack + KSTACKSIZE;
+	p->OpenFile = p->InitialOpenFile;
+	p->OpenFileCount = NOFILE;
 
 	// Leave room for trap frame.
 	sp -= sizeof *p->Trapframe;
@@ -128,10 +221,20 @@ static Process* allocateProcess(void)
 	p->Context = (Context*)sp;
 	memset(p->Context, 0, sizeof *p->Context);
 	p->Context->eip = (uint32_t)forkret;
+ 	return p;
+}
 
-	// Allocate the stdin, stdout and stderr devices
+// Open the console as the stdin, stdout and stderr of a process that does
+// not inherit them
 
+static void openConsole(Process *p)
+{
 	File * consoleDevice = allocateFileStructure();
+
+	if (consoleDevice == 0)
+	{
+		panic("openConsole");
+	}
 	consoleDevice->Type = FD_DEVICE;
 	consoleDevice->DeviceID = CONSOLE;
 	consoleDevice->Readable = 1;
@@ -139,7 +242,14 @@ static Process* allocateProcess(void)
 	p->OpenFile[0] = consoleDevice;
 	p->OpenFile[1] = fileDup(consoleDevice);
 	p->OpenFile[2] = fileDup(consoleDevice);
- 	return p;
+}
+
+// Get the process whose memory, open files and current directory the current
+// process uses.  This is the process itself unless it is a thread.
+
+Process* myThreadGroup(void)
+{
+	return myProcess()->ThreadGroup;
 }
 
 // Set up first user process.
@@ -169,6 +279,7 @@ void initialiseFirstUserProcess(void)
 
 	safestrcpy(p->Name, "initcode", sizeof(p->Name));
 	safestrcpy(p->Cwd, "/", MAXCWDSIZE);
+	openConsole(p);
 
 	// this assignment to p->state lets other cores
 	// run this process. the spinlockAcquire forces the above
@@ -181,82 +292,467 @@ void initialiseFirstUserProcess(void)
 	spinlockRelease(&processTable.Lock);
 }
 
+// Create a kernel thread that runs entry in the kernel.  entry must not return.
+// Returns the process ID of the thread or -1 on error.
+
+int createKernelThread(void (*entry)(void), char *name)
+{
+	Process *p;
+	char *sp;
+
+	if ((p = allocateProcess()) == 0)
+	{
+		return -1;
+	}
+	if ((p->PageTable = setupKernelVirtualMemory()) == 0)
+	{
+		freePhysicalMemoryPage(p->KernelStack);
+		p->KernelStack = 0;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(p);
+		spinlockRelease(&processTable.Lock);
+		return -1;
+	}
+
+	// Return from kernelThreadStart into entry rather than into trapret
+	sp = (char *)p->Context + sizeof *p->Context;
+	*(uint32_t*)sp = (uint32_t)entry;
+	p->Context->eip = (uint32_t)kernelThreadStart;
+
+	safestrcpy(p->Name, name, sizeof(p->Name));
+	safestrcpy(p->Cwd, "/", MAXCWDSIZE);
+	openConsole(p);
+	spinlockAcquire(&processTable.Lock);
+	p->State = RUNNABLE;
+	spinlockRelease(&processTable.Lock);
+	return p->ProcessId;
+}
+
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size, or -1 on failure.
+//
+// Memory cannot be given back while the process has threads, since other
+// processors could still reach the freed pages through their TLBs.
 
 int growProcess(int n)
 {
 	uint32_t memorySize;
-	Process *curproc = myProcess();
+	uint32_t oldSize;
+	Process *curproc = myThreadGroup();
 
-	memorySize = curproc->MemorySize;
+	sleeplockAcquire(&curproc->MemoryLock);
+	oldSize = memorySize = curproc->MemorySize;
 	if (n > 0) 
 	{
-		if ((memorySize = allocateMemoryAndPageTables(curproc->PageTable, memorySize, memorySize + n)) == 0)
+		// The heap must not grow into the region used for mapped files
+		if (memorySize + n > MMAPBASE ||
+			(memorySize = allocateMemoryAndPageTables(curproc->PageTable, memorySize, memorySize + n)) == 0)
 		{
+			sleeplockRelease(&curproc->MemoryLock);
 			return -1;
 		}
 	}
 	else if (n < 0) 
 	{
-		if ((memorySize = releaseUserPages(curproc->PageTable, memorySize, memorySize + n)) == 0)
+		if (curproc->ThreadCount > 0 ||
+			(memorySize = releaseUserPages(curproc->PageTable, memorySize, memorySize + n)) == 0)
 		{
+			sleeplockRelease(&curproc->MemoryLock);
 			return -1;
 		}
+		if (curproc->Ring && memorySize <= curproc->RingAddress)
+		{
+			// The I/O ring page has been released
+			curproc->Ring = 0;
+		}
 	}
 	curproc->MemorySize = memorySize;
-	switchToUserVirtualMemory(curproc);
+	switchToUserVirtualMemory(myProcess());
+	sleeplockRelease(&curproc->MemoryLock);
+	return oldSize;
+}
+
+// Make room for at least count open files in the descriptor table of p.  The
+// table starts in the process structure and moves to a page of its own the
+// first time it has to grow.  Returns -1 if the table cannot be that big.
+// p->FileLock must be held if other threads can use the table.
+
+int growOpenFileTable(Process *p, int count)
+{
+	File **table;
+
+	if (count <= p->OpenFileCount)
+	{
+		return 0;
+	}
+	if (count > MAXNOFILE || (table = (File **)allocatePhysicalMemoryPage()) == 0)
+	{
+		return -1;
+	}
+	memset(table, 0, MAXNOFILE * sizeof(File *));
+	memmove(table, p->OpenFile, p->OpenFileCount * sizeof(File *));
+	p->OpenFile = table;
+	p->OpenFileCount = MAXNOFILE;
 	return 0;
 }
 
+// Give back the page used by a descriptor table that has grown.  All of its
+// files must have been closed.
+
+void freeOpenFileTable(Process *p)
+{
+	if (p->OpenFile != p->InitialOpenFile)
+	{
+		freePhysicalMemoryPage((char *)p->OpenFile);
+	}
+	p->OpenFile = p->InitialOpenFile;
+	p->OpenFileCount = NOFILE;
+}
+
+// Give np, which is not running yet, copies of the open files of p.
+// Returns -1 if there is not enough memory.
+
+static int copyOpenFiles(Process *p, Process *np)
+{
+	spinlockAcquire(&p->FileLock);
+	if (growOpenFileTable(np, p->OpenFileCount) < 0)
+	{
+		spinlockRelease(&p->FileLock);
+		return -1;
+	}
+	for (int i = 0; i < p->OpenFileCount; i++)
+	{
+		if (p->OpenFile[i])
+		{
+			np->OpenFile[i] = fileDup(p->OpenFile[i]);
+		}
+	}
+	spinlockRelease(&p->FileLock);
+	return 0;
+}
+
+// Copy the current directory of p into cwd, which holds MAXCWDSIZE bytes.  The
+// threads of a process share it and one of them may be changing it with chdir,
+// so it is copied under FileLock.
+
+void copyCwd(Process *p, char *cwd)
+{
+	spinlockAcquire(&p->FileLock);
+	safestrcpy(cwd, p->Cwd, MAXCWDSIZE);
+	spinlockRelease(&p->FileLock);
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned Process to RUNNABLE.
 
 int fork(void)
 {
-	int i, pid;
+	int pid;
 	Process *np;
-	Process *curproc = myProcess();
+	Process *curproc = myThreadGroup();
 
-	// Allocate process.
+	// Allocate process.  A thread forks the whole of its process.
 	if ((np = allocateProcess()) == 0) 
 	{
 		return -1;
 	}
 
 	// Copy process state from Process.
+	sleeplockAcquire(&curproc->MemoryLock);
 	if ((np->PageTable = copyProcessPageTable(curproc->PageTable, curproc->MemorySize)) == 0) 
 	{
+		sleeplockRelease(&curproc->MemoryLock);
 		freePhysicalMemoryPage(np->KernelStack);
 		np->KernelStack = 0;
-		np->State = UNUSED;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(np);
+		spinlockRelease(&processTable.Lock);
 		return -1;
 	}
 	np->MemorySize = curproc->MemorySize;
-	np->Parent = curproc;
-	*np->Trapframe = *curproc->Trapframe;
+	if (mmapFork(curproc, np) < 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		mmapRelease(np);
+		freeMemoryAndPageTable(np->PageTable);
+		freePhysicalMemoryPage(np->KernelStack);
+		np->KernelStack = 0;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(np);
+		spinlockRelease(&processTable.Lock);
+		return -1;
+	}
+	if (curproc->Ring)
+	{
+		// The child gets its own copy of the ring page
+		np->Ring = (Ring *)mapVirtualAddressToKernelAddress(np->PageTable, (char *)curproc->RingAddress);
+		np->RingAddress = curproc->RingAddress;
+	}
+	sleeplockRelease(&curproc->MemoryLock);
+	if (copyOpenFiles(curproc, np) < 0)
+	{
+		mmapRelease(np);
+		freeMemoryAndPageTable(np->PageTable);
+		freePhysicalMemoryPage(np->KernelStack);
+		np->KernelStack = 0;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(np);
+		spinlockRelease(&processTable.Lock);
+		return -1;
+	}
+	*np->Trapframe = *myProcess()->Trapframe;
 
 	// Clear %eax so that fork returns 0 in the child.
 	np->Trapframe->eax = 0;
 
-	for (i = 0; i < NOFILE; i++)
+	copyCwd(curproc, np->Cwd);
+	safestrcpy(np->Name, curproc->Name, sizeof(curproc->Name));
+	pid = np->ProcessId;
+	spinlockAcquire(&processTable.Lock);
+	addChild(curproc, np);
+	np->State = RUNNABLE;
+	spinlockRelease(&processTable.Lock);
+
+	return pid;
+}
+
+// Apply the changes in actions to the open files p has inherited.
+// Returns -1 if any of them is not valid.
+
+static int spawnFileActions(Process *p, SpawnAction *actions, int count)
+{
+	SpawnAction *a;
+
+	for (a = actions; a < actions + count; a++)
+	{
+		if (a->Fd < 0 || a->Fd >= p->OpenFileCount || p->OpenFile[a->Fd] == 0)
+		{
+			return -1;
+		}
+		if (a->Action == SPAWN_CLOSE)
+		{
+			fileClose(p->OpenFile[a->Fd]);
+			p->OpenFile[a->Fd] = 0;
+		}
+		else if (a->Action == SPAWN_DUP)
+		{
+			if (a->NewFd < 0 || growOpenFileTable(p, a->NewFd + 1) < 0)
+			{
+				return -1;
+			}
+			if (a->NewFd != a->Fd)
+			{
+				if (p->OpenFile[a->NewFd] != 0)
+				{
+					fileClose(p->OpenFile[a->NewFd]);
+				}
+				p->OpenFile[a->NewFd] = fileDup(p->OpenFile[a->Fd]);
+			}
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Create a child process running the program in path with arguments argv.
+// Unlike fork followed by exec, the memory of the current process is not
+// copied; the child is built straight from the program.  It inherits the
+// open files of the current process, changed by the count actions in
+// actions, and its current directory.  Returns the process ID of the child
+// or -1 on error.
+
+int spawn(char *path, char **argv, SpawnAction *actions, int count)
+{
+	int i, pid;
+	char *name;
+	char cwd[MAXCWDSIZE];
+	Process *np;
+	Process *curproc = myThreadGroup();
+
+	if ((np = allocateProcess()) == 0) 
+	{
+		return -1;
+	}
+	if (copyOpenFiles(curproc, np) < 0)
 	{
-		if (curproc->OpenFile[i])
+		freePhysicalMemoryPage(np->KernelStack);
+		np->KernelStack = 0;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(np);
+		spinlockRelease(&processTable.Lock);
+		return -1;
+	}
+	*np->Trapframe = *myProcess()->Trapframe;
+	np->Trapframe->eax = 0;
+	copyCwd(curproc, cwd);
+	if (spawnFileActions(np, actions, count) < 0 ||
+		(np->PageTable = execLoad(cwd, path, argv, &np->MemorySize, &np->Trapframe->esp, &np->Trapframe->eip, &name)) == 0)
+	{
+		for (i = 0; i < np->OpenFileCount; i++)
 		{
-			np->OpenFile[i] = fileDup(curproc->OpenFile[i]);
+			if (np->OpenFile[i])
+			{
+				fileClose(np->OpenFile[i]);
+				np->OpenFile[i] = 0;
+			}
 		}
+		freeOpenFileTable(np);
+		freePhysicalMemoryPage(np->KernelStack);
+		np->KernelStack = 0;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(np);
+		spinlockRelease(&processTable.Lock);
+		return -1;
 	}
-	safestrcpy(np->Cwd, curproc->Cwd, MAXCWDSIZE);
-	safestrcpy(np->Name, curproc->Name, sizeof(curproc->Name));
+	safestrcpy(np->Cwd, cwd, MAXCWDSIZE);
+	safestrcpy(np->Name, name, sizeof(np->Name));
 	pid = np->ProcessId;
 	spinlockAcquire(&processTable.Lock);
+	addChild(curproc, np);
 	np->State = RUNNABLE;
 	spinlockRelease(&processTable.Lock);
+	return pid;
+}
+
+// Create a thread that shares the memory, open files and current directory
+// of the current process.  The thread runs entry(argument) on the stack of a
+// page at stack.  entry must call exit rather than return.  The thread is
+// given a process ID, which join returns when it has exited.  Returns the ID
+// or -1 on error.
 
+int clone(uint32_t entry, uint32_t argument, uint32_t stack)
+{
+	Process *np;
+	Process *curproc = myProcess();
+	Process *group = curproc->ThreadGroup;
+	uint32_t frame[2];
+	int pid;
+
+	if ((np = allocateProcess()) == 0)
+	{
+		return -1;
+	}
+	// Start the thread as if entry had been called with argument, with a 
+	// return address that faults
+	frame[0] = 0xFFFFFFFF;
+	frame[1] = argument;
+	if (copyToUserVirtualMemory(group->PageTable, stack + PGSIZE - sizeof(frame), frame, sizeof(frame)) < 0)
+	{
+		freePhysicalMemoryPage(np->KernelStack);
+		np->KernelStack = 0;
+		spinlockAcquire(&processTable.Lock);
+		freeProcess(np);
+		spinlockRelease(&processTable.Lock);
+		return -1;
+	}
+	np->PageTable = group->PageTable;
+	np->ThreadGroup = group;
+	np->ThreadStack = stack;
+	*np->Trapframe = *curproc->Trapframe;
+	np->Trapframe->eip = entry;
+	np->Trapframe->esp = stack + PGSIZE - sizeof(frame);
+	safestrcpy(np->Name, group->Name, sizeof(group->Name));
+	pid = np->ProcessId;
+
+	// Threads are children of their process, so that any of them can join them
+	spinlockAcquire(&processTable.Lock);
+	addChild(group, np);
+	group->ThreadCount++;
+	np->State = RUNNABLE;
+	spinlockRelease(&processTable.Lock);
 	return pid;
 }
 
+// Free a thread that has exited.  Its page table belongs to its process and
+// is left alone.  processTable.Lock must be held.
+
+static void freeThread(Process *p)
+{
+	freePhysicalMemoryPage(p->KernelStack);
+	p->KernelStack = 0;
+	p->ThreadGroup->ThreadCount--;
+	freeProcess(p);
+}
+
+// Wait for a thread of the current process to exit.  The address of the stack
+// the thread was given by clone is returned in *stack.  Returns the process ID
+// of the thread, or -1 if there are no other threads.
+
+int join(uint32_t *stack)
+{
+	Process *curproc = myProcess();
+	Process *group = curproc->ThreadGroup;
+	Process *p;
+	int pid;
+
+	spinlockAcquire(&processTable.Lock);
+	for (;;) 
+	{
+		for (p = group->FirstChild; p != 0; p = p->NextSibling) 
+		{
+			if (p->ThreadGroup == group && p->State == ZOMBIE) 
+			{
+				pid = p->ProcessId;
+				*stack = p->ThreadStack;
+				freeThread(p);
+				spinlockRelease(&processTable.Lock);
+				return pid;
+			}
+		}
+		// A thread cannot wait for itself
+		if (group->ThreadCount - (curproc != group) == 0 || curproc->IsKilled) 
+		{
+			spinlockRelease(&processTable.Lock);
+			return -1;
+		}
+		// Exiting threads wake up their process
+		sleep(group, &processTable.Lock);
+	}
+}
+
+// Kill the threads of process p and wait for them all to exit.  Called by
+// exit before the memory and open files of p are freed.
+
+static void stopThreads(Process *p)
+{
+	Process *thread;
+	Process *next;
+
+	spinlockAcquire(&processTable.Lock);
+	while (p->ThreadCount > 0)
+	{
+		for (thread = p->FirstChild; thread != 0; thread = next) 
+		{
+			next = thread->NextSibling;
+			if (thread->ThreadGroup != p)
+			{
+				continue;
+			}
+			if (thread->State == ZOMBIE)
+			{
+				freeThread(thread);
+			}
+			else
+			{
+				thread->IsKilled = 1;
+				if (thread->State == SLEEPING)
+				{
+					thread->State = RUNNABLE;
+				}
+			}
+		}
+		if (p->ThreadCount > 0)
+		{
+			sleep(p, &processTable.Lock);
+		}
+	}
+	spinlockRelease(&processTable.Lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -265,23 +761,33 @@ void exit(void)
 {
 	Process *curproc = myProcess();
 	Process *p;
+	Process *next;
 	int fd;
 
 	if (curproc == initproc)
 	{
 		panic("init exiting");
 	}
-	// Close all open files.
-	for (fd = 0; fd < NOFILE; fd++) 
+	if (curproc->ThreadGroup == curproc)
 	{
-		if (curproc->OpenFile[fd]) 
+		// The threads are using the memory and files of the process, so they
+		// are stopped first.
+		stopThreads(curproc);
+
+		// Remove mapped files and close all open files.
+		mmapRelease(curproc);
+		for (fd = 0; fd < curproc->OpenFileCount; fd++) 
 		{
-			fileClose(curproc->OpenFile[fd]);
-			curproc->OpenFile[fd] = 0;
+			if (curproc->OpenFile[fd]) 
+			{
+				fileClose(curproc->OpenFile[fd]);
+				curproc->OpenFile[fd] = 0;
+			}
 		}
-	}
+		freeOpenFileTable(curproc);
 
-	safestrcpy(curproc->Cwd, "", MAXCWDSIZE);
+		safestrcpy(curproc->Cwd, "", MAXCWDSIZE);
+	}
 
 	spinlockAcquire(&processTable.Lock);
 
@@ -289,17 +795,16 @@ void exit(void)
 	wakeup1(curproc->Parent);
 
 	// Pass abandoned children to init.
-	for (p = processTable.Process; p < &processTable.Process[NPROC]; p++) 
+	for (p = curproc->FirstChild; p != 0; p = next) 
 	{
-		if (p->Parent == curproc) 
+		next = p->NextSibling;
+		addChild(initproc, p);
+		if (p->State == ZOMBIE)
 		{
-			p->Parent = initproc;
-			if (p->State == ZOMBIE)
-			{
-				wakeup1(initproc);
-			}
+			wakeup1(initproc);
 		}
 	}
+	curproc->FirstChild = 0;
 
 	// Jump into the Scheduler, never to return.
 	curproc->State = ZOMBIE;
@@ -314,16 +819,17 @@ int wait(void)
 {
 	Process *p;
 	int havekids, pid;
-	Process *curproc = myProcess();
+	Process *curproc = myThreadGroup();
 
 	spinlockAcquire(&processTable.Lock);
 	for (;;) 
 	{
-		// Scan through table looking for exited children.
+		// Scan through the children looking for exited ones.  Threads are
+		// left for join.
 		havekids = 0;
-		for (p = processTable.Process; p < &processTable.Process[NPROC]; p++) 
+		for (p = curproc->FirstChild; p != 0; p = p->NextSibling) 
 		{
-			if (p->Parent != curproc)
+			if (p->ThreadGroup != p)
 			{
 				continue;
 			}
@@ -335,18 +841,14 @@ int wait(void)
 				freePhysicalMemoryPage(p->KernelStack);
 				p->KernelStack = 0;
 				freeMemoryAndPageTable(p->PageTable);
-				p->ProcessId = 0;
-				p->Parent = 0;
-				p->Name[0] = 0;
-				p->IsKilled = 0;
-				p->State = UNUSED;
+				freeProcess(p);
 				spinlockRelease(&processTable.Lock);
 				return pid;
 			}
 		}
 
 		// No point waiting if we don't have any children.
-		if (!havekids || curproc->IsKilled) 
+		if (!havekids || myProcess()->IsKilled) 
 		{
 			spinlockRelease(&processTable.Lock);
 			return -1;
@@ -378,7 +880,7 @@ void scheduler(void)
 		// Loop over process table looking for process to run.
 		spinlockAcquire(&processTable.Lock);
 
-		for (p = processTable.Process; p < &processTable.Process[NPROC]; p++) 
+		for (p = processTable.All; p != 0; p = p->AllNext) 
 		{
 			if (p->State != RUNNABLE)
 			{
@@ -458,13 +960,26 @@ void forkret(void)
 		// Some initialization functions must be run in the context
 		// of a regular process (e.g., they call sleep), and thus cannot
 		// be run from main().
-		fsFat12Initialise();
+		if (ROOTDEV == RAMDISKDEV)
+		{
+			// Mount the root file system from a copy of IDE disk 0 in memory
+			ramDiskLoad(0);
+		}
+		fsFat12Initialise(ROOTDEV);
 		first = 0;
 	}
 
 	// Return to "caller", actually trapret (see allocateProcess).
 }
 
+// A kernel thread's very first scheduling by Scheduler()
+// will swtch here.  "Return" to the thread's entry function.
+void kernelThreadStart(void)
+{
+	// Still holding processTable.Lock from Scheduler.
+	spinlockRelease(&processTable.Lock);
+}
+
 // Atomically spinlockRelease Lock and sleep on chan.
 // Reacquires Lock when awakened.
 void sleep(void *chan, Spinlock *lk)
@@ -514,7 +1029,7 @@ static void wakeup1(void *chan)
 {
 	Process *p;
 
-	for (p = processTable.Process; p < &processTable.Process[NPROC]; p++)
+	for (p = processTable.All; p != 0; p = p->AllNext)
 	{
 		if (p->State == SLEEPING && p->Chan == chan)
 		{
@@ -531,6 +1046,26 @@ void wakeup(void *chan)
 	spinlockRelease(&processTable.Lock);
 }
 
+// Wake up at most count of the processes sleeping on chan.  Returns the 
+// number woken.
+int wakeupCount(void *chan, int count)
+{
+	Process *p;
+	int woken = 0;
+
+	spinlockAcquire(&processTable.Lock);
+	for (p = processTable.All; p != 0 && woken < count; p = p->AllNext)
+	{
+		if (p->State == SLEEPING && p->Chan == chan)
+		{
+			p->State = RUNNABLE;
+			woken++;
+		}
+	}
+	spinlockRelease(&processTable.Lock);
+	return woken;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -540,19 +1075,16 @@ int kill(int pid)
 	Process *p;
 
 	spinlockAcquire(&processTable.Lock);
-	for (p = processTable.Process; p < &processTable.Process[NPROC]; p++) 
+	if ((p = findProcess(pid)) != 0) 
 	{
-		if (p->ProcessId == pid) 
+		p->IsKilled = 1;
+		// Wake process from sleep if necessary.
+		if (p->State == SLEEPING)
 		{
-			p->IsKilled = 1;
-			// Wake process from sleep if necessary.
-			if (p->State == SLEEPING)
-			{
-				p->State = RUNNABLE;
-			}
-			spinlockRelease(&processTable.Lock);
-			return 0;
+			p->State = RUNNABLE;
 		}
+		spinlockRelease(&processTable.Lock);
+		return 0;
 	}
 	spinlockRelease(&processTable.Lock);
 	return -1;
@@ -579,7 +1111,7 @@ void processDump(void)
 	uint32_t pc[10];
 
 	cprintf("\n");
-	for (p = processTable.Process; p < &processTable.Process[NPROC]; p++) 
+	for (p = processTable.All; p != 0; p = p->AllNext) 
 	{
 		if (p->State == UNUSED)
 		{
@@ -8,6 +8,7 @@ struct _Cpu
   volatile uint32_t		Started;			// Has the CPU Started?
   int					CliDepth;           // Depth of pushCli nesting.
   int					InterruptsEnabled;  // Were interrupts enabled before pushCli?
+  int					SysenterEnabled;	// Has SYSENTER been set up on this CPU?
   Process *				Process;			// The process running on this cpu or null
 };
 
@@ -34,6 +35,20 @@ struct _Context
 	uint32_t eip;
 };
 
+// A file or shared memory segment mapped into the address space of a process
+// (see mmap.c)
+
+typedef struct _Mapping
+{
+	uint32_t			Address;			// User address of the mapping (0 if unused)
+	uint32_t			Length;				// Length in bytes (a multiple of PGSIZE)
+	uint32_t			Offset;				// Offset in the file of the first page
+	int					Protection;			// PROT_READ and PROT_WRITE
+	int					Flags;				// MAP_SHARED or MAP_PRIVATE
+	File *				File;
+	SharedSegment *		Segment;			// Segment mapped instead of a file (see shm.c)
+} Mapping;
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -45,12 +60,28 @@ struct _Process
 	enum procstate		State;				// Process state
 	int					ProcessId;          // Process ID
 	Process *			Parent;				// Parent process
+	Process *			FirstChild;			// Children of the process, linked by NextSibling
+	Process *			NextSibling;
+	Process *			PreviousSibling;
+	Process *			HashNext;			// Next process in the same PID hash chain, or on the free list
+	Process *			AllNext;			// Next process structure, whether it is used or not
+	Process *			ThreadGroup;		// Process whose memory, open files and directory are used (itself unless this is a thread)
+	int					ThreadCount;		// Threads of the process that have not been joined
+	uint32_t			ThreadStack;		// User address of the stack of a thread, returned by join
+	Spinlock			FileLock;			// Protects OpenFile and OpenFileCount while threads share them
+	Sleeplock			MemoryLock;			// Serialises changes to the page table and mappings of a thread group
 	struct Trapframe *	Trapframe;			// Trap frame for current syscall
 	Context *			Context;			// swtch() here to run process
 	void *				Chan;               // If non-zero, sleeping on chan
 	int					IsKilled;           // If non-zero, have been killed
-	File *				OpenFile[NOFILE];	// Open files
+	File **				OpenFile;			// Open files (InitialOpenFile until the table grows)
+	int					OpenFileCount;		// Number of entries in OpenFile
+	File *				InitialOpenFile[NOFILE];
 	char				Cwd[MAXCWDSIZE];	// Current directory
+	Ring *				Ring;				// I/O ring (kernel address) or 0
+	uint32_t			RingAddress;		// User address of I/O ring
+	volatile int		RingDraining;		// Set while a thread is draining the ring
+	Mapping				Mappings[NMAPPINGS];	// Mapped files
 	char				Name[16];		    // Process name (debugging)
 };
 
@@ -0,0 +1,113 @@
+// RAM disk.
+//
+// A block device held in memory, so that the file system can be used without
+// waiting for a disk.  It is RAMDISKSIZE sectors long and is kept in pages 
+// from allocatePhysicalMemoryPage.  A page is only allocated when one of its
+// sectors is first written; until then its sectors read as zeros.
+//
+// The RAM disk can be loaded with a copy of another device when the file 
+// system is mounted, so that the root file system is mounted from memory
+// when ROOTDEV is RAMDISKDEV.  Changes are not written back to that device.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "buf.h"
+#include "blockdev.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static struct
+{
+	Spinlock		Lock;
+	BlockDevice		Device;
+	char *			Pages[(RAMDISKSIZE + SECTORSPERPAGE - 1) / SECTORSPERPAGE];
+	DiskBuffer		Buffer;				// Used to load the RAM disk from another device
+} ramDisk;
+
+// Sync a buffer with the RAM disk.  The request is done straight away.  A
+// write that needs a new page when there is no memory fails with B_ERROR set,
+// and the sector keeps its old contents.
+
+static void ramDiskQueueRequest(DiskBuffer *b)
+{
+	char ** page = &ramDisk.Pages[b->SectorNumber / SECTORSPERPAGE];
+	uint32_t offset = (b->SectorNumber % SECTORSPERPAGE) * BSIZE;
+
+	if (b->Flags & B_DIRTY)
+	{
+		spinlockAcquire(&ramDisk.Lock);
+		if (*page == 0 && (*page = allocatePhysicalMemoryPage()) != 0)
+		{
+			memset(*page, 0, PGSIZE);
+		}
+		spinlockRelease(&ramDisk.Lock);
+		if (*page == 0)
+		{
+			b->Flags |= B_ERROR;
+		}
+		else
+		{
+			memmove(*page + offset, b->Data, BSIZE);
+		}
+	}
+	else if (*page != 0)
+	{
+		memmove(b->Data, *page + offset, BSIZE);
+	}
+	else
+	{
+		memset(b->Data, 0, BSIZE);
+	}
+	b->Flags |= B_VALID;
+	b->Flags &= ~B_DIRTY;
+}
+
+static void ramDiskWaitForRequest(DiskBuffer *b)
+{
+	// Nothing to wait for
+}
+
+void ramDiskInitialise(void)
+{
+	spinlockInitialise(&ramDisk.Lock, "ramdisk");
+	sleeplockInitialise(&ramDisk.Buffer.Lock, "ramdisk buffer");
+	ramDisk.Device.Name = "ramdisk";
+	ramDisk.Device.Capacity = RAMDISKSIZE;
+	ramDisk.Device.QueueRequest = ramDiskQueueRequest;
+	ramDisk.Device.WaitForRequest = ramDiskWaitForRequest;
+	blockDeviceRegister(RAMDISKDEV, &ramDisk.Device);
+}
+
+// Copy the contents of another device into the RAM disk.  Sectors of zeros 
+// are skipped, so no memory is used for the free space of a file system. 
+// Must be called from a process, since reading the device sleeps.
+
+void ramDiskLoad(uint32_t dev)
+{
+	DiskBuffer *b = &ramDisk.Buffer;
+	uint32_t count = min(blockDeviceCapacity(dev), RAMDISKSIZE);
+	uint32_t sector;
+	int i;
+
+	sleeplockAcquire(&b->Lock);
+	for (sector = 0; sector < count; sector++)
+	{
+		b->Device = dev;
+		b->SectorNumber = sector;
+		b->Flags = 0;
+		blockDeviceReadWrite(b);
+		for (i = 0; i < BSIZE && b->Data[i] == 0; i++)
+			;
+		if (i < BSIZE)
+		{
+			b->Device = RAMDISKDEV;
+			b->Flags |= B_DIRTY;
+			ramDiskQueueRequest(b);
+		}
+	}
+	sleeplockRelease(&b->Lock);
+}
@@ -0,0 +1,237 @@
+// Shared-memory I/O ring.
+//
+// A process can ask for a page holding a submission ring and a completion ring
+// to be mapped into its address space (ringsetup).  It queues reads and writes
+// in the submission ring and then makes a single ringenter system call, which
+// carries them all out and posts a completion for each.  If the ring is set up
+// with RING_POLL, the kernel also drains it at the end of every other system
+// call the process makes, so requests queued between other calls do not need a
+// ringenter of their own.  The ring is only drained in system calls, never from
+// an interrupt, since carrying out the requests can wait for the disk.  Polling
+// stops at the first request on a pipe or device, which could wait forever and
+// hold up the unrelated system call; it and the requests after it are left for
+// the next ringenter.
+//
+// Before the requests are carried out, the disk reads for all of the queued reads
+// from disk files are started, so that they are in flight at the disk together
+// rather than being made one at a time.  Pages that are already being read, 
+// including by an earlier request in the same batch, are skipped rather than 
+// waited for (see pageCacheStartRead).  Only one thread of a process drains
+// its ring at a time.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "ring.h"
+#include "x86.h"
+
+#define RINGREADAHEAD	NPAGEIO		// Maximum number of page reads started together
+
+// Map a ring page into the current process, just above its current memory.
+// Returns the user address of the ring or -1 on error.
+
+int ringSetup(int flags)
+{
+	Process *curproc = myThreadGroup();
+	uint32_t address;
+
+	sleeplockAcquire(&curproc->MemoryLock);
+	address = PGROUNDUP(curproc->MemorySize);
+	if (curproc->Ring != 0 ||
+		allocateMemoryAndPageTables(curproc->PageTable, curproc->MemorySize, address + PGSIZE) == 0)
+	{
+		sleeplockRelease(&curproc->MemoryLock);
+		return -1;
+	}
+	curproc->MemorySize = address + PGSIZE;
+	curproc->Ring = (Ring *)mapVirtualAddressToKernelAddress(curproc->PageTable, (char *)address);
+	curproc->RingAddress = address;
+	curproc->Ring->Flags = flags;
+	switchToUserVirtualMemory(myProcess());
+	sleeplockRelease(&curproc->MemoryLock);
+	return address;
+}
+
+// Get the open file for a descriptor in a submission.  A reference is taken
+// under the descriptor table lock, since another thread of the process could
+// close the descriptor; the caller must give it back with fileClose.
+
+static File * ringFile(Process *p, int fd)
+{
+	File *f = 0;
+
+	spinlockAcquire(&p->FileLock);
+	if (fd >= 0 && fd < p->OpenFileCount && (f = p->OpenFile[fd]) != 0)
+	{
+		fileDup(f);
+	}
+	spinlockRelease(&p->FileLock);
+	return f;
+}
+
+// Carry out one request and return its result
+
+static int ringExecute(Process *p, struct _RingSubmission *submission)
+{
+	File *f;
+	char *buffer;
+	int result = -1;
+
+	if (submission->Opcode == RING_NOP)
+	{
+		return 0;
+	}
+	if (submission->Opcode == RING_WRITE)
+	{
+		if (fetchsrcptr((uint32_t)submission->Buffer, &buffer, submission->Length) < 0)
+		{
+			return -1;
+		}
+	}
+	else if (fetchptr((uint32_t)submission->Buffer, &buffer, submission->Length) < 0)
+	{
+		return -1;
+	}
+	if ((f = ringFile(p, submission->Fd)) == 0)
+	{
+		return -1;
+	}
+	switch (submission->Opcode)
+	{
+		case RING_READ:
+			if (submission->Offset < 0)
+			{
+				result = fileRead(f, buffer, submission->Length);
+			}
+			else
+			{
+				result = fileReadAt(f, buffer, submission->Length, submission->Offset);
+			}
+			break;
+
+		case RING_WRITE:
+			if (submission->Offset < 0)
+			{
+				result = fileWrite(f, buffer, submission->Length);
+			}
+			else
+			{
+				result = fileWriteAt(f, buffer, submission->Length, submission->Offset);
+			}
+			break;
+	}
+	fileClose(f);
+	return result;
+}
+
+// Check whether a request can be carried out while the ring is polled, which
+// is when it only waits for the disk, if at all.  A request with a bad
+// descriptor fails straight away, so it can.
+
+static int ringCanPoll(Process *p, struct _RingSubmission *submission)
+{
+	File *f;
+	int result;
+
+	if (submission->Opcode == RING_NOP || (f = ringFile(p, submission->Fd)) == 0)
+	{
+		return 1;
+	}
+	result = f->Type == FD_FILE;
+	fileClose(f);
+	return result;
+}
+
+// Carry out the requests queued in the ring of the current process.
+// Stops early if the completion ring fills up or, if poll is 1, at the first
+// request that could wait for something other than the disk.  Returns the
+// number of requests carried out, or -1 if the process does not have a ring.
+
+int ringDrain(int poll)
+{
+	Process *curproc = myThreadGroup();
+	Ring *ring = curproc->Ring;
+	char *readAhead[RINGREADAHEAD];
+	struct _RingSubmission submission;
+	struct _RingCompletion *completion;
+	uint32_t head;
+	uint32_t tail;
+	File *f;
+	int started = 0;
+	int done = 0;
+
+	if (ring == 0)
+	{
+		return -1;
+	}
+	if (atomicCompareExchange(&curproc->RingDraining, 0, 1) != 0)
+	{
+		// Another thread is draining the ring
+		return 0;
+	}
+	tail = ring->SubmissionTail;
+	if (tail - ring->SubmissionHead > RINGENTRIES)
+	{
+		tail = ring->SubmissionHead + RINGENTRIES;
+	}
+	__sync_synchronize();
+
+	// Start the disk reads for all of the reads from disk files
+	for (head = ring->SubmissionHead; head != tail && started < RINGREADAHEAD; head++)
+	{
+		submission = ring->Submission[head % RINGENTRIES];
+		if (submission.Opcode == RING_READ && (f = ringFile(curproc, submission.Fd)) != 0)
+		{
+			started += fileStartRead(f, submission.Offset < 0 ? f->Position : submission.Offset, submission.Length,
+										readAhead + started, RINGREADAHEAD - started);
+			fileClose(f);
+		}
+	}
+	for (int i = 0; i < started; i++)
+	{
+		pageCacheWaitAndRelease(readAhead[i]);
+	}
+
+	// Now carry out the requests in order, mostly from the page cache
+	for (head = ring->SubmissionHead; head != tail; head++)
+	{
+		if (ring->CompletionTail - ring->CompletionHead >= RINGENTRIES)
+		{
+			break;
+		}
+		submission = ring->Submission[head % RINGENTRIES];
+		if (poll && !ringCanPoll(curproc, &submission))
+		{
+			break;
+		}
+		completion = &ring->Completion[ring->CompletionTail % RINGENTRIES];
+		completion->UserData = submission.UserData;
+		completion->Result = ringExecute(curproc, &submission);
+		__sync_synchronize();
+		ring->CompletionTail++;
+		ring->SubmissionHead = head + 1;
+		done++;
+	}
+	curproc->RingDraining = 0;
+	return done;
+}
+
+// Drain the ring of the current process if it has asked for it to be polled.
+// Called at the end of each system call.
+
+void ringPoll(void)
+{
+	Ring *ring = myThreadGroup()->Ring;
+
+	if (ring != 0 && (ring->Flags & RING_POLL))
+	{
+		ringDrain(1);
+	}
+}
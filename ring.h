@@ -0,0 +1,48 @@
+// Shared-memory I/O ring (see ring.c)
+
+#define RINGENTRIES  64  // entries in each of the submission and completion rings
+
+// Ring operations
+#define RING_NOP	0
+#define RING_READ	1
+#define RING_WRITE	2
+
+// Ring flags
+#define RING_POLL	1	// Kernel also drains the ring at the end of each system call (disk files only)
+
+// A request queued by the process.  An Offset of -1 reads or writes at the
+// current position of the file, otherwise the position is not used or changed.
+
+struct _RingSubmission
+{
+	uint32_t	Opcode;
+	int			Fd;
+	void *		Buffer;
+	uint32_t	Length;
+	int			Offset;
+	uint32_t	UserData;	// Copied to the completion
+};
+
+// The result of a request, posted by the kernel
+
+struct _RingCompletion
+{
+	uint32_t	UserData;
+	int			Result;
+};
+
+// The ring page.  The process adds submissions at SubmissionTail and takes
+// completions from CompletionHead.  The kernel takes submissions from 
+// SubmissionHead and adds completions at CompletionTail.  The indexes only
+// ever increase; entries are at index % RINGENTRIES.
+
+struct _Ring
+{
+	volatile uint32_t		SubmissionHead;
+	volatile uint32_t		SubmissionTail;
+	volatile uint32_t		CompletionHead;
+	volatile uint32_t		CompletionTail;
+	uint32_t				Flags;
+	struct _RingSubmission	Submission[RINGENTRIES];
+	struct _RingCompletion	Completion[RINGENTRIES];
+};
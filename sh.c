@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -57,6 +58,11 @@ struct backcmd
 
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
+
+// Commands are parsed by the shell itself, so that simple ones can be 
+// started without forking it.  The parser records the first error here 
+// rather than exiting.
+char *parseerror;
 struct cmd *parsecmd(char*);
 
 // Execute cmd.  Never returns.
@@ -148,6 +154,126 @@ void runcmd(struct cmd *cmd)
 	exit();
 }
 
+// Check whether cmd is a program, possibly with its input or output 
+// redirected, or a pipeline of them.  These are started with spawn.
+
+int canspawn(struct cmd *cmd)
+{
+	switch (cmd->type)
+	{
+		case EXEC:
+			return ((struct execcmd*)cmd)->argv[0] != 0;
+
+		case REDIR:
+			return canspawn(((struct redircmd*)cmd)->cmd);
+
+		case PIPE:
+			return canspawn(((struct pipecmd*)cmd)->left) && canspawn(((struct pipecmd*)cmd)->right);
+	}
+	return 0;
+}
+
+// Start the programs in cmd, which canspawn has accepted, with spawn.  actions
+// are the changes made so far to the open files the programs will inherit.
+// Returns the number of processes started.
+
+int spawncmd(struct cmd *cmd, struct _SpawnAction *actions, int count)
+{
+	int p[2];
+	int fd;
+	int started;
+	struct _SpawnAction more[MAXSPAWNACTIONS];
+	struct execcmd *ecmd;
+	struct pipecmd *pcmd;
+	struct redircmd *rcmd;
+
+	if (cmd->type != EXEC && count + 3 > MAXSPAWNACTIONS)
+	{
+		printf("too many redirections\n");
+		return 0;
+	}
+	memmove(more, actions, count * sizeof(struct _SpawnAction));
+	switch (cmd->type) 
+	{
+		case EXEC:
+			ecmd = (struct execcmd*)cmd;
+			if (spawn(ecmd->argv[0], ecmd->argv, actions, count) < 0)
+			{
+				printf("exec %s failed\n", ecmd->argv[0]);
+				return 0;
+			}
+			return 1;
+
+		case REDIR:
+			rcmd = (struct redircmd*)cmd;
+			if ((fd = open(rcmd->file, rcmd->mode)) < 0) 
+			{
+				printf("open %s failed\n", rcmd->file);
+				return 0;
+			}
+			more[count].Action = SPAWN_DUP;
+			more[count].Fd = fd;
+			more[count].NewFd = rcmd->fd;
+			more[count + 1].Action = SPAWN_CLOSE;
+			more[count + 1].Fd = fd;
+			started = spawncmd(rcmd->cmd, more, count + 2);
+			close(fd);
+			return started;
+
+		case PIPE:
+			pcmd = (struct pipecmd*)cmd;
+			if (pipe(p) < 0)
+			{
+				panic("Pipe");
+			}
+			more[count].Action = SPAWN_DUP;
+			more[count].Fd = p[1];
+			more[count].NewFd = 1;
+			more[count + 1].Action = SPAWN_CLOSE;
+			more[count + 1].Fd = p[0];
+			more[count + 2].Action = SPAWN_CLOSE;
+			more[count + 2].Fd = p[1];
+			started = spawncmd(pcmd->left, more, count + 3);
+			more[count].Fd = p[0];
+			more[count].NewFd = 0;
+			started += spawncmd(pcmd->right, more, count + 3);
+			close(p[0]);
+			close(p[1]);
+			return started;
+	}
+	return 0;
+}
+
+// Free the structures made by parsecmd
+void freecmd(struct cmd *cmd)
+{
+	if (cmd == 0)
+	{
+		return;
+	}
+	switch (cmd->type) 
+	{
+		case REDIR:
+			freecmd(((struct redircmd*)cmd)->cmd);
+			break;
+
+		case PIPE:
+			freecmd(((struct pipecmd*)cmd)->left);
+			freecmd(((struct pipecmd*)cmd)->right);
+			break;
+
+		case LIST:
+			freecmd(((struct listcmd*)cmd)->left);
+			freecmd(((struct listcmd*)cmd)->right);
+			break;
+
+		case BACK:
+			freecmd(((struct backcmd*)cmd)->cmd);
+			break;
+	}
+	free(cmd);
+}
+
 void changeDirectory(char * path)
 {
 	// Stop a plain CD command doing nothing
@@ -185,6 +311,8 @@ int getcmd(char *buf, int nbuf)
 int main(void)
 {
 	static char buf[100];
+	struct cmd *cmd;
+	int started;
 
 	// Read and run input commands.
 	while (getcmd(buf, sizeof(buf)) >= 0) 
@@ -196,11 +324,29 @@ int main(void)
 			changeDirectory(buf + 3);
 			continue;
 		}
-		if (fork1() == 0)
+		cmd = parsecmd(buf);
+		if (parseerror != 0)
 		{
-			runcmd(parsecmd(buf));
+			printf("%s\n", parseerror);
+			parseerror = 0;
 		}
-		wait();
+		else if (cmd != 0 && canspawn(cmd))
+		{
+			// Programs and pipelines are started without copying the shell
+			for (started = spawncmd(cmd, 0, 0); started > 0; started--)
+			{
+				wait();
+			}
+		}
+		else
+		{
+			if (fork1() == 0)
+			{
+				runcmd(cmd);
+			}
+			wait();
+		}
+		freecmd(cmd);
 	}
 	exit();
 }
@@ -359,6 +505,15 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// Record a syntax error.  Only the first one is reported.
+void syntax(char *s)
+{
+	if (parseerror == 0)
+	{
+		parseerror = s;
+	}
+}
+
 struct cmd*	parsecmd(char *s)
 {
 	char *es;
@@ -370,7 +525,7 @@ struct cmd*	parsecmd(char *s)
 	if (s != es) 
 	{
 		printf("leftovers: %s\n", s);
-		panic("syntax");
+		syntax("syntax");
 	}
 	nulterminate(cmd);
 	return cmd;
@@ -417,7 +572,8 @@ struct cmd*	parseredirs(struct cmd *cmd, char **ps, char *es)
 		tok = gettoken(ps, es, 0, 0);
 		if (gettoken(ps, es, &q, &eq) != 'a')
 		{
-			panic("missing File for redirection");
+			syntax("missing File for redirection");
+			break;
 		}
 		switch (tok) 
 		{
@@ -425,7 +581,7 @@ struct cmd*	parseredirs(struct cmd *cmd, char **ps, char *es)
 				cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
 				break;
 			case '>':
-				cmd = redircmd(cmd, q, eq, O_WRONLY | O_CREATE, 1);
+				cmd = redircmd(cmd, q, eq, O_WRONLY | O_CREATE | O_TRUNC, 1);
 				break;
 			case '+':  // >>
 				cmd = redircmd(cmd, q, eq, O_WRONLY | O_CREATE, 1);
@@ -447,7 +603,7 @@ struct cmd*	parseblock(char **ps, char *es)
 	cmd = parseline(ps, es);
 	if (!peek(ps, es, ")"))
 	{
-		panic("syntax - missing )");
+		syntax("syntax - missing )");
 	}
 	gettoken(ps, es, 0, 0);
 	cmd = parseredirs(cmd, ps, es);
@@ -478,15 +634,17 @@ struct cmd*	parseexec(char **ps, char *es)
 		}
 		if (tok != 'a')
 		{
-			panic("syntax");
+			syntax("syntax");
+			break;
+		}
+		if (argc + 1 >= MAXARGS)
+		{
+			syntax("too many args");
+			break;
 		}
 		cmd->argv[argc] = q;
 		cmd->eargv[argc] = eq;
 		argc++;
-		if (argc >= MAXARGS)
-		{
-			panic("too many args");
-		}
 		ret = parseredirs(ret, ps, es);
 	}
 	cmd->argv[argc] = 0;
@@ -0,0 +1,188 @@
+// Shared memory segments.
+//
+// A segment is a set of pages that several processes can map at once, so that
+// they can pass data to each other without it being copied through the kernel
+// as it is with pipes.  shmget finds or creates a segment using a key that 
+// the processes agree on (a key of 0 always creates a new segment, which can
+// be shared with children).  shmat maps the segment into the region used for
+// mapped files (see mmap.c) and shmdt removes it.  shmrm removes the segment
+// itself, so that it can no longer be found or attached.
+//
+// The pages of a segment are allocated and cleared when they are first 
+// touched, and the same physical page is then mapped into every process that
+// touches it.  A segment counts the processes it is attached to and is freed,
+// with its pages, when the last of them detaches it or exits.  A segment that
+// is not attached is kept until it is attached or removed with shmrm.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+struct _SharedSegment
+{
+	int					Key;
+	uint32_t			Size;				// Size in bytes (a multiple of PGSIZE, 0 if unused)
+	int					Attached;			// Number of mappings of the segment
+	int					Removed;			// shmrm has been called, so it cannot be attached again
+	char *				Page[SHMMAXPAGES];	// Pages that have been touched
+};
+
+struct
+{
+	Spinlock			Lock;
+	SharedSegment		Segment[NSHAREDSEGMENTS];
+} shmTable;
+
+void shmInitialise(void)
+{
+	spinlockInitialise(&shmTable.Lock, "shm");
+}
+
+// Find the segment for key, creating it with size bytes if there is none.
+// Returns the ID of the segment or -1 if it is too big, if an existing
+// segment is smaller than size or if there is no room for another.
+
+int shmGet(int key, int size)
+{
+	SharedSegment *s;
+	SharedSegment *free = 0;
+	int id = -1;
+
+	if (size <= 0 || size > SHMMAXPAGES * PGSIZE)
+	{
+		return -1;
+	}
+	spinlockAcquire(&shmTable.Lock);
+	for (s = shmTable.Segment; s < shmTable.Segment + NSHAREDSEGMENTS; s++)
+	{
+		if (s->Size == 0)
+		{
+			if (free == 0)
+			{
+				free = s;
+			}
+		}
+		else if (key != 0 && s->Key == key && !s->Removed)
+		{
+			id = s->Size >= size ? s - shmTable.Segment : -1;
+			spinlockRelease(&shmTable.Lock);
+			return id;
+		}
+	}
+	if (free != 0)
+	{
+		free->Key = key;
+		free->Size = PGROUNDUP(size);
+		free->Attached = 0;
+		free->Removed = 0;
+		id = free - shmTable.Segment;
+	}
+	spinlockRelease(&shmTable.Lock);
+	return id;
+}
+
+// Count another mapping of segment id.  The size of the segment is returned
+// in size.  Returns the segment or 0 if there is no segment id.
+
+SharedSegment* shmAttach(int id, uint32_t *size)
+{
+	SharedSegment *s = 0;
+
+	if (id < 0 || id >= NSHAREDSEGMENTS)
+	{
+		return 0;
+	}
+	spinlockAcquire(&shmTable.Lock);
+	if (shmTable.Segment[id].Size != 0 && !shmTable.Segment[id].Removed)
+	{
+		s = &shmTable.Segment[id];
+		s->Attached++;
+		*size = s->Size;
+	}
+	spinlockRelease(&shmTable.Lock);
+	return s;
+}
+
+// Count another mapping of a segment that is already attached.  Used by fork.
+
+void shmHold(SharedSegment *s)
+{
+	spinlockAcquire(&shmTable.Lock);
+	s->Attached++;
+	spinlockRelease(&shmTable.Lock);
+}
+
+// Free s and its pages.  shmTable.Lock must be held.
+
+static void shmFree(SharedSegment *s)
+{
+	for (int i = 0; i < SHMMAXPAGES; i++)
+	{
+		if (s->Page[i] != 0)
+		{
+			freePhysicalMemoryPage(s->Page[i]);
+			s->Page[i] = 0;
+		}
+	}
+	s->Size = 0;
+}
+
+// Remove a mapping of s.  The pages must have been unmapped.  When the last
+// mapping has gone, the segment and its pages are freed.
+
+void shmDetach(SharedSegment *s)
+{
+	spinlockAcquire(&shmTable.Lock);
+	if (--s->Attached == 0)
+	{
+		shmFree(s);
+	}
+	spinlockRelease(&shmTable.Lock);
+}
+
+// Remove segment id, so that it cannot be found by its key or attached again.
+// It is freed now if it is not attached, or otherwise when the last mapping of
+// it goes.  Returns -1 if there is no segment id.
+
+int shmRemove(int id)
+{
+	SharedSegment *s;
+	int result = -1;
+
+	if (id < 0 || id >= NSHAREDSEGMENTS)
+	{
+		return -1;
+	}
+	spinlockAcquire(&shmTable.Lock);
+	s = &shmTable.Segment[id];
+	if (s->Size != 0 && !s->Removed)
+	{
+		s->Removed = 1;
+		if (s->Attached == 0)
+		{
+			shmFree(s);
+		}
+		result = 0;
+	}
+	spinlockRelease(&shmTable.Lock);
+	return result;
+}
+
+// Get page index of s, allocating and clearing it if this is the first time
+// it has been touched.  Returns 0 if there is no memory.
+
+char* shmPage(SharedSegment *s, uint32_t index)
+{
+	char *page;
+
+	spinlockAcquire(&shmTable.Lock);
+	if ((page = s->Page[index]) == 0 && (page = allocatePhysicalMemoryPage()) != 0)
+	{
+		memset(page, 0, PGSIZE);
+		s->Page[index] = page;
+	}
+	spinlockRelease(&shmTable.Lock);
+	return page;
+}
@@ -6,9 +6,9 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 
 void sleeplockInitialise(Sleeplock *lk, char *name)
 {
@@ -30,6 +30,23 @@ void sleeplockAcquire(Sleeplock *lk)
 	spinlockRelease(&lk->Spinlock);
 }
 
+// Acquire the lock if it is free without sleeping.  Returns 1 if it was acquired.
+
+int sleeplockTryAcquire(Sleeplock *lk)
+{
+	int acquired = 0;
+
+	spinlockAcquire(&lk->Spinlock);
+	if (!lk->Locked)
+	{
+		lk->Locked = 1;
+		lk->Pid = myProcess()->ProcessId;
+		acquired = 1;
+	}
+	spinlockRelease(&lk->Spinlock);
+	return acquired;
+}
+
 void sleeplockRelease(Sleeplock *lk)
 {
 	spinlockAcquire(&lk->Spinlock);
@@ -0,0 +1,13 @@
+// Changes made by spawn to the open files a new process inherits
+
+#define SPAWN_DUP			1		// Make NewFd refer to the file open on Fd
+#define SPAWN_CLOSE			2		// Close Fd
+
+#define MAXSPAWNACTIONS		16		// max actions in one spawn
+
+struct _SpawnAction
+{
+	int			Action;
+	int			Fd;
+	int			NewFd;
+};
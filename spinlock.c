@@ -6,8 +6,9 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
 
 void spinlockInitialise(Spinlock *lk, char *name)
 {
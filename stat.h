@@ -2,6 +2,18 @@
 #define T_FILE 2   // File
 #define T_DEV  3   // Device
 
+// A date and time kept by a file system, decoded from its form on the disk
+
+struct _StatTime
+{
+  uint16_t	year;
+  uint8_t	month;	// 1 - 12
+  uint8_t	day;	// 1 - 31
+  uint8_t	hour;
+  uint8_t	minute;
+  uint8_t	second;
+};
+
 struct _Stat 
 {
   short		type;	// Type of file
@@ -9,4 +21,8 @@ struct _Stat
   uint32_t	ino;    // Inode number
   short		nlink;	// Number of links to file
   uint32_t	size;   // Size of file in bytes
+  uint32_t	cluster;	// First cluster of the file (0 if it has none)
+  uint8_t	attrib;		// FAT attributes of the file
+  struct _StatTime created;		// When the file was created (all 0 if not known)
+  struct _StatTime modified;	// When the file was last changed (all 0 if not known)
 };
@@ -3,6 +3,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -18,7 +20,7 @@
 
 int fetchint(uint32_t addr, int *ip)
 {
-	Process *curproc = myProcess();
+	Process *curproc = myThreadGroup();
 
 	if (addr >= curproc->MemorySize || addr + 4 > curproc->MemorySize)
 	{
@@ -28,14 +30,56 @@ int fetchint(uint32_t addr, int *ip)
 	return 0;
 }
 
+// Check that the block of memory of size bytes at addr lies within the
+// process memory or in a file mapped into it, and set *pp to point at it.
+// write is 1 if the kernel will write to the block, which cannot be done to
+// read-only mapped files.
+
+static int fetchblock(uint32_t addr, char **pp, int size, int write)
+{
+	Process *curproc = myThreadGroup();
+
+	if (size < 0)
+	{
+		return -1;
+	}
+	if (addr >= curproc->MemorySize || addr + size > curproc->MemorySize)
+	{
+		if (addr < MMAPBASE || mmapFaultIn(curproc, addr, size, write) < 0)
+		{
+			return -1;
+		}
+	}
+	*pp = (char*)addr;
+	return 0;
+}
+
+// Check that the block of memory of size bytes at addr lies within
+// the process address space and set *pp to point at it.
+
+int fetchptr(uint32_t addr, char **pp, int size)
+{
+	return fetchblock(addr, pp, size, 1);
+}
+
+// As fetchptr, for a block that the kernel will only read from
+
+int fetchsrcptr(uint32_t addr, char **pp, int size)
+{
+	return fetchblock(addr, pp, size, 0);
+}
+
 // Fetch the nul-terminated string at addr from the current process.
 // Doesn't actually copy the string - just sets *pp to point at it.
-// Returns length of string, not including nul.
+// Returns length of string, not including nul.  Another thread of the process
+// may change the string after it has been checked, so callers must only use
+// it in ways that are bounded, such as copying it with safestrcpy, or use
+// fetchstrcopy instead.
 
 int fetchstr(uint32_t addr, char **pp)
 {
 	char *s, *ep;
-	Process *curproc = myProcess();
+	Process *curproc = myThreadGroup();
 
 	if (addr >= curproc->MemorySize)
 	{
@@ -53,6 +97,26 @@ int fetchstr(uint32_t addr, char **pp)
 	return -1;
 }
 
+// Copy the nul-terminated string at addr in the current process into buffer,
+// which holds size bytes.  Used where the kernel needs a string that another
+// thread cannot change while it is being used.  Returns the length of the
+// string, not including nul, or -1 if it is not valid or does not fit.
+
+int fetchstrcopy(uint32_t addr, char *buffer, int size)
+{
+	Process *curproc = myThreadGroup();
+	int i;
+
+	for (i = 0; i < size && addr + i < curproc->MemorySize; i++)
+	{
+		if ((buffer[i] = *(char*)(addr + i)) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
 // Fetch the nth parameter to the system call as an int
 
 int argint(int n, int *ip)
@@ -67,24 +131,31 @@ int argint(int n, int *ip)
 int argptr(int n, char **pp, int size)
 {
 	int i;
-	Process *curproc = myProcess();
 
 	if (argint(n, &i) < 0)
 	{
 		return -1;
 	}
-	if (size < 0 || (uint32_t)i >= curproc->MemorySize || (uint32_t)i + size > curproc->MemorySize)
+	return fetchptr(i, pp, size);
+}
+
+// As argptr, for a block that the kernel will only read from
+
+int argsrcptr(int n, char **pp, int size)
+{
+	int i;
+
+	if (argint(n, &i) < 0)
 	{
 		return -1;
 	}
-	*pp = (char*)i;
-	return 0;
+	return fetchsrcptr(i, pp, size);
 }
 
 // Fetch the nth parameter to the system call as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// The string is not copied and threads share memory, so it may change
+// after this check; see fetchstr.
 
 int argstr(int n, char **pp)
 {
@@ -96,6 +167,20 @@ int argstr(int n, char **pp)
 	return fetchstr(addr, pp);
 }
 
+// Copy the nth parameter to the system call, a string, into buffer, which
+// holds size bytes.  Returns the length of the string or -1.
+
+int argstrcopy(int n, char *buffer, int size)
+{
+	int addr;
+
+	if (argint(n, &addr) < 0)
+	{
+		return -1;
+	}
+	return fetchstrcopy(addr, buffer, size);
+}
+
 // Execute the system call whose index is specified in AX.
 
 void syscall(void)
@@ -107,6 +192,10 @@ void syscall(void)
 	if (num > 0 && num < NELEM(syscalls) && syscalls[num]) 
 	{
 		curproc->Trapframe->eax = syscalls[num]();
+		if (num != SYS_ringenter)
+		{
+			ringPoll();
+		}
 	}
 	else 
 	{
@@ -35,9 +35,41 @@ my @syscalls = (
 				"getcwd",
 				"opendir",
 				"readdir",
-				"closedir"
+				"closedir",
+				"splice",
+				"lseek",
+				"pread",
+				"pwrite",
+				"readv",
+				"writev",
+				"getdents",
+				"ringsetup",
+				"ringenter",
+				"mmap",
+				"munmap",
+				"stat",
+				"clone",
+				"join",
+				"futexwait",
+				"futexwake",
+				"spawn",
+				"shmget",
+				"shmat",
+				"shmdt",
+				"shmrm"
 			   );
 
+# These system calls are wrapped by functions in ulib.c, so their stubs in usys.asm
+# are given a leading underscore in C (e.g. exit is made by _exit).
+
+my %wrapped = (
+				"exit" => 1,
+				"fork" => 1,
+				"exec" => 1,
+				"close" => 1,
+				"spawn" => 1
+			  );
+
 my $i;			   
 if ($#ARGV == -1)
 {
@@ -81,18 +113,68 @@ if ($ARGV[0] eq '-a')
 {
 	print "%include \"syscall.asm\"\n";
 	print "\n";
+	# All stubs jump to syscallentry with the return address of the caller still on
+	# top of the stack, so the kernel finds the arguments in the same place whether
+	# the call is made with SYSENTER or with int 64.  The first call checks whether
+	# the CPU supports SYSENTER.
+	print "section .data\n";
+	print "sysentersupported\tdd\t-1\t; -1 = not checked yet\n";
+	print "\n";
+	print "section .text\n";
+	print "syscallentry:\n";
+	print "\tcmp\tdword [sysentersupported], 0\n";
+	print "\tjg\t.fast\n";
+	print "\tje\t.slow\n";
+	print "\tpush\teax\n";
+	print "\tpush\tebx\n";
+	print "\tpush\tecx\n";
+	print "\tpush\tedx\n";
+	print "\tmov\teax, 1\n";
+	print "\tcpuid\n";
+	print "\tshr\tedx, 11\t\t; CPUID_SEP\n";
+	print "\tand\tedx, 1\n";
+	print "\tmov\t[sysentersupported], edx\n";
+	print "\tpop\tedx\n";
+	print "\tpop\tecx\n";
+	print "\tpop\tebx\n";
+	print "\tpop\teax\n";
+	print "\tjmp\tsyscallentry\n";
+	print ".fast:\n";
+	print "\tmov\tecx, esp\n";
+	print "\tmov\tedx, .return\n";
+	print "\tsysenter\n";
+	print ".return:\n";
+	print "\tret\n";
+	print ".slow:\n";
+	print "\tint\t64\n";
+	print "\tret\n";
+	print "\n";
 	print "\%macro SYSCALL 1\n";
 	print "global _\%1\n"; 
 	print "_\%1:\n"; 
     print "\tmov\teax, SYS_\%1\n"; 
-    print "\tint\t64\n"; 
-    print "\tret\n";
+    print "\tjmp\tsyscallentry\n"; 
+	print "\n";
+	print "\%endmacro\n";
+	print "\n";
+	print "\%macro WRAPPEDSYSCALL 1\n";
+	print "global __\%1\n"; 
+	print "__\%1:\n"; 
+    print "\tmov\teax, SYS_\%1\n"; 
+    print "\tjmp\tsyscallentry\n"; 
 	print "\n";
 	print "\%endmacro\n";
 	print "\n";
 	for ($i = 0; $i < scalar(@syscalls); $i++)
 	{
-		print "SYSCALL $syscalls[$i]\n";
+		if (exists $wrapped{$syscalls[$i]})
+		{
+			print "WRAPPEDSYSCALL $syscalls[$i]\n";
+		}
+		else
+		{
+			print "SYSCALL $syscalls[$i]\n";
+		}
 	}
 }
 elsif ($ARGV[0] eq '-c')
@@ -5,60 +5,90 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
-#include "proc.h"
-#include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "spawn.h"
 
-// Retrieve an argument to the system call that is an FD
+// Retrieve an argument to the system call that is an FD.  The descriptor
+// table is shared by the threads of a process, so a reference to the file is
+// taken while the table is locked; another thread closing the descriptor then
+// cannot free the file while it is being used.  The caller must give the 
+// reference back with fileClose.
 //
 // n   = The parameter number (0 = The first parameter, 1 = second parameter, etc).
-// pfd = Returns the fd number (set to 0 if not required)
-// pf  = Returns the pointer to the File structure (set to 0 if not required).
+// pf  = Returns the pointer to the File structure.
 
-static int argfd(int n, int *pfd, File **pf)
+static int argfd(int n, File **pf)
 {
 	int fd;
-	File *f;
+	File *f = 0;
+	Process *curproc = myThreadGroup();
 
 	if (argint(n, &fd) < 0)
 	{
 		return -1;
 	}
-	if (fd < 0 || fd >= NOFILE || (f = myProcess()->OpenFile[fd]) == 0)
+	spinlockAcquire(&curproc->FileLock);
+	if (fd >= 0 && fd < curproc->OpenFileCount && (f = curproc->OpenFile[fd]) != 0)
 	{
-		return -1;
-	}
-	if (pfd)
-	{
-		*pfd = fd;
+		fileDup(f);
 	}
-	if (pf)
+	spinlockRelease(&curproc->FileLock);
+	if (f == 0)
 	{
-		*pf = f;
+		return -1;
 	}
+	*pf = f;
 	return 0;
 }
 
 // Allocate a file descriptor for the given file and
 // store it in the process table for the current process.
+// The descriptor table is grown if it is full.
 
 static int fdalloc(File *f)
 {
 	int fd;
-	Process *curproc = myProcess();
+	Process *curproc = myThreadGroup();
 
-	for (fd = 0; fd < NOFILE; fd++) 
+	spinlockAcquire(&curproc->FileLock);
+	for (fd = 0; fd < curproc->OpenFileCount; fd++) 
 	{
 		if (curproc->OpenFile[fd] == 0) 
 		{
-			curproc->OpenFile[fd] = f;
-			return fd;
+			break;
 		}
 	}
-	return -1;
+	if (growOpenFileTable(curproc, fd + 1) < 0)
+	{
+		spinlockRelease(&curproc->FileLock);
+		return -1;
+	}
+	curproc->OpenFile[fd] = f;
+	spinlockRelease(&curproc->FileLock);
+	return fd;
+}
+
+// Take the file open on descriptor fd out of the descriptor table.
+// Returns the file, which the caller must close, or 0 if fd is not open.
+
+static File* fdremove(int fd)
+{
+	File *f = 0;
+	Process *curproc = myThreadGroup();
+
+	spinlockAcquire(&curproc->FileLock);
+	if (fd >= 0 && fd < curproc->OpenFileCount && (f = curproc->OpenFile[fd]) != 0)
+	{
+		curproc->OpenFile[fd] = 0;
+	}
+	spinlockRelease(&curproc->FileLock);
+	return f;
 }
 
 // Duplicate a file descriptor
@@ -68,15 +98,16 @@ int sys_dup(void)
 	File *f;
 	int fd;
 
-	if (argfd(0, 0, &f) < 0)
+	if (argfd(0, &f) < 0)
 	{
 		return -1;
 	}
+	// The new descriptor keeps the reference taken by argfd
 	if ((fd = fdalloc(f)) < 0)
 	{
+		fileClose(f);
 		return -1;
 	}
-	fileDup(f);
 	return fd;
 }
 
@@ -87,12 +118,18 @@ int sys_read(void)
 	File *f;
 	int n;
 	char *p;
+	int result = -1;
 
-	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	if (argfd(0, &f) < 0)
 	{
 		return -1;
 	}
-	return fileRead(f, p, n);
+	if (argint(2, &n) >= 0 && argptr(1, &p, n) >= 0)
+	{
+		result = fileRead(f, p, n);
+	}
+	fileClose(f);
+	return result;
 }
 
 // Write to file.  Only implemented for pipes and console at present. 
@@ -102,11 +139,18 @@ int sys_write(void)
 	File *f;
 	int n;
 	char *p;
-	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	int result = -1;
+
+	if (argfd(0, &f) < 0)
 	{
 		return -1;
 	}
-	return fileWrite(f, p, n);
+	if (argint(2, &n) >= 0 && argsrcptr(1, &p, n) >= 0)
+	{
+		result = fileWrite(f, p, n);
+	}
+	fileClose(f);
+	return result;
 }
 
 // Close file.
@@ -116,27 +160,49 @@ int sys_close(void)
 	int fd;
 	File *f;
 
-	if (argfd(0, &fd, &f) < 0)
+	if (argint(0, &fd) < 0 || (f = fdremove(fd)) == 0)
 	{
 		return -1;
 	}
-	myProcess()->OpenFile[fd] = 0;
 	fileClose(f);
 	return 0;
 }
 
-// Return file stats.  Not fully implemented.
+// Return file stats.
 
 int sys_fstat(void)
 {
 	File *f;
 	Stat *st;
+	int result = -1;
+
+	if (argfd(0, &f) < 0)
+	{
+		return -1;
+	}
+	if (argptr(1, (void*)&st, sizeof(*st)) >= 0)
+	{
+		result = fileStat(f, st);
+	}
+	fileClose(f);
+	return result;
+}
+
+// Return the stats of the file or directory at a path without opening it.
+
+int sys_stat(void)
+{
+	char *path;
+	Stat *st;
 
-	if (argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+	char cwd[MAXCWDSIZE];
+
+	if (argstr(0, &path) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
 	{
 		return -1;
 	}
-	return fileStat(f, st);
+	copyCwd(myThreadGroup(), cwd);
+	return vfsStatPath(cwd, path, st);
 }
 
 // Open a file. 
@@ -144,6 +210,7 @@ int sys_fstat(void)
 int sys_open(void)
 {
 	char *path;
+	char cwd[MAXCWDSIZE];
 	int fd, omode;
 	File * f;
 	
@@ -152,41 +219,48 @@ int sys_open(void)
 		return -1;
 	}
 	
-	Process *curproc = myProcess();
-	// At the moment, only file reading is supported
-	f = fsFat12Open(curproc->Cwd, path, 0);
+	copyCwd(myThreadGroup(), cwd);
+	f = vfsOpen(cwd, path, 0, (omode & O_CREATE) != 0);
 	if (f == 0)
 	{
 		return -1;
 	}
+	// Set the file up before another thread can see it in the descriptor table
+	f->Readable = !(omode & O_WRONLY);
+	f->Writable = (omode & O_WRONLY) || (omode & O_RDWR);
+	if (f->Writable && (omode & O_TRUNC))
+	{
+		fileTruncate(f);
+	}
 	fd = fdalloc(f);
 	if (fd < 0)
 	{
 		fileClose(f);
 		return -1;
 	}
-	f->Readable = !(omode & O_WRONLY);
-	f->Writable = (omode & O_WRONLY) || (omode & O_RDWR);
 	return fd;
 }
 
-// Execute a program
+// Fetch the path of a program and its arguments, which are the nth and
+// n+1th system call arguments, for exec or spawn.  ".exe" is added to the
+// path if it has no extension.  The path and the arguments are copied, the
+// arguments into the page strings, so that another thread cannot change them
+// while they are used.
 
-int sys_exec(void)
+static int argprogram(int n, char *adjustedPath, int size, char **argv, char *strings)
 {
-	char *path, *argv[MAXARG];
 	int i;
+	int length;
+	int used = 0;
 	uint32_t uargv, uarg;
-	char adjustedPath[200];
 	
-	if (argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0) 
+	if (argint(n + 1, (int*)&uargv) < 0) 
 	{
 		return -1;
 	}
-	memset(argv, 0, sizeof(argv));
 	for (i = 0;; i++) 
 	{
-		if (i >= NELEM(argv))
+		if (i >= MAXARG)
 		{
 			return -1;
 		}
@@ -199,19 +273,84 @@ int sys_exec(void)
 			argv[i] = 0;
 			break;
 		}
-		if (fetchstr(uarg, &argv[i]) < 0)
+		if ((length = fetchstrcopy(uarg, strings + used, PGSIZE - used)) < 0)
 		{
 			return -1;
 		}
+		argv[i] = strings + used;
+		used += length + 1;
+	}
+	// Leave room for ".exe"
+	int pathLen = argstrcopy(n, adjustedPath, size - 4);
+	if (pathLen < 0)
+	{
+		return -1;
+	}
+	if (pathLen < 4 || adjustedPath[pathLen - 4] != '.')
+	{
+		safestrcpy(adjustedPath + pathLen, ".exe", size - pathLen);
+	}
+	return 0;
+}
+
+// Execute a program
+
+int sys_exec(void)
+{
+	char *argv[MAXARG];
+	char adjustedPath[200];
+	char *strings;
+	int result = -1;
+	
+	if ((strings = allocatePhysicalMemoryPage()) == 0)
+	{
+		return -1;
 	}
-	int pathLen = strlen(path);
-	safestrcpy(adjustedPath, path, 200);
-	if (path[pathLen - 4] != '.')
+	if (argprogram(0, adjustedPath, sizeof(adjustedPath), argv, strings) == 0)
 	{
-		safestrcpy(adjustedPath + pathLen, ".exe", 200 - pathLen);
-		adjustedPath[pathLen + 4] = 0;
+		result = exec(adjustedPath, argv);
 	}
-	return exec(adjustedPath, argv);
+	freePhysicalMemoryPage(strings);
+	return result;
+}
+
+// Start a program in a new child process, with changes to the open files it
+// inherits
+
+int sys_spawn(void)
+{
+	char *argv[MAXARG];
+	char adjustedPath[200];
+	SpawnAction actions[MAXSPAWNACTIONS];
+	SpawnAction *uactions;
+	char *strings;
+	int count;
+	int result = -1;
+
+	if (argint(3, &count) < 0 || count < 0 || count > MAXSPAWNACTIONS)
+	{
+		return -1;
+	}
+	// The actions are copied before they are checked, so that another thread
+	// cannot change them afterwards
+	if (count > 0)
+	{
+		if (argsrcptr(2, (char **)&uactions, count * sizeof(SpawnAction)) < 0)
+		{
+			return -1;
+		}
+		memmove(actions, uactions, count * sizeof(SpawnAction));
+	}
+	if ((strings = allocatePhysicalMemoryPage()) == 0)
+	{
+		return -1;
+	}
+	if (argprogram(0, adjustedPath, sizeof(adjustedPath), argv, strings) == 0)
+	{
+		result = spawn(adjustedPath, argv, actions, count);
+	}
+	freePhysicalMemoryPage(strings);
+	return result;
 }
 
 int sys_pipe(void)
@@ -233,7 +372,7 @@ int sys_pipe(void)
 	{
 		if (fd0 >= 0)
 		{
-			myProcess()->OpenFile[fd0] = 0;
+			fdremove(fd0);
 		}
 		fileClose(rf);
 		fileClose(wf);
@@ -247,22 +386,28 @@ int sys_pipe(void)
 // Currently supports any <dir> and using ../ or .. to go back but not ../<dir>
 int sys_chdir(void)
 {
-	char *directory;
+	char directory[MAXCWDSIZE];
 	char goBack[] = "../";
 	char goBackAlt[] = "..";
 	int counter = 0;
 	
-	// Check values on the stack exist
-	if (argstr(0, &directory) < 0)
+	// Copy the directory, since another thread could change it while it is used
+	int length = argstrcopy(0, directory, sizeof(directory));
+	if (length < 0)
 	{
 		return -1;
 	}
 		
-	// Get current process
-	Process *curproc = myProcess();
+	// Get current process.  Its threads share Cwd, so it is changed under FileLock
+	Process *curproc = myThreadGroup();
+	spinlockAcquire(&curproc->FileLock);
 		
-	int length = strlen(directory);
 	int currentLength = strlen(curproc->Cwd);
+	if (currentLength + length + 2 > MAXCWDSIZE)
+	{
+		spinlockRelease(&curproc->FileLock);
+		return -1;
+	}
 	
 	// See if the user has opted to go back a level (../ or ..)
 	if((strcmp(directory, goBack) != 0) && (strcmp(directory, goBackAlt) != 0))
@@ -300,7 +445,7 @@ int sys_chdir(void)
 			}
 		}
 	}
-		
+	spinlockRelease(&curproc->FileLock);
 	return 0;
 }
 
@@ -309,23 +454,24 @@ int sys_getcwd(void)
 	// buffer (currentDirectory buffer)
 	char *buffer;		
 	int bufferSize;
+	char cwd[MAXCWDSIZE];
 	
-	// Check values on the stack exist
-	if (argstr(0, &buffer) < 0 || argint(1, &bufferSize) < 0)
+	// Check values on the stack exist and the buffer can be written to
+	if (argint(1, &bufferSize) < 0 || argptr(0, &buffer, bufferSize) < 0)
 	{
 		return -1;
 	}
 	
-	// Get current process
-	Process *curproc = myProcess();
+	// Get a copy of the current directory of the process
+	copyCwd(myThreadGroup(), cwd);
 	
 	// Initialise empty counter
 	int counter = 0;
 	
 	// Loop through until we have every character in the buffer
-	while(counter < bufferSize)
+	while(counter < bufferSize && counter < MAXCWDSIZE)
 	{
-		buffer[counter] = curproc->Cwd[counter];
+		buffer[counter] = cwd[counter];
 		counter++;
 	}
 	
@@ -343,113 +489,436 @@ int sys_opendir(void)
 	// Check values on the stack exist
 	if (argstr(0, &directory) < 0)
 	{
-		return 0;
+		return -1;
 	}
 	
-	// Get current process
-	Process *curproc = myProcess();
-	
 	// Prepare a copy we will modify if directory isn't passed in
-	char cwdCopy[255];
-	safestrcpy(cwdCopy, curproc->Cwd, MAXCWDSIZE);
+	char cwdCopy[MAXCWDSIZE];
+	copyCwd(myThreadGroup(), cwdCopy);
 	int cwdLength = strlen(cwdCopy);
 	
-	// Determine whether reading root or subdirectory
-	if((strcmp(directory, "/") == 0) || (strcmp(cwdCopy, "/") == 0 && strcmp(directory, "") == 0))
-	{	
-		// Return 0 for the root's directoryDescriptor
-		return 0;
-	}
-	
-	// If directory is null, remove the last / since fsFat12Open will add one
-	if(directory[0] == '\0')
+	// If directory is null we are opening the current directory itself, so remove 
+	// the last / (unless it is the root) since vfsOpen will add one
+	if(directory[0] == '\0' && cwdLength > 1)
 	{		
 		// Change the last / to a terminator
 		cwdCopy[cwdLength - 1] = '\0';
 	}
 	
 	// Open directory	
-	f = fsFat12Open(cwdCopy, directory, 1);			
+	f = vfsOpen(cwdCopy, directory, 1, 0);
 	if (f == 0)
 	{
-		// Just exit and show an error message so we don't get confused with the root
+		// Just exit and show an error message
 		cprintf("Failed to open directory\n");
-		// Errors without this return
 		return -1;
 	} 
-	else
+	f->Readable = 1;
+	f->Writable = 0;
+	
+	// Set unique descriptor
+	uniqueDescriptor = fdalloc(f);
+	if (uniqueDescriptor < 0)
 	{
-		// Set unique descriptor
-		uniqueDescriptor = fdalloc(f);
-	}	
-		
+		fileClose(f);
+		return -1;
+	}
+	
 	// Return the unique Descriptor if it opened up fine
 	return uniqueDescriptor; 
 }
  
 int sys_readdir(void)
 {
-	int directoryDescriptor;
-    DirectoryEntry *dirEntry;
+	File *directory;
+	DirectoryEntry *dirEntry;
+	int result = -1;
 	
-	if(argint(0, &directoryDescriptor) < 0 || argptr(1, (void*)&dirEntry, sizeof(*dirEntry)) < 0)
+	if(argfd(0, &directory) < 0)
 	{
 		return -1;
 	}
 	
-	if(directoryDescriptor == 0)
+	// Return -1 to say the directory is completely read
+	if (argptr(1, (void*)&dirEntry, sizeof(*dirEntry)) >= 0 && fileReadDirectory(directory, dirEntry, 1) == 1)
+	{
+		result = 0;
+	}
+	fileClose(directory);
+	return result;
+}
+
+// Read as many directory entries as will fit in the buffer, continuing from
+// where the last call left off.  At most MAXDIRENTRIES are read at once, so
+// that the size of the buffer that is checked cannot overflow.
+//
+// getdents(directoryDescriptor, entries, count) returns the number of entries
+// read, 0 at the end of the directory or -1 on error.
+
+int sys_getdents(void)
+{
+	File *directory;
+	DirectoryEntry *dirEntries;
+	int count;
+	int result = -1;
+	
+	if(argfd(0, &directory) < 0)
 	{
-		// Open root directory
-		fsFat12ReadRootDirectory(dirEntry);
-		
-		if(dirEntry->Filename[0] != '\0')
-		{
-			return 0;
-		}
 		return -1;
 	}
-	else
+	if (argint(2, &count) >= 0 && count >= 0)
 	{
-		// Fetch opened file and pass across results
-		Process *curproc = myProcess();
-		File *directory = curproc->OpenFile[directoryDescriptor];		
-			
-		// Start pulling contents from the directory and sending it back to LS	
-		unsigned char buffer[256];
-		
-		// Read the next chunk into the buffer (next file)
-		fsFat12Read(directory, buffer, 32);
-		
-		// Copy this to the passed in empty struct
-		DirectoryEntry *foundEntry = (DirectoryEntry *)buffer;
-		memmove((char *)dirEntry, (char *)foundEntry, sizeof(DirectoryEntry));
-	
-		// Return to say file is completely read
-		if(buffer[0] != '\0')
+		if (count > MAXDIRENTRIES)
 		{
-			return 0;
+			count = MAXDIRENTRIES;
 		}
-		return -1;
-	}	
+		if (argptr(1, (void*)&dirEntries, count * sizeof(DirectoryEntry)) >= 0)
+		{
+			result = fileReadDirectory(directory, dirEntries, count);
+		}
+	}
+	fileClose(directory);
+	return result;
 }
 
 int sys_closedir(void)
 {
 	int directoryDescriptor;
+	File * directory;
 
-	if(argint(0, &directoryDescriptor) < 0)
+	// Take the opened directory out of the descriptor table and close it
+	if (argint(0, &directoryDescriptor) < 0 || (directory = fdremove(directoryDescriptor)) == 0)
 	{
 		return -1;
 	}
-	
-	// Get current process 
-	Process *curproc = myProcess();	
-	
-	// Fetch the opened directory
-	File * directory = curproc->OpenFile[directoryDescriptor];	
-	
-	// Close it
 	fileClose(directory);
-	curproc->OpenFile[directoryDescriptor] = 0;	
 	return 0;
 }
+
+// Move data between a file and a pipe without copying it through user space.
+//
+// splice(fdIn, fdOut, n) returns the number of bytes moved, 0 at end of file
+// or -1 on error.
+
+int sys_splice(void)
+{
+	File *in;
+	File *out;
+	int n;
+	int result = -1;
+
+	if (argfd(0, &in) < 0)
+	{
+		return -1;
+	}
+	if (argfd(1, &out) < 0)
+	{
+		fileClose(in);
+		return -1;
+	}
+	if (argint(2, &n) >= 0)
+	{
+		result = fileSplice(in, out, n);
+	}
+	fileClose(in);
+	fileClose(out);
+	return result;
+}
+
+// Set the position of a file.
+//
+// lseek(fd, offset, whence) returns the new position or -1 on error.
+
+int sys_lseek(void)
+{
+	File *f;
+	int offset;
+	int whence;
+	int result = -1;
+
+	if (argfd(0, &f) < 0)
+	{
+		return -1;
+	}
+	if (argint(1, &offset) >= 0 && argint(2, &whence) >= 0)
+	{
+		result = fileSeek(f, offset, whence);
+	}
+	fileClose(f);
+	return result;
+}
+
+// Read from a file at a given offset without changing its position.
+//
+// pread(fd, buffer, n, offset)
+
+int sys_pread(void)
+{
+	File *f;
+	int n;
+	int offset;
+	char *p;
+	int result = -1;
+
+	if (argfd(0, &f) < 0)
+	{
+		return -1;
+	}
+	if (argint(2, &n) >= 0 && argptr(1, &p, n) >= 0 && argint(3, &offset) >= 0 && offset >= 0)
+	{
+		result = fileReadAt(f, p, n, offset);
+	}
+	fileClose(f);
+	return result;
+}
+
+// Write to a file at a given offset without changing its position.
+//
+// pwrite(fd, buffer, n, offset)
+
+int sys_pwrite(void)
+{
+	File *f;
+	int n;
+	int offset;
+	char *p;
+	int result = -1;
+
+	if (argfd(0, &f) < 0)
+	{
+		return -1;
+	}
+	if (argint(2, &n) >= 0 && argsrcptr(1, &p, n) >= 0 && argint(3, &offset) >= 0 && offset >= 0)
+	{
+		result = fileWriteAt(f, p, n, offset);
+	}
+	fileClose(f);
+	return result;
+}
+
+// Copy the vectors passed to readv or writev into iov, which has room for
+// MAXIOVECTORS, and check them.  write is 1 if the buffers will be written to.
+// Only the copy is used afterwards, since another thread could change the
+// vectors in user memory once they have been checked.  Returns the number of
+// vectors or -1 if any of them lie outside the process.
+
+static int argiovec(int n, IoVector *iov, int write)
+{
+	int count;
+	IoVector *uiov;
+	char *p;
+
+	if (argint(n + 1, &count) < 0 || count < 0 || count > MAXIOVECTORS)
+	{
+		return -1;
+	}
+	if (argsrcptr(n, (void*)&uiov, count * sizeof(IoVector)) < 0)
+	{
+		return -1;
+	}
+	memmove(iov, uiov, count * sizeof(IoVector));
+	for (int i = 0; i < count; i++)
+	{
+		if ((write ? fetchptr((uint32_t)iov[i].Base, &p, iov[i].Length) : fetchsrcptr((uint32_t)iov[i].Base, &p, iov[i].Length)) < 0)
+		{
+			return -1;
+		}
+		iov[i].Base = p;
+	}
+	return count;
+}
+
+// Read into several buffers with one call.
+//
+// readv(fd, vectors, count) returns the total number of bytes read.
+
+int sys_readv(void)
+{
+	File *f;
+	IoVector iov[MAXIOVECTORS];
+	int count;
+	int n;
+	int total = 0;
+
+	if ((count = argiovec(1, iov, 1)) < 0 || argfd(0, &f) < 0)
+	{
+		return -1;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		n = fileRead(f, iov[i].Base, iov[i].Length);
+		if (n < 0)
+		{
+			total = total > 0 ? total : -1;
+			break;
+		}
+		total += n;
+		if (n < iov[i].Length)
+		{
+			break;
+		}
+	}
+	fileClose(f);
+	return total;
+}
+
+// Write from several buffers with one call.
+//
+// writev(fd, vectors, count) returns the total number of bytes written.
+
+int sys_writev(void)
+{
+	File *f;
+	IoVector iov[MAXIOVECTORS];
+	int count;
+	int n;
+	int total = 0;
+
+	if ((count = argiovec(1, iov, 0)) < 0 || argfd(0, &f) < 0)
+	{
+		return -1;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		n = fileWrite(f, iov[i].Base, iov[i].Length);
+		if (n < 0)
+		{
+			total = total > 0 ? total : -1;
+			break;
+		}
+		total += n;
+		if (n < iov[i].Length)
+		{
+			break;
+		}
+	}
+	fileClose(f);
+	return total;
+}
+
+// Map a shared-memory I/O ring into the process (see ring.c).
+//
+// ringsetup(flags) returns the address of the ring or -1 on error.
+
+int sys_ringsetup(void)
+{
+	int flags;
+
+	if (argint(0, &flags) < 0)
+	{
+		return -1;
+	}
+	return ringSetup(flags);
+}
+
+// Carry out the requests queued in the I/O ring.
+//
+// ringenter() returns the number of requests carried out.
+
+int sys_ringenter(void)
+{
+	return ringDrain(0);
+}
+
+// Map part of a file into the process (see mmap.c).
+//
+// mmap(address, length, protection, flags, fd, offset) returns the address of
+// the mapping or -1 on error.  The address asked for is ignored.
+
+int sys_mmap(void)
+{
+	File *f;
+	int length;
+	int protection;
+	int flags;
+	int offset;
+	int result;
+
+	if (argint(1, &length) < 0 || argint(2, &protection) < 0 || argint(3, &flags) < 0 ||
+		argint(5, &offset) < 0 || argfd(4, &f) < 0)
+	{
+		return -1;
+	}
+	// The mapping takes its own reference to the file
+	result = mmapMap(f, length, protection, flags, offset);
+	fileClose(f);
+	return result;
+}
+
+// Remove a mapping made by mmap.
+//
+// munmap(address, length) returns 0 or -1 on error.
+
+int sys_munmap(void)
+{
+	int address;
+	int length;
+
+	if (argint(0, &address) < 0 || argint(1, &length) < 0)
+	{
+		return -1;
+	}
+	return mmapUnmap(address, length);
+}
+
+// Find or create a shared memory segment (see shm.c).
+//
+// shmget(key, size) returns the ID of the segment or -1 on error.
+
+int sys_shmget(void)
+{
+	int key;
+	int size;
+
+	if (argint(0, &key) < 0 || argint(1, &size) < 0)
+	{
+		return -1;
+	}
+	return shmGet(key, size);
+}
+
+// Map a shared memory segment into the process.
+//
+// shmat(id) returns the address of the segment or -1 on error.
+
+int sys_shmat(void)
+{
+	int id;
+
+	if (argint(0, &id) < 0)
+	{
+		return -1;
+	}
+	return mmapAttach(id);
+}
+
+// Remove a shared memory segment from the process.
+//
+// shmdt(address) returns 0 or -1 on error.
+
+int sys_shmdt(void)
+{
+	int address;
+
+	if (argint(0, &address) < 0)
+	{
+		return -1;
+	}
+	return mmapDetach(address);
+}
+
+// Remove a shared memory segment, so that it is freed once no process has it
+// attached.
+//
+// shmrm(id) returns 0 or -1 on error.
+
+int sys_shmrm(void)
+{
+	int id;
+
+	if (argint(0, &id) < 0)
+	{
+		return -1;
+	}
+	return shmRemove(id);
+}
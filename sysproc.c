@@ -5,6 +5,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 
 int sys_fork(void)
@@ -12,6 +14,75 @@ int sys_fork(void)
 	return fork();
 }
 
+// Create a thread.
+//
+// clone(entry, argument, stack) starts a thread running entry(argument) on
+// the page at stack and returns its process ID, or -1 on error.
+
+int sys_clone(void)
+{
+	int entry;
+	int argument;
+	char *stack;
+
+	if (argint(0, &entry) < 0 || argint(1, &argument) < 0 || argptr(2, &stack, PGSIZE) < 0)
+	{
+		return -1;
+	}
+	return clone(entry, argument, (uint32_t)stack);
+}
+
+// Wait for a thread to exit.
+//
+// join(&stack) returns the process ID of the thread and sets stack to the
+// stack that was given to clone, or returns -1 if there are no threads.
+
+int sys_join(void)
+{
+	uint32_t *stack;
+
+	if (argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+	{
+		return -1;
+	}
+	return join(stack);
+}
+
+// Wait on a futex (see futex.c).
+//
+// futexwait(address, value) sleeps if the word at address holds value.
+// Returns 0 when woken, or -1 if the word did not hold value.
+
+int sys_futexwait(void)
+{
+	char *address;
+	int value;
+
+	// The kernel only reads the word
+	if (argsrcptr(0, &address, sizeof(int)) < 0 || argint(1, &value) < 0)
+	{
+		return -1;
+	}
+	return futexWait((uint32_t)address, value);
+}
+
+// Wake a futex.
+//
+// futexwake(address, count) wakes up to count of the processes waiting on the
+// word at address and returns the number woken.
+
+int sys_futexwake(void)
+{
+	char *address;
+	int count;
+
+	if (argsrcptr(0, &address, sizeof(int)) < 0 || argint(1, &count) < 0)
+	{
+		return -1;
+	}
+	return futexWake((uint32_t)address, count);
+}
+
 int sys_exit(void)
 {
 	exit();
@@ -49,8 +120,7 @@ int sys_sbrk(void)
 	{
 		return -1;
 	}
-	addr = myProcess()->MemorySize;
-	if (growProcess(n) < 0)
+	if ((addr = growProcess(n)) < 0)
 	{
 		return -1;
 	}
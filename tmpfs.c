@@ -0,0 +1,347 @@
+// Memory-backed file system.
+//
+// tmpfs holds scratch files, such as the intermediate files of a pipeline,
+// in memory so that they never touch the disk.  It is mounted at TMPFSPATH
+// and its contents are lost when the machine is restarted.
+//
+// Each file or directory is a TmpNode.  The data of a file is kept in pages
+// from allocatePhysicalMemoryPage, which are found through a page of 
+// pointers, so files can be up to TMPMAXPAGES pages long.  Pages are only
+// allocated when they are written; the holes left by seeking past the end of
+// a file read as zeros.  Names are held in the same 8.3 form as on the FAT
+// disk and a hash table on the directory and name finds a node quickly.
+// The vnode of an open node is identified by its index in tmpfs.Node.
+//
+// tmpfs.Lock is held while nodes or their data are used.  It is a sleep lock
+// since data is copied straight to and from user memory.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "vfs.h"
+#include "tmpfs.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct
+{
+	Sleeplock		Lock;
+	TmpNode			Node[NTMPNODES];
+	TmpNode *		Hash[NTMPHASH];
+	TmpNode *		Root;
+} tmpfs;
+
+static FileSystemOperations tmpfsOperations;
+
+static uint32_t tmpfsHash(TmpNode * directory, const char * name)
+{
+	uint32_t hash = (uint32_t)(directory - tmpfs.Node);
+
+	for (int i = 0; i < 11; i++)
+	{
+		hash = hash * 31 + (uint8_t)name[i];
+	}
+	return hash % NTMPHASH;
+}
+
+// Find a name (in 8.3 form) in a directory.  tmpfs.Lock must be held.
+
+static TmpNode * tmpfsLookup(TmpNode * directory, const char * name)
+{
+	TmpNode * node;
+
+	for (node = tmpfs.Hash[tmpfsHash(directory, name)]; node != 0; node = node->HashNext)
+	{
+		if (node->Parent == directory && memcmp(node->Name, name, 11) == 0)
+		{
+			return node;
+		}
+	}
+	return 0;
+}
+
+// Add a new file or directory to a directory.  Returns 0 if there are no free
+// nodes.  tmpfs.Lock must be held.
+
+static TmpNode * tmpfsCreateNode(TmpNode * directory, const char * name, int isDirectory)
+{
+	TmpNode * node;
+	uint32_t hash;
+
+	for (node = tmpfs.Node; node < tmpfs.Node + NTMPNODES; node++)
+	{
+		if (!node->InUse)
+		{
+			break;
+		}
+	}
+	if (node == tmpfs.Node + NTMPNODES)
+	{
+		return 0;
+	}
+	memset(node, 0, sizeof(TmpNode));
+	node->InUse = 1;
+	node->Directory = isDirectory;
+	node->Parent = directory;
+	if (directory == 0)
+	{
+		return node;
+	}
+	memmove(node->Name, name, 11);
+	hash = tmpfsHash(directory, name);
+	node->HashNext = tmpfs.Hash[hash];
+	tmpfs.Hash[hash] = node;
+	if (directory->LastChild == 0)
+	{
+		directory->FirstChild = node;
+	}
+	else
+	{
+		directory->LastChild->NextSibling = node;
+	}
+	directory->LastChild = node;
+	return node;
+}
+
+void tmpfsInitialise(void)
+{
+	sleeplockInitialise(&tmpfs.Lock, "tmpfs");
+	tmpfs.Root = tmpfsCreateNode(0, 0, 1);
+	vfsMount(TMPFSPATH, &tmpfsOperations, 0);
+}
+
+//  Open a file or directory in tmpfs
+//
+//  mount     = Where tmpfs is mounted
+//  path      = The path of the file from TMPFSPATH, starting with a '\' or '/'
+//  directory = 1 if we are opening a directory, 0 otherwise
+//  create    = 1 to create the file if it does not exist
+//
+//  Returns the vnode of the file or 0 if it could not be found or created.
+
+static Vnode * tmpfsOpen(Mount * mount, char * path, int directory, int create)
+{
+	char pathPart[MAXCWDSIZE];
+	char name[11];
+	TmpNode * node;
+	TmpNode * next;
+	Vnode * vnode;
+	char * p = path;
+	int partLength;
+
+	sleeplockAcquire(&tmpfs.Lock);
+	node = tmpfs.Root;
+	while (*p != 0)
+	{
+		// Move past the '/' or '\'
+		p++;
+		partLength = fsGetPathPart(p, pathPart);
+		if (pathPart[0] == 0 || strncmp(pathPart, ".", 2) == 0)
+		{
+			// Nothing to do
+		}
+		else if (strncmp(pathPart, "..", 3) == 0)
+		{
+			if (node->Parent != 0)
+			{
+				node = node->Parent;
+			}
+		}
+		else
+		{
+			toDosFileName(pathPart, name, 11);
+			if ((next = tmpfsLookup(node, name)) == 0)
+			{
+				// Only the last part of the path can be created
+				if (!create || partLength != 0 || directory ||
+					(next = tmpfsCreateNode(node, name, 0)) == 0)
+				{
+					sleeplockRelease(&tmpfs.Lock);
+					return 0;
+				}
+			}
+			node = next;
+		}
+		if (partLength == 0)
+		{
+			break;
+		}
+		if (!node->Directory)
+		{
+			sleeplockRelease(&tmpfs.Lock);
+			return 0;
+		}
+		p += partLength;
+	}
+	if ((directory && !node->Directory) || (vnode = vfsGetVnode(mount, node - tmpfs.Node + 1)) == 0)
+	{
+		sleeplockRelease(&tmpfs.Lock);
+		return 0;
+	}
+	if (!vnode->Valid)
+	{
+		vnode->Node = node;
+		vnode->Directory = node->Directory;
+		vnode->Size = node->Size;
+		vfsVnodeFilled(vnode);
+	}
+	sleeplockRelease(&tmpfs.Lock);
+	return vnode;
+}
+
+// Read from a tmpfs file at the given offset
+
+static int tmpfsReadAt(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	TmpNode * node = vnode->Node;
+	char * page;
+	uint32_t pageOffset;
+	uint32_t readLength;
+	int totalRead = 0;
+
+	sleeplockAcquire(&tmpfs.Lock);
+	if (offset < node->Size)
+	{
+		length = min(length, node->Size - offset);
+		while (length > 0)
+		{
+			pageOffset = offset % PGSIZE;
+			readLength = min(length, PGSIZE - pageOffset);
+			page = node->Pages != 0 ? node->Pages[offset / PGSIZE] : 0;
+			if (page != 0)
+			{
+				memmove(buffer, page + pageOffset, readLength);
+			}
+			else
+			{
+				memset(buffer, 0, readLength);
+			}
+			buffer += readLength;
+			offset += readLength;
+			length -= readLength;
+			totalRead += readLength;
+		}
+	}
+	sleeplockRelease(&tmpfs.Lock);
+	return totalRead;
+}
+
+// Write to a tmpfs file at the given offset.  Returns the number of bytes 
+// written or -1 if nothing could be written because the file is too large or
+// there is no memory.
+
+static int tmpfsWriteAt(Vnode * vnode, char * buffer, int length, uint32_t offset)
+{
+	TmpNode * node = vnode->Node;
+	char ** page;
+	uint32_t pageOffset;
+	uint32_t writeLength;
+	int totalWritten = 0;
+
+	sleeplockAcquire(&tmpfs.Lock);
+	while (length > 0 && offset < TMPMAXPAGES * PGSIZE)
+	{
+		if (node->Pages == 0)
+		{
+			if ((node->Pages = (char **)allocatePhysicalMemoryPage()) == 0)
+			{
+				break;
+			}
+			memset(node->Pages, 0, PGSIZE);
+		}
+		page = &node->Pages[offset / PGSIZE];
+		if (*page == 0)
+		{
+			if ((*page = allocatePhysicalMemoryPage()) == 0)
+			{
+				break;
+			}
+			memset(*page, 0, PGSIZE);
+		}
+		pageOffset = offset % PGSIZE;
+		writeLength = min(length, PGSIZE - pageOffset);
+		memmove(*page + pageOffset, buffer, writeLength);
+		buffer += writeLength;
+		offset += writeLength;
+		length -= writeLength;
+		totalWritten += writeLength;
+		if (offset > node->Size)
+		{
+			node->Size = offset;
+		}
+	}
+	vnode->Size = node->Size;
+	sleeplockRelease(&tmpfs.Lock);
+	return (totalWritten > 0 || length == 0) ? totalWritten : -1;
+}
+
+// Truncate a tmpfs file to zero length, freeing its pages
+
+static int tmpfsTruncate(Vnode * vnode)
+{
+	TmpNode * node = vnode->Node;
+
+	sleeplockAcquire(&tmpfs.Lock);
+	if (node->Pages != 0)
+	{
+		for (int i = 0; i < TMPMAXPAGES; i++)
+		{
+			if (node->Pages[i] != 0)
+			{
+				freePhysicalMemoryPage(node->Pages[i]);
+			}
+		}
+		freePhysicalMemoryPage((char *)node->Pages);
+		node->Pages = 0;
+	}
+	node->Size = 0;
+	vnode->Size = 0;
+	sleeplockRelease(&tmpfs.Lock);
+	return 0;
+}
+
+// Read up to count directory entries from the current position of a tmpfs
+// directory, in the same form as the entries of a FAT directory.  The position
+// is the number of entries read so far.  Returns the number of entries read,
+// which is 0 once the end of the directory has been reached.
+
+static int tmpfsReadDirectory(File * directory, DirectoryEntry * directoryEntries, int count)
+{
+	TmpNode * node;
+	uint32_t index = 0;
+	int found = 0;
+
+	sleeplockAcquire(&tmpfs.Lock);
+	for (node = directory->Vnode->Node->FirstChild; node != 0 && index < directory->Position; node = node->NextSibling)
+	{
+		index++;
+	}
+	for (; node != 0 && found < count; node = node->NextSibling)
+	{
+		memset(&directoryEntries[found], 0, sizeof(DirectoryEntry));
+		memmove(directoryEntries[found].Filename, node->Name, 8);
+		memmove(directoryEntries[found].Ext, node->Name + 8, 3);
+		directoryEntries[found].Attrib = node->Directory ? 0x10 : 0x20;
+		directoryEntries[found].FileSize = node->Size;
+		found++;
+	}
+	directory->Position += found;
+	sleeplockRelease(&tmpfs.Lock);
+	return found;
+}
+
+static FileSystemOperations tmpfsOperations =
+{
+	.Name = "tmpfs",
+	.Open = tmpfsOpen,
+	.ReadAt = tmpfsReadAt,
+	.WriteAt = tmpfsWriteAt,
+	.Truncate = tmpfsTruncate,
+	.ReadDirectory = tmpfsReadDirectory
+};
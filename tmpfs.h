@@ -0,0 +1,20 @@
+// Memory-backed file system (see tmpfs.c)
+
+#define TMPFSPATH		"/tmp"		// Where tmpfs is mounted
+#define NTMPNODES		128			// Files and directories in tmpfs
+#define NTMPHASH		64			// Buckets in the directory hash table
+#define TMPMAXPAGES		(PGSIZE / sizeof(char *))	// Pages in the largest file
+
+struct _TmpNode
+{
+	int				InUse;
+	int				Directory;
+	char			Name[11];		// 8.3 name, as in a FAT directory entry
+	uint32_t		Size;
+	char **			Pages;			// Page of pointers to the pages holding the data (0 if none)
+	TmpNode *		Parent;
+	TmpNode *		HashNext;		// Next node in the same bucket of the directory hash table
+	TmpNode *		FirstChild;		// Contents of a directory, in the order they were created
+	TmpNode *		LastChild;
+	TmpNode *		NextSibling;
+};
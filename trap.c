@@ -3,14 +3,16 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint32_t vectors[];  // in vectors.S: array of 256 entry pointers
+extern void sysenter(void);	// in trapasm.asm: SYSENTER entry point
 Spinlock tickslock;
 uint32_t ticks;
 
@@ -31,6 +33,44 @@ void interruptDescriptorTableInitialise(void)
 	loadInterruptDescriptorTable(idt, sizeof(idt));
 }
 
+// Set up the fast system call path on this CPU if it supports SYSENTER.
+// The kernel stack pointer is set each time a process is switched to
+// (see switchToUserVirtualMemory).  SYSEXIT relies on the user code and
+// data segments following the kernel code and data segments in the GDT.
+
+void sysenterInitialise(void)
+{
+	uint32_t features;
+
+	readCpuId(1, 0, 0, 0, &features);
+	if ((features & CPUID_SEP) == 0)
+	{
+		return;
+	}
+	writeModelSpecificRegister(MSR_SYSENTER_CS, SEG_KCODE << 3);
+	writeModelSpecificRegister(MSR_SYSENTER_ESP, 0);
+	writeModelSpecificRegister(MSR_SYSENTER_EIP, (uint32_t)sysenter);
+	myCpu()->SysenterEnabled = 1;
+}
+
+// System calls made with SYSENTER come here rather than to trap().
+// sysenter in trapasm.asm builds the same trap frame as int T_SYSCALL,
+// so the system calls fetch their arguments in the same way.
+
+void sysenterTrap(struct Trapframe *tf)
+{
+	if (myProcess()->IsKilled)
+	{
+		exit();
+	}
+	myProcess()->Trapframe = tf;
+	syscall();
+	if (myProcess()->IsKilled)
+	{
+		exit();
+	}
+}
+
 void trap(struct Trapframe *tf)
 {
 	if (tf->trapno == T_SYSCALL) 
@@ -86,6 +126,14 @@ void trap(struct Trapframe *tf)
 			localApicEndOfInterrupt();
 			break;
 
+		case T_PGFLT:
+			// A page of a mapped file that has not been touched yet
+			if (myProcess() != 0 && (tf->cs & 3) == DPL_USER && mmapPageFault(readControlRegister2(), (tf->err & 2) != 0) == 0)
+			{
+				break;
+			}
+			// Otherwise the fault is handled like any other trap
+
 		default:
 			if (myProcess() == 0 || (tf->cs & 3) == 0) 
 			{
@@ -31,3 +31,50 @@ _trapret:
 	pop		ds
 	add		esp, 8		; Move past trapno and errcode
 	iret
+
+; System calls made with SYSENTER enter here, on the kernel stack given by
+; MSR_SYSENTER_ESP and with interrupts disabled.  The user stub passes its
+; stack pointer in ecx and the address to return to in edx.
+
+extern _sysenterTrap
+
+global _sysenter
+_sysenter:
+	; Build a trap frame that looks like the one built by int T_SYSCALL
+	push	dword 23h	; user ss: (SEG_UDATA << 3) | DPL_USER
+	push	ecx			; user esp
+	pushfd
+	or		dword [esp], 200h	; FL_IF: interrupts are enabled in user space
+	push	dword 1Bh	; user cs: (SEG_UCODE << 3) | DPL_USER
+	push	edx			; user eip
+	push	dword 0		; errcode
+	push	dword 64	; trapno: T_SYSCALL
+	push	ds
+	push	es
+	push	fs
+	push	gs
+	pushad
+
+	; Set up data segments.
+	mov		ax, 10h		; SEG_KDATA << 3
+	mov		ds, ax
+	mov		es, ax
+	sti
+
+	; Call sysenterTrap(tf), where tf=%esp
+	push	esp
+	call	_sysenterTrap
+	add		esp, 4
+
+	; Return with SYSEXIT, using the (possibly updated) eip and esp in the trap frame
+	cli
+	popad
+	pop		gs
+	pop		fs
+	pop		es
+	pop		ds
+	add		esp, 8		; Move past trapno and errcode
+	mov		edx, dword [esp]		; eip
+	mov		ecx, dword [esp + 12]	; esp
+	sti					; Interrupts are not enabled until after sysexit
+	sysexit
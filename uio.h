@@ -0,0 +1,9 @@
+// Scatter/gather vector used by readv and writev
+
+#define MAXIOVECTORS  16  // max vectors in one readv or writev
+
+struct _IoVector
+{
+	void *		Base;
+	uint32_t	Length;
+};
@@ -56,18 +56,46 @@ char* strchr(const char *s, char c)
 	return 0;
 }
 
+// Standard input is read a buffer at a time rather than a byte at a time when it
+// is a device (the console), which only gives a line at a time anyway.  Other
+// files are read a byte at a time, so that no more is taken than the line read;
+// the rest is left for the programs that the caller may run, and is not copied
+// by fork.
+
+#define INPUT_UNKNOWN	0	// Not yet known what standard input is
+#define INPUT_DEVICE	1	// Read ahead
+#define INPUT_FILE		2	// Read a byte at a time
+
+static char		inputBuffer[512];
+static int		inputCount;
+static int		inputPosition;
+static int		inputMode;
+
 char* gets(char *buf, int max)
 {
-	int i, cc;
+	int i;
 	char c;
+	struct _Stat st;
 
+	// Make sure any prompt has been written before we wait for input
+	flushall();
+	if (inputMode == INPUT_UNKNOWN)
+	{
+		inputMode = (fstat(0, &st) == 0 && st.type == T_DEV) ? INPUT_DEVICE : INPUT_FILE;
+	}
 	for (i = 0; i + 1 < max; ) 
 	{
-		cc = read(0, &c, 1);
-		if (cc < 1)
+		if (inputPosition == inputCount)
 		{
-			break;
+			inputCount = read(0, inputBuffer, inputMode == INPUT_DEVICE ? sizeof(inputBuffer) : 1);
+			inputPosition = 0;
+			if (inputCount < 1)
+			{
+				inputCount = 0;
+				break;
+			}
 		}
+		c = inputBuffer[inputPosition++];
 		buf[i++] = c;
 		if (c == '\n' || c == '\r')
 		{
@@ -78,19 +106,25 @@ char* gets(char *buf, int max)
 	return buf;
 }
 
-int stat(char *n, struct _Stat *st)
+// exit, exec and spawn flush buffered output before making the system call
+// so that output is not lost or written twice.  fork and close are in printf.c.
+
+int exit(void)
 {
-	int fd;
-	int r;
+	flushall();
+	_exit();
+}
 
-	fd = open(n, O_RDONLY);
-	if (fd < 0)
-	{
-		return -1;
-	}
-	r = fstat(fd, st);
-	close(fd);
-	return r;
+int exec(char *path, char **argv)
+{
+	flushall();
+	return _exec(path, argv);
+}
+
+int spawn(char *path, char **argv, struct _SpawnAction *actions, int count)
+{
+	flushall();
+	return _spawn(path, argv, actions, count);
 }
 
 int atoi(const char *s)
@@ -117,3 +151,99 @@ void* memmove(void *vdst, void *vsrc, int n)
 	}
 	return vdst;
 }
+
+// Locks built on futexes.  A lock is taken with an atomic operation on its
+// word and the kernel is only entered to wait for it or to wake a waiter.
+
+// A mutex is 0 when unlocked, 1 when locked and 2 when locked with processes
+// that may be waiting for it.  Waiters always set it to 2, so that the 
+// process that unlocks it knows that it has to wake one of them.
+
+void mutexLock(Mutex *m)
+{
+	int state = atomicCompareExchange(&m->State, 0, 1);
+
+	if (state == 0)
+	{
+		return;
+	}
+	if (state != 2)
+	{
+		state = atomicExchange((volatile uint32_t *)&m->State, 2);
+	}
+	while (state != 0)
+	{
+		futexwait((int *)&m->State, 2);
+		state = atomicExchange((volatile uint32_t *)&m->State, 2);
+	}
+}
+
+void mutexUnlock(Mutex *m)
+{
+	if (atomicAdd(&m->State, -1) != 1)
+	{
+		m->State = 0;
+		futexwake((int *)&m->State, 1);
+	}
+}
+
+// Wait for a condition to be signalled.  m must be locked, and is unlocked
+// while waiting.  As with any condition variable, the caller must check again
+// whatever it was waiting for.
+
+void conditionWait(Condition *c, Mutex *m)
+{
+	int sequence = c->Sequence;
+
+	mutexUnlock(m);
+	futexwait((int *)&c->Sequence, sequence);
+
+	// Other processes may be waiting for the mutex too
+	while (atomicExchange((volatile uint32_t *)&m->State, 2) != 0)
+	{
+		futexwait((int *)&m->State, 2);
+	}
+}
+
+void conditionSignal(Condition *c)
+{
+	atomicAdd(&c->Sequence, 1);
+	futexwake((int *)&c->Sequence, 1);
+}
+
+void conditionBroadcast(Condition *c)
+{
+	atomicAdd(&c->Sequence, 1);
+	futexwake((int *)&c->Sequence, 0x7FFFFFFF);
+}
+
+// Set up a barrier that releases the threads waiting at it once count of
+// them have arrived
+
+void barrierInitialise(Barrier *b, int count)
+{
+	memset(b, 0, sizeof(Barrier));
+	b->Total = count;
+}
+
+void barrierWait(Barrier *b)
+{
+	int generation;
+
+	mutexLock(&b->Lock);
+	generation = b->Generation;
+	if (++b->Count == b->Total)
+	{
+		b->Count = 0;
+		b->Generation++;
+		conditionBroadcast(&b->Released);
+	}
+	else
+	{
+		while (generation == b->Generation)
+		{
+			conditionWait(&b->Released, &b->Lock);
+		}
+	}
+	mutexUnlock(&b->Lock);
+}
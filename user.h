@@ -1,5 +1,8 @@
 struct _Stat;
 struct _DirectoryEntry;
+struct _IoVector;
+struct _Ring;
+struct _SpawnAction;
 
 // System calls.  If you add any new system calls to UoDOS, the signature of the calls for
 // user programs should be added here, as well as adding them to syscalls.pl.
@@ -31,12 +34,64 @@ int getcwd(char*, int);
 int opendir(char*);
 int readdir(int, struct _DirectoryEntry*);
 int closedir(int);
+int getdents(int, struct _DirectoryEntry*, int);
+int splice(int, int, int);
+int lseek(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int readv(int, struct _IoVector*, int);
+int writev(int, struct _IoVector*, int);
+struct _Ring* ringsetup(int);
+int ringenter(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int stat(char*, struct _Stat*);
+int clone(void (*)(void*), void*, void*);
+int join(void**);
+int futexwait(int*, int);
+int futexwake(int*, int);
+int spawn(char*, char**, struct _SpawnAction*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+
+// System calls that are wrapped by the C run-time library so that buffered
+// output can be flushed first.  Programs should normally call exit, fork, exec,
+// close and spawn.
+
+int _exit(void) __attribute__((noreturn));
+int _fork(void);
+int _exec(char*, char**);
+int _close(int);
+int _spawn(char*, char**, struct _SpawnAction*, int);
+
+// Locks for threads, and for processes sharing memory, built on futexes.  
+// A Mutex or Condition that is all zero is ready to use.
+
+typedef struct _Mutex
+{
+	volatile int		State;		// 0 = unlocked, 1 = locked, 2 = locked and there may be waiters
+} Mutex;
+
+typedef struct _Condition
+{
+	volatile int		Sequence;	// Changed by every signal
+} Condition;
+
+typedef struct _Barrier
+{
+	Mutex				Lock;
+	Condition			Released;
+	int					Total;		// Number of threads that wait at the barrier
+	int					Count;		// Number waiting now
+	int					Generation;	// Changed each time the barrier is released
+} Barrier;
 
 // The following are C standard library functions implemented in our
 // equivalent of the C run-time library
 
 // ulib.c
-int stat(char*, struct _Stat*);
 char* strcpy(char*, char*);
 void *memmove(void*, void*, int);
 char* strchr(const char*, char c);
@@ -47,6 +102,15 @@ void* memset(void*, int, uint32_t);
 void* malloc(uint32_t);
 void free(void*);
 int atoi(const char*);
+void mutexLock(Mutex*);
+void mutexUnlock(Mutex*);
+void conditionWait(Condition*, Mutex*);
+void conditionSignal(Condition*);
+void conditionBroadcast(Condition*);
+void barrierInitialise(Barrier*, int);
+void barrierWait(Barrier*);
 
 // printf.c
 void printf(char*, ...);
+void fflush(int);
+void flushall(void);
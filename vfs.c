@@ -0,0 +1,279 @@
+// Virtual file system.
+//
+// Each type of file system provides a FileSystemOperations table and is
+// mounted at a path.  vfsOpen finds the file system that a path is in from 
+// the mount table and asks it to open the file, which it returns as a vnode.
+// The rest of the kernel then only uses the file system through the 
+// operations table of the vnode's mount.
+//
+// Vnodes are kept in a cache.  A file system identifies each of its files 
+// and directories with a number, and vfsGetVnode returns the vnode already in
+// use for that number if there is one.  The vnode stays in the cache while it 
+// has references and is then reused.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "stat.h"
+#include "file.h"
+#include "vfs.h"
+
+struct
+{
+	Spinlock		Lock;
+	Mount			Mount[NMOUNT];
+	int				MountCount;
+	Vnode			Vnode[NVNODE];
+} vfs;
+
+void vfsInitialise(void)
+{
+	spinlockInitialise(&vfs.Lock, "vfs");
+}
+
+// Mount a file system at path.  The file system must have been set up on
+// the device already.
+
+void vfsMount(const char * path, FileSystemOperations * operations, uint32_t device)
+{
+	Mount * mount;
+
+	spinlockAcquire(&vfs.Lock);
+	if (vfs.MountCount == NMOUNT)
+	{
+		panic("vfsMount: too many file systems");
+	}
+	mount = &vfs.Mount[vfs.MountCount++];
+	safestrcpy(mount->Path, path, MAXMOUNTPATH);
+	mount->Operations = operations;
+	mount->Device = device;
+	spinlockRelease(&vfs.Lock);
+}
+
+// If path is in the file system mounted at mountPath, return the part of it
+// after mountPath, otherwise 0.  Upper and lower case are the same, as they 
+// are on the FAT disk.
+
+static char * vfsPathInside(const char * mountPath, char * path)
+{
+	char * p = path;
+	char c;
+	char m;
+
+	if (strncmp(mountPath, "/", 2) == 0)
+	{
+		return path;
+	}
+	while (*mountPath != 0)
+	{
+		c = *p == '\\' ? '/' : *p;
+		m = *mountPath;
+		if (c >= 'A' && c <= 'Z')
+		{
+			c += 'a' - 'A';
+		}
+		if (m >= 'A' && m <= 'Z')
+		{
+			m += 'a' - 'A';
+		}
+		if (c != m)
+		{
+			return 0;
+		}
+		p++;
+		mountPath++;
+	}
+	if (*p != 0 && *p != '/' && *p != '\\')
+	{
+		return 0;
+	}
+	return p;
+}
+
+// Find the vnode for a file or directory, with a reference to it.  The 
+// arguments are the same as for vfsOpen.
+
+static Vnode * vfsLookup(const char * cwd, const char * filename, int directory, int create)
+{
+	char path[MAXCWDSIZE];
+	Mount * mount = 0;
+	char * inside = 0;
+	char * p;
+
+	if (*filename == '\\' || *filename == '/')
+	{
+		safestrcpy(path, filename, MAXCWDSIZE);
+	}
+	else
+	{
+		safestrcpy(path, cwd, MAXCWDSIZE);
+		int cwdLen = strlen(cwd);
+		safestrcpy(path + cwdLen, filename, MAXCWDSIZE - cwdLen);
+	}
+	// Use the file system mounted at the longest path that matches
+	spinlockAcquire(&vfs.Lock);
+	for (int i = 0; i < vfs.MountCount; i++)
+	{
+		if ((p = vfsPathInside(vfs.Mount[i].Path, path)) != 0 && (inside == 0 || p > inside))
+		{
+			mount = &vfs.Mount[i];
+			inside = p;
+		}
+	}
+	spinlockRelease(&vfs.Lock);
+	if (mount == 0)
+	{
+		return 0;
+	}
+	// The file system is given the path from its root, which always starts with a '/'
+	if (*inside == 0)
+	{
+		inside = "/";
+	}
+	return mount->Operations->Open(mount, inside, directory, create);
+}
+
+//  Open a file or directory
+//
+//  cwd = 		The current working directory
+//  filename  = The path of the file to open.  If it does not begin with a '\' or '/'. we prepend cwd to the filename
+//  directory = 1 if we are opening a directory, 0 otherwise
+//  create    = 1 to create the file if it does not exist
+//
+//  Returns 0 if the file could not be found or created.
+
+File * vfsOpen(const char * cwd, const char * filename, int directory, int create)
+{
+	Vnode * vnode;
+	File * file;
+
+	if ((vnode = vfsLookup(cwd, filename, directory, create)) == 0)
+	{
+		return 0;
+	}
+	if ((file = allocateFileStructure()) == 0)
+	{
+		vfsReleaseVnode(vnode);
+		return 0;
+	}
+	safestrcpy(file->Name, filename, sizeof(file->Name));
+	file->Type = vnode->Directory ? FD_DIR : FD_FILE;
+	file->Vnode = vnode;
+	file->Position = 0;
+	file->Eof = 0;
+	return file;
+}
+
+// Get the details of an open file or directory from its vnode.  Nothing is
+// read from the disk.
+
+void vfsStat(Vnode * vnode, Stat * st)
+{
+	memset(st, 0, sizeof(*st));
+	st->type = vnode->Directory ? T_DIR : T_FILE;
+	st->dev = vnode->Mount->Device;
+	st->ino = vnode->Id;
+	st->nlink = 1;
+	st->size = vnode->Size;
+	if (vnode->Mount->Operations->Stat != 0)
+	{
+		vnode->Mount->Operations->Stat(vnode, st);
+	}
+}
+
+// Get the details of a file or directory from its path without opening it.
+// Returns -1 if it cannot be found.
+
+int vfsStatPath(const char * cwd, const char * filename, Stat * st)
+{
+	Vnode * vnode;
+
+	if ((vnode = vfsLookup(cwd, filename, 0, 0)) == 0)
+	{
+		return -1;
+	}
+	vfsStat(vnode, st);
+	vfsReleaseVnode(vnode);
+	return 0;
+}
+
+// Get the vnode for object id of the file system mounted at mount, with a 
+// reference to it.  If the vnode was not in use already, Valid is 0 and the
+// file system must fill it in and then call vfsVnodeFilled.  Anyone else who
+// gets the vnode meanwhile waits until then, so that only one caller fills it
+// in.  Returns 0 if there are no free vnodes.
+
+Vnode * vfsGetVnode(Mount * mount, uint32_t id)
+{
+	Vnode * vnode;
+	Vnode * empty = 0;
+
+	spinlockAcquire(&vfs.Lock);
+	for (vnode = vfs.Vnode; vnode < vfs.Vnode + NVNODE; vnode++)
+	{
+		if (vnode->ReferenceCount > 0 && vnode->Mount == mount && vnode->Id == id)
+		{
+			vnode->ReferenceCount++;
+			while (!vnode->Valid)
+			{
+				sleep(vnode, &vfs.Lock);
+			}
+			spinlockRelease(&vfs.Lock);
+			return vnode;
+		}
+		if (empty == 0 && vnode->ReferenceCount == 0)
+		{
+			empty = vnode;
+		}
+	}
+	if (empty != 0)
+	{
+		memset(empty, 0, sizeof(Vnode));
+		empty->ReferenceCount = 1;
+		empty->Mount = mount;
+		empty->Id = id;
+	}
+	spinlockRelease(&vfs.Lock);
+	return empty;
+}
+
+// Mark a vnode that vfsGetVnode returned with Valid 0 as filled in, and wake
+// anyone waiting for it
+
+void vfsVnodeFilled(Vnode * vnode)
+{
+	spinlockAcquire(&vfs.Lock);
+	vnode->Valid = 1;
+	wakeup(vnode);
+	spinlockRelease(&vfs.Lock);
+}
+
+// Take another reference to a vnode
+
+Vnode * vfsDupVnode(Vnode * vnode)
+{
+	spinlockAcquire(&vfs.Lock);
+	if (vnode->ReferenceCount < 1)
+	{
+		panic("vfsDupVnode");
+	}
+	vnode->ReferenceCount++;
+	spinlockRelease(&vfs.Lock);
+	return vnode;
+}
+
+// Drop a reference to a vnode
+
+void vfsReleaseVnode(Vnode * vnode)
+{
+	spinlockAcquire(&vfs.Lock);
+	if (vnode->ReferenceCount < 1)
+	{
+		panic("vfsReleaseVnode");
+	}
+	vnode->ReferenceCount--;
+	spinlockRelease(&vfs.Lock);
+}
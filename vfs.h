@@ -0,0 +1,54 @@
+// Virtual file system (see vfs.c)
+
+#define MAXMOUNTPATH	32		// Longest path a file system can be mounted at
+
+// The operations provided by a type of file system.  Operations that a file
+// system does not support are 0.
+
+struct _FileSystemOperations
+{
+	char *			Name;
+	Vnode *			(*Open)(Mount *, char *, int, int);
+	int				(*ReadAt)(Vnode *, char *, int, uint32_t);
+	int				(*WriteAt)(Vnode *, char *, int, uint32_t);
+	int				(*Truncate)(Vnode *);
+	int				(*ReadDirectory)(File *, DirectoryEntry *, int);
+	int				(*MapPage)(Vnode *, uint32_t, uint32_t *, int);	// File data is kept in the page cache (see pagecache.c)
+	void			(*Stat)(Vnode *, Stat *);		// Fill in the details of a file that only the file system knows
+	void			(*Close)(File *);
+};
+
+// A mounted file system
+
+struct _Mount
+{
+	char						Path[MAXMOUNTPATH];	// Where the file system is mounted ("/" for the root)
+	FileSystemOperations *		Operations;
+	uint32_t					Device;
+};
+
+// An open file or directory.  There is only one vnode for each object however
+// many times it is open, so the size of a file and the parts of it that have
+// been found on the disk are shared by all of the file structures using it.
+
+struct _Vnode
+{
+	int					ReferenceCount;
+	Mount *				Mount;
+	uint32_t			Id;						// Identifies the object in its file system (0 if the vnode is not in the cache)
+	int					Valid;					// The file system has filled in the vnode
+	int					Directory;
+	uint32_t			Size;
+
+	// Used by FAT file systems
+	DirectoryEntry		DirectoryEntry;
+	ClusterRun			ClusterRuns[NCLUSTERRUNS];	// Parts of the cluster chain found so far
+	uint32_t			NextClusterRun;			// Entry of ClusterRuns to be replaced next
+	uint32_t			DirectorySector;		// Sector holding the directory entry (0 for the root directory)
+	uint32_t			DirectoryOffset;		// Offset of the directory entry in DirectorySector
+	uint32_t			DirectoryEntryChanged;	// The directory entry needs to be written back
+	uint32_t			Delayed;				// Data has been written past the end of the clusters of the file
+
+	// Used by tmpfs
+	TmpNode *			Node;
+};
@@ -4,6 +4,8 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
 #include "file.h"
@@ -199,6 +201,11 @@ void switchToUserVirtualMemory(Process *p)
 	// forbids I/O instructions (e.g., inb and outb) from user space
 	myCpu()->Taskstate.iomb = (uint16_t)0xFFFF;
 	loadTaskRegister(SEG_TSS << 3);
+	if (myCpu()->SysenterEnabled)
+	{
+		// SYSENTER does not use the TSS, so tell it where the kernel stack is
+		writeModelSpecificRegister(MSR_SYSENTER_ESP, (uint32_t)p->KernelStack + KSTACKSIZE);
+	}
 	loadControlRegister3(V2P(p->PageTable));  // switch to process's address space
 	popCli();
 }
@@ -255,8 +262,7 @@ int loadProgramSegmentIntoPageTable(pde_t *pgdir, char *addr, File *f, uint32_t
 		}
 		else
 		{
-			f->Position = offset + i;
-			if (fileRead(f, P2V(pa), n) != n)
+			if (fileReadAt(f, P2V(pa), n, offset + i) != n)
 			{
 				return -1;
 			}
@@ -426,7 +432,7 @@ char* mapVirtualAddressToKernelAddress(pde_t *pgdir, char *uva)
 	pte_t *pte;
 
 	pte = getPageTableEntry(pgdir, uva, 0);
-	if ((*pte & PTE_P) == 0)
+	if (pte == 0 || (*pte & PTE_P) == 0)
 	{
 		return 0;
 	}
@@ -437,6 +443,33 @@ char* mapVirtualAddressToKernelAddress(pde_t *pgdir, char *uva)
 	return (char*)P2V(PTE_ADDR(*pte));
 }
 
+// Map the page of physical memory at kernel address page at user address va.
+// Used for pages that are not part of the process memory, such as the pages
+// of mapped files.
+
+int mapUserPage(pde_t *pgdir, uint32_t va, char *page, int writable)
+{
+	return createPageTableEntries(pgdir, (void*)va, PGSIZE, V2P(page), PTE_U | (writable ? PTE_W : 0));
+}
+
+// Remove the page mapped at user address va without freeing it.  Returns
+// the kernel address of the page or 0 if no page was mapped there.
+
+char* unmapUserPage(pde_t *pgdir, uint32_t va)
+{
+	pte_t *pte;
+	char *page;
+
+	pte = getPageTableEntry(pgdir, (char*)va, 0);
+	if (pte == 0 || (*pte & PTE_P) == 0)
+	{
+		return 0;
+	}
+	page = (char*)P2V(PTE_ADDR(*pte));
+	*pte = 0;
+	return page;
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // mapVirtualAddressToKernelAddress ensures this only works for PTE_U pages.
@@ -115,6 +115,29 @@ static inline uint32_t atomicExchange(volatile uint32_t *addr, uint32_t newval)
 	return result;
 }
 
+// If *addr holds expected, replace it with newval as one locked operation.  
+// Returns what *addr held before.
+
+static inline int atomicCompareExchange(volatile int *addr, int expected, int newval)
+{
+	asm volatile("lock; cmpxchgl %2, %1" :
+		"+a" (expected), "+m" (*addr) :
+		"r" (newval) :
+		"memory", "cc");
+	return expected;
+}
+
+// Add value to *addr as one locked operation and return what *addr held before
+
+static inline int atomicAdd(volatile int *addr, int value)
+{
+	asm volatile("lock; xaddl %0, %1" :
+		"+r" (value), "+m" (*addr) :
+		:
+		"memory", "cc");
+	return value;
+}
+
 static inline uint32_t readControlRegister2(void)
 {
 	uint32_t val;
@@ -127,6 +150,34 @@ static inline void loadControlRegister3(uint32_t val)
 	asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline void readCpuId(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	asm volatile("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (info));
+	if (eaxp)
+	{
+		*eaxp = eax;
+	}
+	if (ebxp)
+	{
+		*ebxp = ebx;
+	}
+	if (ecxp)
+	{
+		*ecxp = ecx;
+	}
+	if (edxp)
+	{
+		*edxp = edx;
+	}
+}
+
+static inline void writeModelSpecificRegister(uint32_t msr, uint32_t val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "a" (val), "d" (0));
+}
+
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
 